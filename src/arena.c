@@ -0,0 +1,90 @@
+/**
+ * RBML assembly language compiler: allocation arena
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "rbmlc.h"
+
+/**
+ * Chunk size (bytes); larger allocations get a chunk of their own
+ */
+#define ARENA_CHUNK_SIZE	(64 * 1024)
+
+/**
+ * Alignment of allocations
+ */
+#define ARENA_ALIGN		sizeof(void *)
+
+/**
+ * Arena chunk, followed by its memory
+ */
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;		/**< memory size (bytes) */
+};
+
+/**
+ * Init arena
+ */
+void
+arena_init(struct arena *a)
+{
+	memset(a, 0, sizeof(*a));
+}
+
+/**
+ * Free arena
+ */
+void
+arena_free(struct arena *a)
+{
+	struct arena_chunk *chunk;
+
+	while ((chunk = a->chunks) != NULL) {
+		a->chunks = chunk->next;
+		free(chunk);
+	}
+	arena_init(a);
+}
+
+/**
+ * Allocate memory from arena
+ */
+void *
+arena_alloc(struct arena *a, size_t size)
+{
+	struct arena_chunk *chunk;
+	size_t chunk_size;
+	void *p;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if ((size_t) (a->end - a->next) < size) {
+		chunk_size = size > ARENA_CHUNK_SIZE / 4 ? size : ARENA_CHUNK_SIZE;
+		chunk = calloc(1, sizeof(*chunk) + chunk_size);
+		if (chunk == NULL)
+			die("Failed to allocate memory: %s", strerror(errno));
+		chunk->size = chunk_size;
+
+		// a large allocation leaves the current chunk current
+		if (chunk_size != ARENA_CHUNK_SIZE && a->chunks != NULL) {
+			chunk->next = a->chunks->next;
+			a->chunks->next = chunk;
+			return chunk + 1;
+		}
+		chunk->next = a->chunks;
+		a->chunks = chunk;
+		a->next = (char *) (chunk + 1);
+		a->end = a->next + chunk_size;
+	}
+
+	p = a->next;
+	a->next += size;
+
+	return p;
+}
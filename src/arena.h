@@ -0,0 +1,42 @@
+/**
+ * RBML assembly language compiler: allocation arena
+ *
+ * Everything the assembler allocates for a compilation (symbols, their
+ * names, forward references) comes from one arena, carved out of large
+ * chunks and freed all at once.
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+struct arena_chunk;
+
+/**
+ * Arena
+ */
+struct arena {
+	struct arena_chunk *chunks;	/**< chunks, the current one first */
+	char *next;			/**< free space in the current chunk */
+	char *end;			/**< end of the current chunk */
+};
+
+/**
+ * Init arena
+ */
+void arena_init(struct arena *a);
+
+/**
+ * Free arena and everything allocated from it
+ */
+void arena_free(struct arena *a);
+
+/**
+ * Allocate zeroed memory from arena
+ */
+void *arena_alloc(struct arena *a, size_t size);
+
+#endif /* _ARENA_H_ */
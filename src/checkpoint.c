@@ -0,0 +1,236 @@
+/**
+ * RBML machine: checkpoint and restore
+ *
+ * A checkpoint file holds the whole state of a machine (see struct
+ * rbml_checkpoint_header). Main memory is stored page aligned, so that a
+ * restore maps it instead of reading it: restoring is about as cheap as
+ * loading a program, and any number of machines can be started from the
+ * same checkpoint.
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "machine_impl.h"
+
+/**
+ * Size of the zero page runs left as holes in the checkpoint (words)
+ */
+#define HOLE_WORDS	1024
+
+/**
+ * Is every word zero
+ */
+static int
+is_zero(const rbml_word *p, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (p[i] != 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Write checkpoint file
+ */
+int
+rbml_machine_checkpoint(struct rbml_machine *m, const char *checkpoint_file)
+{
+	struct rbml_checkpoint_header hdr;
+	size_t i, n, words;
+	FILE *fp;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, RBML_CHECKPOINT_MAGIC, sizeof(hdr.magic));
+	hdr.header_size = sizeof(hdr);
+
+	// an END at depth 0 pops call_stack[0] even when nothing was pushed
+	words = m->call_stack_counter > 0 ? m->call_stack_counter : 1;
+	hdr.memory_size = m->memory_size;
+	hdr.call_stack_words = words;
+	hdr.memory_offset = (sizeof(hdr) + words * sizeof(rbml_word) + RBML_CHECKPOINT_ALIGN - 1)
+	    & ~(uint64_t) (RBML_CHECKPOINT_ALIGN - 1);
+	hdr.instructions = m->instructions;
+
+	for (i = 0; i < countof(m->disk); i++) {
+		hdr.disk[i] = -1;
+		if (m->disk[i] == NULL)
+			continue;
+		if (m->disk[i]->fd < 0) {
+			fprintf(stderr, "Cannot checkpoint RAM disk %zu\n", i);
+			return -1;
+		}
+		// the file as it would be closed, for the restored machine to open
+		if (rbml_disk_sync(m, i) < 0) {
+			fprintf(stderr, "Failed to checkpoint disk %zu: %s\n", i, strerror(errno));
+			return -1;
+		}
+		hdr.disk[i] = m->disk[i]->pos * sizeof(rbml_word);
+	}
+
+	memcpy(hdr.reg, m->reg, sizeof(hdr.reg));
+	hdr.accumulator = m->accumulator;
+	hdr.jump = m->jump;
+	hdr.less = m->less;
+	hdr.equal = m->equal;
+	hdr.greater = m->greater;
+	hdr.overflow = m->overflow;
+	hdr.ioerr = m->ioerr;
+	hdr.divzero = m->divzero;
+	hdr.instruction_counter = m->instruction_counter;
+	hdr.call_stack_counter = m->call_stack_counter;
+	hdr.halted = m->halted;
+	hdr.exit_status = m->exit_status;
+
+	if ((fp = fopen(checkpoint_file, "wb")) == NULL) {
+		fprintf(stderr, "Failed to create checkpoint %s: %s\n", checkpoint_file, strerror(errno));
+		return -1;
+	}
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	fwrite(m->call_stack, sizeof(rbml_word), words, fp);
+
+	// memory the program never wrote stays a hole
+	for (i = 0; i < m->memory_size; i += n) {
+		n = m->memory_size - i < HOLE_WORDS ? m->memory_size - i : HOLE_WORDS;
+		if (is_zero(m->memory + i, n))
+			continue;
+		fseek(fp, hdr.memory_offset + i * sizeof(rbml_word), SEEK_SET);
+		fwrite(m->memory + i, sizeof(rbml_word), n, fp);
+	}
+	fflush(fp);
+	if (ferror(fp) || ftruncate(fileno(fp), hdr.memory_offset + m->memory_size * sizeof(rbml_word)) < 0
+	    || fclose(fp) != 0) {
+		fprintf(stderr, "Failed to write checkpoint %s\n", checkpoint_file);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Read checkpoint header and call stack
+ */
+static int
+read_state(struct rbml_machine *m, int fd, struct rbml_checkpoint_header *hdr,
+    const char *checkpoint_file)
+{
+	struct stat sb;
+	size_t size;
+
+	if (pread(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr)
+	    || memcmp(hdr->magic, RBML_CHECKPOINT_MAGIC, sizeof(hdr->magic)) != 0
+	    || hdr->header_size != sizeof(*hdr)) {
+		fprintf(stderr, "Corrupted checkpoint %s: Bad header\n", checkpoint_file);
+		return -1;
+	}
+	// the call stack lies between the header and memory: memory_offset at
+	// least sizeof(*hdr) + call_stack_words words, without overflowing
+	if (fstat(fd, &sb) < 0
+	    || hdr->memory_offset % RBML_CHECKPOINT_ALIGN != 0
+	    || hdr->memory_offset < sizeof(*hdr)
+	    || hdr->call_stack_words == 0
+	    || hdr->call_stack_words > (hdr->memory_offset - sizeof(*hdr)) / sizeof(rbml_word)
+	    || hdr->memory_size > (uint64_t) sb.st_size / sizeof(rbml_word)
+	    || hdr->call_stack_counter < 0
+	    || (uint64_t) hdr->call_stack_counter > hdr->call_stack_words
+	    || (uint64_t) sb.st_size != hdr->memory_offset + hdr->memory_size * sizeof(rbml_word)) {
+		fprintf(stderr, "Corrupted checkpoint %s: Bad layout\n", checkpoint_file);
+		return -1;
+	}
+	// the fast engine starts fetching at the counter unchecked
+	if (hdr->instruction_counter < 0
+	    || (uint64_t) hdr->instruction_counter >= hdr->memory_size) {
+		fprintf(stderr, "Corrupted checkpoint %s: Bad instruction counter\n", checkpoint_file);
+		return -1;
+	}
+
+	if (hdr->call_stack_words > m->call_stack_limit) {
+		fprintf(stderr, "Checkpoint %s: Call stack of %llu words over the limit of %zu\n",
+		    checkpoint_file, (unsigned long long) hdr->call_stack_words, m->call_stack_limit);
+		return -1;
+	}
+	if (hdr->call_stack_words > m->call_stack_size) {
+		rbml_word *call_stack;
+
+		if ((call_stack = realloc(m->call_stack, hdr->call_stack_words * sizeof(*call_stack))) == NULL) {
+			fprintf(stderr, "Failed to allocate call stack of %llu words\n",
+			    (unsigned long long) hdr->call_stack_words);
+			return -1;
+		}
+		m->call_stack = call_stack;
+		m->call_stack_size = hdr->call_stack_words;
+	}
+	size = hdr->call_stack_words * sizeof(rbml_word);
+	if (pread(fd, m->call_stack, size, sizeof(*hdr)) != (ssize_t) size) {
+		fprintf(stderr, "Corrupted checkpoint %s: Truncated call stack\n", checkpoint_file);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Restore machine from checkpoint file
+ */
+int
+rbml_machine_restore(struct rbml_machine *m, const char *checkpoint_file)
+{
+	struct rbml_checkpoint_header hdr;
+	size_t i;
+	int fd;
+
+	if ((fd = open(checkpoint_file, O_RDONLY)) < 0) {
+		fprintf(stderr, "Failed to open checkpoint %s: %s\n", checkpoint_file, strerror(errno));
+		return -1;
+	}
+	rbml_machine_reset(m);
+	if (read_state(m, fd, &hdr, checkpoint_file) < 0
+	    || rbml_machine_map(m, hdr.memory_size, fd, hdr.memory_offset, hdr.memory_size,
+	    checkpoint_file) < 0) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	memcpy(m->reg, hdr.reg, sizeof(m->reg));
+	m->accumulator = hdr.accumulator;
+	m->jump = hdr.jump;
+	m->less = hdr.less;
+	m->equal = hdr.equal;
+	m->greater = hdr.greater;
+	m->overflow = hdr.overflow;
+	m->ioerr = hdr.ioerr;
+	m->divzero = hdr.divzero;
+	m->instruction_counter = hdr.instruction_counter;
+	m->call_stack_counter = hdr.call_stack_counter;
+	m->halted = hdr.halted;
+	m->exit_status = hdr.exit_status;
+	m->instructions = hdr.instructions;
+
+	for (i = 0; i < countof(m->disk); i++) {
+		if (hdr.disk[i] < 0)
+			continue;
+		rbml_disk_open(m, i);
+		if (m->disk[i] == NULL) {
+			fprintf(stderr, "Failed to restore disk %zu: %s\n", i, strerror(errno));
+			return -1;
+		}
+		m->disk[i]->pos = hdr.disk[i] / sizeof(rbml_word);
+		rbml_disk_window_reset(m, m->disk[i]);
+	}
+	m->ioerr = hdr.ioerr;
+	rbml_machine_verify(m, NULL);
+
+	return 0;
+}
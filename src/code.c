@@ -11,12 +11,21 @@
 #include <unistd.h>
 
 #include "code.h"
+#include "object.h"
+#include "parser.h"
 #include "symbol.h"
 #include "rbmlc.h"
 
-#define CODE_ALLOCATION_STEP	100
+/**
+ * Initial size of program text, symbols by id and fixups (elements); they
+ * double as they fill
+ */
+#define CODE_INITIAL_SIZE	1024
 
-RB_GENERATE(symbol_table, symbol, link, symbol_cmp);
+/**
+ * Initial symbol table size (slots); it doubles when half full
+ */
+#define CODE_SYMBOLS_INITIAL	1024
 
 /**
  * Allocate code
@@ -29,7 +38,11 @@ code_alloc()
 	c = calloc(1, sizeof(*c));
 	if (c == NULL)
 		die("Failed to allocate code: %s", strerror(errno));
-	RB_INIT(&c->symbol_table);
+	c->symbols = calloc(CODE_SYMBOLS_INITIAL, sizeof(*c->symbols));
+	if (c->symbols == NULL)
+		die("Failed to allocate symbol table: %s", strerror(errno));
+	c->symbols_size = CODE_SYMBOLS_INITIAL;
+	arena_init(&c->arena);
 
 	return c;
 }
@@ -40,37 +53,95 @@ code_alloc()
 void
 code_free(struct code *c)
 {
-	struct symbol *s, *s_next;
-
 	if (c == NULL)
 		return;
 
 	if (c->text != NULL)
 		free(c->text);
-	RB_FOREACH_SAFE(s, symbol_table, &c->symbol_table, s_next)
-		symbol_free(s);
+	free(c->symbols);
+	free(c->symbol_ids);
+	free(c->fixups);
+	arena_free(&c->arena);
 	free(c);
 }
 
+/**
+ * Make room for one more element in array of allocated elements
+ */
+static void *
+grow(void *array, size_t n, size_t *allocated, size_t size, const char *what)
+{
+	if (n < *allocated)
+		return array;
+
+	*allocated = *allocated > 0 ? 2 * *allocated : CODE_INITIAL_SIZE;
+	array = realloc(array, *allocated * size);
+	if (array == NULL)
+		die("Failed to allocate memory for %s: %s", what, strerror(errno));
+
+	return array;
+}
+
+/**
+ * Find symbol table slot of symbol, or the free slot for it
+ */
+static struct symbol **
+symbol_slot(struct symbol **symbols, size_t size, const struct symbol_key *key)
+{
+	struct symbol *s;
+	size_t i;
+
+	for (i = key->hash & (size - 1); (s = symbols[i]) != NULL; i = (i + 1) & (size - 1)) {
+		if (s->hash == key->hash && s->len == key->len
+		    && memcmp(s->name, key->name, key->len) == 0)
+			break;
+	}
+
+	return &symbols[i];
+}
+
 /**
  * Lookup symbol
  */
 struct symbol *
-code_symbol_lookup(struct code *c, const char *name)
+code_symbol_lookup(struct code *c, const struct symbol_key *key)
 {
-	return RB_FIND(symbol_table, &c->symbol_table, (struct symbol *) &name);
+	return *symbol_slot(c->symbols, c->symbols_size, key);
 }
 
 /**
  * Add symbol
  */
 struct symbol *
-code_symbol_add(struct code *c, const char *name, unsigned line_num)
+code_symbol_add(struct code *c, const struct symbol_key *key, unsigned line_num)
 {
-	struct symbol *s;
+	struct symbol **symbols, *s;
+	struct symbol_key k;
+	size_t i, size;
 
-	s = symbol_alloc(name, line_num, c->size);
-	RB_INSERT(symbol_table, &c->symbol_table, s);
+	if (2 * (c->num_symbols + 1) > c->symbols_size) {
+		size = 2 * c->symbols_size;
+		symbols = calloc(size, sizeof(*symbols));
+		if (symbols == NULL)
+			die("Failed to allocate symbol table: %s", strerror(errno));
+		for (i = 0; i < c->symbols_size; i++) {
+			if ((s = c->symbols[i]) == NULL)
+				continue;
+			k.name = s->name;
+			k.len = s->len;
+			k.hash = s->hash;
+			*symbol_slot(symbols, size, &k) = s;
+		}
+		free(c->symbols);
+		c->symbols = symbols;
+		c->symbols_size = size;
+	}
+
+	c->symbol_ids = grow(c->symbol_ids, c->num_symbols, &c->symbol_ids_allocated,
+	    sizeof(*c->symbol_ids), "symbols");
+	s = symbol_alloc(&c->arena, key, c->num_symbols, line_num, c->size);
+	*symbol_slot(c->symbols, c->symbols_size, key) = s;
+	c->symbol_ids[c->num_symbols++] = s;
 
 	return s;
 }
@@ -79,16 +150,19 @@ code_symbol_add(struct code *c, const char *name, unsigned line_num)
  * Reference a symbol
  */
 struct symbol *
-code_symbol_ref(struct code *c, const char *name, unsigned line_num)
+code_symbol_ref(struct code *c, const struct symbol_key *key, unsigned line_num)
 {
 	struct symbol *s;
 
-	s = code_symbol_lookup(c, name);
+	s = code_symbol_lookup(c, key);
 	if (s == NULL)
-		s = code_symbol_add(c, name, 0);
+		s = code_symbol_add(c, key, 0);
 
-	if (s->line_num == 0)
-		symbol_ref(s, line_num, c->size);
+	if (s->line_num == 0 || c->relocatable) {
+		c->fixups = grow(c->fixups, c->num_fixups, &c->fixups_allocated,
+		    sizeof(*c->fixups), "forward references");
+		c->fixups[c->num_fixups++] = (struct fixup) { c->size, s->id, line_num };
+	}
 
 	return s;
 }
@@ -99,20 +173,97 @@ code_symbol_ref(struct code *c, const char *name, unsigned line_num)
 void
 code_symbol_define(struct code *c, struct symbol *s, unsigned line_num)
 {
-	symbol_define(s, line_num, c->size, c->text);
+	symbol_define(s, line_num, c->size);
 }
 
 /**
- * Check symbol references
+ * Export symbol
  */
 void
-code_check_refs(struct code *c, struct parser *p)
+code_symbol_export(struct code *c, const struct symbol_key *key, unsigned line_num)
 {
 	struct symbol *s;
 
-	RB_FOREACH(s, symbol_table, &c->symbol_table) {
-		symbol_check_refs(s, p);
+	s = code_symbol_lookup(c, key);
+	if (s == NULL)
+		s = code_symbol_add(c, key, 0);
+	s->export_line = line_num;
+}
+
+/**
+ * Compare unresolved fixups by symbol (ranked by name), then line
+ */
+static int
+fixup_cmp(const void *a, const void *b)
+{
+	const struct fixup *fa = a, *fb = b;
+
+	if (fa->symbol != fb->symbol)
+		return fa->symbol < fb->symbol ? -1 : 1;
+
+	return (fa->line_num > fb->line_num) - (fa->line_num < fb->line_num);
+}
+
+/**
+ * Resolve forward references
+ */
+void
+code_resolve_refs(struct code *c, struct parser *p)
+{
+	struct symbol **unresolved, *s;
+	unsigned *rank, line_num = p->line_num;
+	size_t i, n = 0, num_unresolved = 0;
+
+	for (i = 0; i < c->num_symbols; i++) {
+		s = c->symbol_ids[i];
+		if (s->export_line != 0 && s->line_num == 0) {
+			p->line_num = s->export_line;
+			parser_error(p, "Exported symbol `%s' not defined", s->name);
+		}
+	}
+	p->line_num = line_num;
+
+	// patch the references to symbols defined since, keep the others
+	// (all of them in an object, as its relocations)
+	for (i = 0; i < c->num_fixups; i++) {
+		s = c->symbol_ids[c->fixups[i].symbol];
+		if (s->line_num != 0)
+			RBML_SET_ARG3(c->text[c->fixups[i].offset], s->offset);
+		if (s->line_num == 0 || c->relocatable)
+			c->fixups[n++] = c->fixups[i];
+	}
+	if (c->relocatable) {
+		c->num_fixups = n;
+		return;
+	}
+	c->num_fixups = 0;
+	if (n == 0)
+		return;
+
+	// report those by symbol name, then line
+	unresolved = malloc(c->num_symbols * sizeof(*unresolved));
+	rank = malloc(c->num_symbols * sizeof(*rank));
+	if (unresolved == NULL || rank == NULL)
+		die("Failed to allocate memory for symbol references: %s", strerror(errno));
+	for (i = 0; i < c->num_symbols; i++) {
+		if (c->symbol_ids[i]->line_num == 0)
+			unresolved[num_unresolved++] = c->symbol_ids[i];
+	}
+	qsort(unresolved, num_unresolved, sizeof(*unresolved), symbol_cmp);
+	for (i = 0; i < num_unresolved; i++)
+		rank[unresolved[i]->id] = i;
+	for (i = 0; i < n; i++)
+		c->fixups[i].symbol = rank[c->fixups[i].symbol];
+	qsort(c->fixups, n, sizeof(*c->fixups), fixup_cmp);
+
+	for (i = 0; i < n; i++) {
+		p->line_num = c->fixups[i].line_num;
+		parser_error(p, "Unreferenced symbol `%s'", unresolved[c->fixups[i].symbol]->name);
 	}
+	p->line_num = line_num;
+
+	free(rank);
+	free(unresolved);
 }
 
 /**
@@ -121,13 +272,7 @@ code_check_refs(struct code *c, struct parser *p)
 void
 code_emit(struct code *c, rbml_word w)
 {
-	if (c->allocated <= c->size) {
-		c->text = realloc(c->text, (c->allocated + CODE_ALLOCATION_STEP) * sizeof(*c->text));
-		if (c->text == NULL)
-			die("Failed to allocate memory for program text: %s", strerror(errno));
-		c->allocated += CODE_ALLOCATION_STEP;
-	}
-
+	c->text = grow(c->text, c->size, &c->allocated, sizeof(*c->text), "program text");
 	c->text[c->size++] = w;
 }
 
@@ -150,3 +295,70 @@ code_write(struct code *c, const char *output_file)
 	}
 	fclose(fp);
 }
+
+/**
+ * Write relocatable code to object file
+ */
+void
+code_write_object(struct code *c, const char *output_file)
+{
+	struct rbml_object_header hdr;
+	struct rbml_object_reloc reloc;
+	struct rbml_object_symbol sym;
+	struct symbol *s;
+	uint32_t *index;
+	size_t i;
+	FILE *fp;
+
+	// the symbols of the object: exported ones, and the imported ones
+	// (referenced, never defined)
+	index = malloc((c->num_symbols + 1) * sizeof(*index));
+	if (index == NULL)
+		die("Failed to allocate memory for object symbols: %s", strerror(errno));
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, RBML_OBJECT_MAGIC, sizeof(hdr.magic));
+	hdr.text_words = c->size;
+	hdr.num_relocs = c->num_fixups;
+	for (i = 0; i < c->num_symbols; i++) {
+		s = c->symbol_ids[i];
+		index[i] = RBML_RELOC_LOCAL;
+		if (s->line_num != 0 ? s->export_line == 0 : s->export_line != 0)
+			continue;
+		index[i] = hdr.num_symbols++;
+		hdr.names_size += s->len + 1;
+	}
+
+	fp = fopen(output_file, "w");
+	if (fp == NULL)
+		die("Failed to open output file %s: %s", output_file, strerror(errno));
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	fwrite(c->text, sizeof(*c->text), c->size, fp);
+	for (i = 0; i < c->num_fixups; i++) {
+		s = c->symbol_ids[c->fixups[i].symbol];
+		reloc.offset = c->fixups[i].offset;
+		reloc.symbol = s->line_num != 0 ? RBML_RELOC_LOCAL : index[s->id];
+		fwrite(&reloc, sizeof(reloc), 1, fp);
+	}
+	sym.name = 0;
+	for (i = 0; i < c->num_symbols; i++) {
+		s = c->symbol_ids[i];
+		if (index[i] == RBML_RELOC_LOCAL)
+			continue;
+		sym.flags = s->line_num != 0 ? RBML_SYMBOL_EXPORT : 0;
+		sym.offset = s->line_num != 0 ? s->offset : 0;
+		fwrite(&sym, sizeof(sym), 1, fp);
+		sym.name += s->len + 1;
+	}
+	for (i = 0; i < c->num_symbols; i++) {
+		if (index[i] != RBML_RELOC_LOCAL)
+			fwrite(c->symbol_ids[i]->name, 1, c->symbol_ids[i]->len + 1, fp);
+	}
+	free(index);
+
+	if (ferror(fp)) {
+		fclose(fp);
+		unlink(output_file);
+		die("Failed to write output file %s: %s", output_file, strerror(errno));
+	}
+	fclose(fp);
+}
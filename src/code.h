@@ -9,12 +9,22 @@
 
 #include <sys/types.h>
 
+#include "arena.h"
 #include "rbml.h"
-#include "tree.h"
 
 struct symbol;
+struct symbol_key;
 struct parser;
 
+/**
+ * Forward reference: ARG3 of a program word to set to a symbol offset
+ */
+struct fixup {
+	unsigned offset;	/**< program text offset */
+	unsigned symbol;	/**< symbol id */
+	unsigned line_num;	/**< source line of the reference */
+};
+
 /**
  * Code
  */
@@ -23,8 +33,25 @@ struct code {
 	rbml_word size;		/**< current program size */
 	size_t allocated;	/**< allocated program size */
 
-	RB_HEAD(symbol_table, symbol) symbol_table;
-				/**< program symbol table */
+	struct symbol **symbols;
+				/**< program symbol table (open addressing,
+				     linear probing) */
+	size_t symbols_size;	/**< symbol table slots (power of 2) */
+	size_t num_symbols;	/**< symbols in the table */
+	struct symbol **symbol_ids;
+				/**< symbols by id (in order of creation) */
+	size_t symbol_ids_allocated;
+				/**< allocated symbols by id */
+	struct arena arena;	/**< symbols and names */
+
+	struct fixup *fixups;	/**< forward references, in source order */
+	size_t num_fixups;	/**< number of forward references */
+	size_t fixups_allocated;
+				/**< allocated forward references */
+
+	int relocatable;	/**< assembling an object: every reference
+				     is kept as a relocation, undefined
+				     symbols are imported */
 };
 
 /**
@@ -40,17 +67,18 @@ void code_free(struct code *c);
 /**
  * Lookup symbol
  */
-struct symbol *code_symbol_lookup(struct code *c, const char *name);
+struct symbol *code_symbol_lookup(struct code *c, const struct symbol_key *key);
 
 /**
  * Add symbol
  */
-struct symbol *code_symbol_add(struct code *c, const char *name, unsigned line_num);
+struct symbol *code_symbol_add(struct code *c, const struct symbol_key *key, unsigned line_num);
 
 /**
- * Reference a symbol
+ * Reference a symbol from the word about to be emitted, recording a
+ * fixup if it is not defined yet
  */
-struct symbol *code_symbol_ref(struct code *c, const char *name, unsigned line_num);
+struct symbol *code_symbol_ref(struct code *c, const struct symbol_key *key, unsigned line_num);
 
 /**
  * Define previously referenced symbol
@@ -58,9 +86,16 @@ struct symbol *code_symbol_ref(struct code *c, const char *name, unsigned line_n
 void code_symbol_define(struct code *c, struct symbol *s, unsigned line_num);
 
 /**
- * Check symbol references
+ * Export symbol from the object (EXPORT)
+ */
+void code_symbol_export(struct code *c, const struct symbol_key *key, unsigned line_num);
+
+/**
+ * Resolve forward references in one pass over the fixups, reporting the
+ * unresolved ones by symbol name (or keeping them as imports, if
+ * relocatable)
  */
-void code_check_refs(struct code *c, struct parser *p);
+void code_resolve_refs(struct code *c, struct parser *p);
 
 /**
  * Emit code
@@ -72,4 +107,9 @@ void code_emit(struct code *c, rbml_word w);
  */
 void code_write(struct code *c, const char *output_file);
 
+/**
+ * Write relocatable code to object file (see object.h)
+ */
+void code_write_object(struct code *c, const char *output_file);
+
 #endif /* _CODE_H_ */
@@ -0,0 +1,134 @@
+/**
+ * RBML machine: instruction disassembler
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#include <stdio.h>
+
+#include "machine_impl.h"
+
+// Instruction mnemonics, indexed by opcode.
+static const char *const mnemonics[256] = {
+	[OP_STO] =	"STO",
+	[OP_STOA] =	"STOA",
+	[OP_STOJ] =	"STOJ",
+
+	[OP_LOD] =	"LOD",
+	[OP_LODA] =	"LODA",
+	[OP_LODJ] =	"LODJ",
+
+	[OP_MOV] =	"MOV",
+	[OP_MOVA] =	"MOVA",
+	[OP_MOVJ] =	"MOVJ",
+
+	[OP_CRDM] =	"CRDM",
+	[OP_CRDR] =	"CRDR",
+	[OP_CRDA] =	"CRDA",
+	[OP_CRDJ] =	"CRDJ",
+
+	[OP_WRIT] =	"WRIT",
+	[OP_WRTA] =	"WRTA",
+	[OP_WRTJ] =	"WRTJ",
+
+	[OP_FRDM] =	"FRDM",
+	[OP_FRDR] =	"FRDR",
+	[OP_FRDA] =	"FRDA",
+	[OP_FRDJ] =	"FRDJ",
+	[OP_FWRT] =	"FWRT",
+	[OP_FWTA] =	"FWTA",
+	[OP_FWTJ] =	"FWTJ",
+	[OP_REPO] =	"REPO",
+	[OP_PRES] =	"PRES",
+	[OP_OPEN] =	"OPEN",
+	[OP_CLOS] =	"CLOS",
+
+	[OP_ADD] =	"ADD",
+	[OP_ADDA] =	"ADDA",
+	[OP_ADDJ] =	"ADDJ",
+
+	[OP_SUB] =	"SUB",
+	[OP_SUBA] =	"SUBA",
+	[OP_SUBJ] =	"SUBJ",
+
+	[OP_DIV] =	"DIV",
+	[OP_DIVA] =	"DIVA",
+	[OP_DIVJ] =	"DIVJ",
+
+	[OP_MULT] =	"MULT",
+	[OP_MLTA] =	"MLTA",
+	[OP_MLTJ] =	"MLTJ",
+
+	[OP_MOD] =	"MOD",
+	[OP_MODA] =	"MODA",
+	[OP_MODJ] =	"MODJ",
+
+	[OP_CJNT] =	"CJNT",
+	[OP_CJNA] =	"CJNA",
+	[OP_CJNJ] =	"CJNJ",
+
+	[OP_DJNT] =	"DJNT",
+	[OP_DJNA] =	"DJNA",
+	[OP_DJNJ] =	"DJNJ",
+
+	[OP_COMP] =	"COMP",
+	[OP_COMPA] =	"COMPA",
+	[OP_COMPJ] =	"COMPJ",
+
+	[OP_LSFT] =	"LSFT",
+	[OP_LSFA] =	"LSFA",
+	[OP_LSFJ] =	"LSFJ",
+
+	[OP_RSFT] =	"RSFT",
+	[OP_RSFA] =	"RSFA",
+	[OP_RSFJ] =	"RSFJ",
+
+	[OP_CMP] =	"CMP",
+	[OP_CMPA] =	"CMPA",
+	[OP_CMPJ] =	"CMPJ",
+	[OP_CMPM] =	"CMPM",
+
+	[OP_BRAN] =	"BRAN",
+	[OP_BRGT] =	"BRGT",
+	[OP_BRLT] =	"BRLT",
+	[OP_BREQ] =	"BREQ",
+	[OP_BRGE] =	"BRGE",
+	[OP_BRLE] =	"BRLE",
+
+	[OP_CALL] =	"CALL",
+	[OP_CAGT] =	"CAGT",
+	[OP_CALT] =	"CALT",
+	[OP_CAEQ] =	"CAEQ",
+	[OP_CAGE] =	"CAGE",
+	[OP_CALE] =	"CALE",
+	[OP_END] =	"END",
+
+	[OP_HALT] =	"HALT",
+	[OP_HERR] =	"HERR",
+};
+
+/**
+ * Get instruction mnemonic
+ */
+const char *
+rbml_opcode_name(int opcode)
+{
+	if (opcode < 0 || opcode >= countof(mnemonics))
+		return NULL;
+
+	return mnemonics[opcode];
+}
+
+/**
+ * Disassemble instruction word
+ */
+int
+rbml_disasm(rbml_word w, char *buf, size_t size)
+{
+	const char *name = rbml_opcode_name(RBML_OPCODE(w));
+
+	if (name == NULL)
+		return snprintf(buf, size, "WORD %08x", (unsigned) w);
+
+	return snprintf(buf, size, "%-5s %x %x %04x", name, RBML_ARG1(w), RBML_ARG2(w), RBML_ARG3(w));
+}
@@ -0,0 +1,210 @@
+/**
+ * RBML machine: disk I/O thread
+ *
+ * With the I/O thread on, disks are read and written a window at a time
+ * (RBML_DISK_WINDOW). Entering a window waits for the pages the thread
+ * was asked to read ahead for it, asks for the next window and starts
+ * writing back the window left, so the interpreter only stalls when it
+ * catches up with the disk. CLOS and halting are durability barriers:
+ * the disk is on stable storage when they complete.
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#define _GNU_SOURCE		/* sync_file_range() */
+
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "machine_impl.h"
+
+/**
+ * Number of requests queued at most
+ */
+#define IO_QUEUE	64
+
+/**
+ * I/O request
+ */
+struct io_request {
+	struct rbml_disk *d;
+	int op;			/**< RBML_IO_* */
+	off_t start;		/**< file range (bytes) */
+	off_t end;
+};
+
+/**
+ * I/O thread and its queue
+ */
+struct rbml_io {
+	pthread_t thread;
+	pthread_mutex_t lock;	/**< protects the queue and pending counts */
+	pthread_cond_t work;	/**< a request was queued, or stop */
+	pthread_cond_t done;	/**< a request completed */
+	struct io_request queue[IO_QUEUE];
+	size_t head;		/**< requests taken by the thread */
+	size_t tail;		/**< requests queued */
+	int stop;
+};
+
+/**
+ * Read pages in: ask for them, then touch them so they are resident
+ */
+static void
+prefetch(const struct io_request *r)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	volatile const char *p = (const char *) r->d->map;
+	off_t start = r->start & ~(off_t) (page - 1);
+	off_t i;
+
+	madvise((char *) r->d->map + start, r->end - start, MADV_WILLNEED);
+	for (i = start; i < r->end; i += page)
+		(void) p[i];
+}
+
+/**
+ * Start writing pages back
+ */
+static void
+writeback(const struct io_request *r)
+{
+#ifdef SYNC_FILE_RANGE_WRITE
+	sync_file_range(r->d->fd, r->start, r->end - r->start, SYNC_FILE_RANGE_WRITE);
+#else
+	long page = sysconf(_SC_PAGESIZE);
+	off_t start = r->start & ~(off_t) (page - 1);
+
+	msync((char *) r->d->map + start, r->end - start, MS_ASYNC);
+#endif
+}
+
+/**
+ * I/O thread
+ */
+static void *
+io_main(void *arg)
+{
+	struct rbml_io *io = arg;
+	struct io_request r;
+
+	pthread_mutex_lock(&io->lock);
+	for (;;) {
+		while (io->head == io->tail && !io->stop)
+			pthread_cond_wait(&io->work, &io->lock);
+		if (io->head == io->tail)
+			break;
+		r = io->queue[io->head++ % IO_QUEUE];
+		pthread_mutex_unlock(&io->lock);
+
+		if (r.op == RBML_IO_PREFETCH)
+			prefetch(&r);
+		else
+			writeback(&r);
+
+		pthread_mutex_lock(&io->lock);
+		r.d->pending--;
+		pthread_cond_broadcast(&io->done);
+	}
+	pthread_mutex_unlock(&io->lock);
+
+	return NULL;
+}
+
+/**
+ * Queue I/O request for disk
+ */
+void
+rbml_io_submit(struct rbml_machine *m, struct rbml_disk *d, int op, off_t start, off_t end)
+{
+	struct rbml_io *io = m->io;
+
+	// the thread must not touch the file past its end
+	if (end > d->allocated)
+		end = d->allocated;
+	if (start >= end)
+		return;
+
+	pthread_mutex_lock(&io->lock);
+	while (io->tail - io->head == IO_QUEUE)
+		pthread_cond_wait(&io->done, &io->lock);
+	io->queue[io->tail++ % IO_QUEUE] = (struct io_request) { d, op, start, end };
+	d->pending++;
+	pthread_cond_signal(&io->work);
+	pthread_mutex_unlock(&io->lock);
+}
+
+/**
+ * Wait for the I/O queued for disk
+ */
+void
+rbml_io_wait(struct rbml_machine *m, struct rbml_disk *d)
+{
+	struct rbml_io *io = m->io;
+
+	if (io == NULL)
+		return;
+
+	pthread_mutex_lock(&io->lock);
+	while (d->pending > 0)
+		pthread_cond_wait(&io->done, &io->lock);
+	pthread_mutex_unlock(&io->lock);
+}
+
+/**
+ * Read disks ahead and write them behind on an I/O thread
+ */
+int
+rbml_machine_disk_thread(struct rbml_machine *m, int enable)
+{
+	struct rbml_io *io = m->io;
+	size_t i;
+
+	if ((io != NULL) == (enable != 0))
+		return 0;
+
+	if (!enable) {
+		for (i = 0; i < countof(m->disk); i++) {
+			if (m->disk[i] != NULL)
+				rbml_io_wait(m, m->disk[i]);
+		}
+		pthread_mutex_lock(&io->lock);
+		io->stop = 1;
+		pthread_cond_signal(&io->work);
+		pthread_mutex_unlock(&io->lock);
+		pthread_join(io->thread, NULL);
+		pthread_mutex_destroy(&io->lock);
+		pthread_cond_destroy(&io->work);
+		pthread_cond_destroy(&io->done);
+		free(io);
+		m->io = NULL;
+	} else {
+		if ((io = calloc(1, sizeof(*io))) == NULL)
+			return -1;
+		pthread_mutex_init(&io->lock, NULL);
+		pthread_cond_init(&io->work, NULL);
+		pthread_cond_init(&io->done, NULL);
+		if ((errno = pthread_create(&io->thread, NULL, io_main, io)) != 0) {
+			pthread_mutex_destroy(&io->lock);
+			pthread_cond_destroy(&io->work);
+			pthread_cond_destroy(&io->done);
+			free(io);
+			return -1;
+		}
+		m->io = io;
+	}
+
+	// disks already open switch over on their next access
+	for (i = 0; i < countof(m->disk); i++) {
+		if (m->disk[i] != NULL)
+			rbml_disk_window_reset(m, m->disk[i]);
+	}
+
+	return 0;
+}
@@ -0,0 +1,836 @@
+/**
+ * RBML machine: fast engine
+ *
+ * All instruction handlers are inlined into one function, with the
+ * registers and flags held in locals. With GNU C the handlers are
+ * dispatched by computed goto (every handler ends with its own indirect
+ * jump to the next one); otherwise, or when built with
+ * RBML_DISPATCH_SWITCH, by a portable switch.
+ *
+ * Instructions are not decoded on every step. Each word of memory has a
+ * predecoded shadow entry (struct rbml_insn) holding the handler and the
+ * unpacked arguments, filled the first time the word is executed. An all
+ * zero entry means "not decoded yet", so the shadow array starts out as
+ * untouched zero pages. Stores into memory (STO, STOA, STOJ, CRDM) reset
+ * the entry of the word they write if it has been decoded, so programs
+ * patching their own ARG3 fields see the new instruction.
+ *
+ * While decoding, common instruction sequences are fused into one
+ * superinstruction handler installed at the first word of the sequence:
+ *
+ *	CMP/CMPA/CMPJ/CMPM + BRGT/BRLT/BREQ/BRGE/BRLE
+ *	LOD + LOD + ADD/SUB/MULT + STOA
+ *	ADD/SUB/MULT + MOVA 1
+ *	MOVA + MOVA
+ *
+ * A fused handler executes the instructions in order with their normal
+ * semantics and retires all of them; jumping into the middle of a
+ * sequence runs the words there on their own. The other words of a fused
+ * sequence are always decoded as well, so a store into any of them takes
+ * the invalidation path, which also drops the superinstructions spanning
+ * the written word.
+ *
+ * There is no per instruction bounds check on the instruction counter:
+ * falling through the last word of memory runs into the guard word, and
+ * jumps are checked when they are taken. Nor are memory operands checked
+ * when they are used: words whose ARG3 memory operand or branch target is
+ * out of memory are decoded to a handler that runs them on the reference
+ * engine, which checks them. The instruction budget is
+ * counted down on every fetch; a superinstruction the budget runs out in
+ * the middle of executes its first word on its own instead.
+ *
+ * This file is also built as the traced engine (engine_traced.c, with
+ * RBML_BUILD_TRACED defined), which records every instruction fetched
+ * into the trace ring buffer, and as the profiled engine
+ * (engine_profiled.c, RBML_BUILD_PROFILED), which counts instructions per
+ * address and opcode and branches taken. Neither fuses superinstructions,
+ * so each word executed is seen on its own. The fast engine has no
+ * instrumentation code at all.
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#include <stdio.h>
+
+#include "machine_impl.h"
+
+#if defined(__GNUC__) && !defined(RBML_DISPATCH_SWITCH)
+#define RBML_DISPATCH_THREADED
+#endif
+
+/**
+ * Superinstructions
+ */
+enum {
+	XOP_CMP_BRGT = 256,
+	XOP_CMP_BRLT,
+	XOP_CMP_BREQ,
+	XOP_CMP_BRGE,
+	XOP_CMP_BRLE,
+	XOP_CMPA_BRGT,
+	XOP_CMPA_BRLT,
+	XOP_CMPA_BREQ,
+	XOP_CMPA_BRGE,
+	XOP_CMPA_BRLE,
+	XOP_CMPJ_BRGT,
+	XOP_CMPJ_BRLT,
+	XOP_CMPJ_BREQ,
+	XOP_CMPJ_BRGE,
+	XOP_CMPJ_BRLE,
+	XOP_CMPM_BRGT,
+	XOP_CMPM_BRLT,
+	XOP_CMPM_BREQ,
+	XOP_CMPM_BRGE,
+	XOP_CMPM_BRLE,
+
+	XOP_LOD_LOD_ADD_STOA,
+	XOP_LOD_LOD_SUB_STOA,
+	XOP_LOD_LOD_MULT_STOA,
+
+	XOP_ADD_MOVA,
+	XOP_SUB_MOVA,
+	XOP_MULT_MOVA,
+
+	XOP_MOVA_MOVA,
+
+	XOP_CHECKED,		/* ARG3 out of memory */
+
+	XOP_MAX
+};
+
+#define ARG1	insn->arg1
+#define ARG2	insn->arg2
+#define ARG3	insn->arg3
+
+#if defined(RBML_BUILD_TRACED)
+#define ENGINE		rbml_engine_traced
+#define ENGINE_ID	RBML_ENGINE_TRACED
+#elif defined(RBML_BUILD_PROFILED)
+#define ENGINE		rbml_engine_profiled
+#define ENGINE_ID	RBML_ENGINE_PROFILED
+#else
+#define ENGINE		rbml_engine_fast
+#define ENGINE_ID	RBML_ENGINE_FAST
+#endif
+
+/* instrumented builds see every instruction on its own */
+#if defined(RBML_BUILD_TRACED) || defined(RBML_BUILD_PROFILED)
+#define FUSE(w, n, span)	0
+#else
+#define FUSE(w, n, span)	fuse(w, n, span)
+#endif
+
+#if defined(RBML_BUILD_TRACED)
+/* complete the record of the previous instruction with the register it wrote */
+#define TRACE_COMPLETE()						\
+	do {								\
+		if (trace->pending) {					\
+			volatile struct rbml_trace_record *_r =		\
+			    &trace->records[trace->head & trace->mask];	\
+			if (trace_reg != RBML_TRACE_NONE) {		\
+				_r->value = trace_reg < 16 ? reg[trace_reg] : \
+				    trace_reg == RBML_TRACE_ACC ? acc : jump; \
+				_r->reg = trace_reg;			\
+			}						\
+			trace->head++;					\
+			trace->pending = 0;				\
+		}							\
+	} while (0)
+
+/* start the record of the instruction at pc */
+#define TRACE_BEGIN()							\
+	do {								\
+		volatile struct rbml_trace_record *_r =			\
+		    &trace->records[trace->head & trace->mask];		\
+		_r->pc = pc;						\
+		_r->word = memory[pc];					\
+		_r->value = 0;						\
+		_r->reg = RBML_TRACE_NONE;				\
+		trace_reg = rbml_trace_reg(memory[pc]);			\
+		trace->pending = 1;					\
+	} while (0)
+
+#define FETCH()								\
+	do {								\
+		insn = &code[pc];					\
+		if (--left < 0)						\
+			goto out_budget;				\
+		TRACE_COMPLETE();					\
+		TRACE_BEGIN();						\
+	} while (0)
+
+/* take back a fetch that did not execute an instruction */
+#define UNFETCH()	do { left++; trace->pending = 0; } while (0)
+#elif defined(RBML_BUILD_PROFILED)
+#define FETCH()								\
+	do {								\
+		insn = &code[pc];					\
+		if (--left < 0)						\
+			goto out_budget;				\
+		profile->count[pc]++;					\
+		profile->opcode[RBML_OPCODE(memory[pc])]++;		\
+	} while (0)
+
+#define UNFETCH()							\
+	do {								\
+		left++;							\
+		profile->count[pc]--;					\
+		profile->opcode[RBML_OPCODE(memory[pc])]--;		\
+	} while (0)
+
+#define PROFILE_TAKEN()		profile->taken[pc]++
+#define PROFILE_NOT_TAKEN()	profile->not_taken[pc]++
+#else
+#define FETCH()								\
+	do {								\
+		insn = &code[pc];					\
+		if (--left < 0)						\
+			goto out_budget;				\
+	} while (0)
+
+#define UNFETCH()	do { left++; } while (0)
+#endif
+
+#ifndef RBML_BUILD_TRACED
+#define TRACE_COMPLETE()	do { } while (0)
+#endif
+#ifndef RBML_BUILD_PROFILED
+#define PROFILE_TAKEN()		do { } while (0)
+#define PROFILE_NOT_TAKEN()	do { } while (0)
+#endif
+
+/*
+ * Handlers are stored in the shadow entries as the offset of their label
+ * from the decode label (threaded dispatch), or as opcode + 1 (switch
+ * dispatch), so that 0 is the decode handler either way.
+ */
+#ifdef RBML_DISPATCH_THREADED
+#define HANDLER(op)	((op) < 256 ? handlers[op] : xhandlers[(op) - 256])
+#define SWITCH(h)	goto *(&&L_DECODE + (h));
+#define CASE(op)	L_##op:
+#define CASE_DECODE	L_DECODE:
+#define DEFAULT		L_DEFAULT:
+#define DISPATCH()	do { FETCH(); goto *(&&L_DECODE + insn->handler); } while (0)
+#define SINGLE()	goto *(&&L_DECODE + handlers[RBML_OPCODE(memory[pc])])
+#else
+#define HANDLER(op)	((op) + 1)
+#define SWITCH(h)	switch (h)
+#define CASE(op)	case (op) + 1:
+#define CASE_DECODE	case 0:
+#define DEFAULT		default:
+#define DISPATCH()	goto dispatch
+#define SINGLE()							\
+	do {								\
+		handler = HANDLER(RBML_OPCODE(memory[pc]));		\
+		goto redispatch;					\
+	} while (0)
+#endif
+
+/* store word to memory, dropping the decoded instructions it overwrites */
+#define STORE(addr, value)						\
+	do {								\
+		int _addr = (addr);					\
+		memory[_addr] = (value);				\
+		if (code[_addr].handler != 0)				\
+			invalidate(code, _addr);			\
+	} while (0)
+
+/* stop if a console read would have to wait for input */
+#define INPUT(fcontrol)							\
+	do {								\
+		if (!rbml_cread_ready(m, fcontrol))			\
+			goto out_blocked;				\
+	} while (0)
+
+/* next instruction */
+#define NEXT()		do { pc++; DISPATCH(); } while (0)
+
+/* transfer control to target */
+#define JUMP(target)							\
+	do {								\
+		pc = (target);						\
+		if ((size_t) pc >= memory_size)				\
+			goto out_of_region;				\
+		DISPATCH();						\
+	} while (0)
+
+#define COMPARE(a, b)							\
+	do {								\
+		rbml_word _a = (a), _b = (b);				\
+		less = _a < _b;						\
+		equal = _a == _b;					\
+		greater = _a > _b;					\
+	} while (0)
+
+/*
+ * retire the n other words of a superinstruction, or run its first word
+ * on its own if the budget runs out inside it
+ */
+#define FUSED(n)							\
+	do {								\
+		if (left < (n))						\
+			SINGLE();					\
+		left -= (n);						\
+	} while (0)
+
+/* compare and branch superinstruction */
+#define FUSED_CMP_BR(xop, a, b, cond)					\
+	CASE(xop)							\
+		FUSED(1);						\
+		COMPARE(a, b);						\
+		m->fused[RBML_FUSE_CMP_BR]++;				\
+		if (cond)						\
+			JUMP(insn[1].arg3);				\
+		pc += 2;						\
+		DISPATCH();
+
+/* load, load, operate, store accumulator superinstruction */
+#define FUSED_LOD_LOD_OP_STOA(xop, op, flag)				\
+	CASE(xop)							\
+		FUSED(3);						\
+		reg[insn[0].arg1] = memory[insn[0].arg3];		\
+		reg[insn[1].arg1] = memory[insn[1].arg3];		\
+		acc = op(reg[insn[2].arg1], reg[insn[2].arg2], &flag);	\
+		m->fused[RBML_FUSE_LOD_OP_STO]++;			\
+		STORE(insn[3].arg3, acc);				\
+		pc += 4;						\
+		DISPATCH();
+
+/* operate, move accumulator to register superinstruction */
+#define FUSED_OP_MOVA(xop, op, flag)					\
+	CASE(xop)							\
+		FUSED(1);						\
+		acc = op(reg[insn[0].arg1], reg[insn[0].arg2], &flag);	\
+		reg[insn[1].arg2] = acc;				\
+		m->fused[RBML_FUSE_OP_MOVA]++;				\
+		pc += 2;						\
+		DISPATCH();
+
+#define CALL(target)							\
+	do {								\
+		if (rbml_call(m, jump) < 0)				\
+			goto out_halt;					\
+		jump = pc;						\
+		JUMP(target);						\
+	} while (0)
+
+/* conditional branch */
+#define BRANCH_IF(cond, target)						\
+	do {								\
+		if (cond) {						\
+			PROFILE_TAKEN();				\
+			JUMP(target);					\
+		}							\
+		PROFILE_NOT_TAKEN();					\
+		NEXT();							\
+	} while (0)
+
+/* conditional call */
+#define CALL_IF(cond, target)						\
+	do {								\
+		if (cond) {						\
+			PROFILE_TAKEN();				\
+			CALL(target);					\
+		}							\
+		PROFILE_NOT_TAKEN();					\
+		NEXT();							\
+	} while (0)
+
+/**
+ * Longest superinstruction (number of words)
+ */
+#define FUSE_MAX	4
+
+#if !defined(RBML_BUILD_TRACED) && !defined(RBML_BUILD_PROFILED)
+/**
+ * Match superinstruction at the start of w
+ *
+ * @param w words to match
+ * @param n number of words available
+ * @param span set to the number of words fused
+ * @return superinstruction (XOP_*) or 0 if there is none
+ */
+static int
+fuse(const rbml_word *w, size_t n, int *span)
+{
+	int op0, op1;
+
+	if (n < 2)
+		return 0;
+	op0 = RBML_OPCODE(w[0]);
+	op1 = RBML_OPCODE(w[1]);
+
+	if (n >= 4 && op0 == OP_LOD && op1 == OP_LOD && RBML_OPCODE(w[3]) == OP_STOA) {
+		*span = 4;
+		switch (RBML_OPCODE(w[2])) {
+		case OP_ADD:	return XOP_LOD_LOD_ADD_STOA;
+		case OP_SUB:	return XOP_LOD_LOD_SUB_STOA;
+		case OP_MULT:	return XOP_LOD_LOD_MULT_STOA;
+		}
+	}
+
+	*span = 2;
+	if (op1 >= OP_BRGT && op1 <= OP_BRLE) {
+		switch (op0) {
+		case OP_CMP:	return XOP_CMP_BRGT + op1 - OP_BRGT;
+		case OP_CMPA:	return XOP_CMPA_BRGT + op1 - OP_BRGT;
+		case OP_CMPJ:	return XOP_CMPJ_BRGT + op1 - OP_BRGT;
+		case OP_CMPM:	return XOP_CMPM_BRGT + op1 - OP_BRGT;
+		}
+	}
+	if (op1 == OP_MOVA && RBML_ARG1(w[1]) != 0) {
+		switch (op0) {
+		case OP_ADD:	return XOP_ADD_MOVA;
+		case OP_SUB:	return XOP_SUB_MOVA;
+		case OP_MULT:	return XOP_MULT_MOVA;
+		}
+	}
+	if (op0 == OP_MOVA && op1 == OP_MOVA)
+		return XOP_MOVA_MOVA;
+
+	return 0;
+}
+#endif
+
+/**
+ * Drop decoded instruction at addr, and the superinstructions spanning it
+ */
+static void
+invalidate(struct rbml_insn *code, int addr)
+{
+	int i;
+
+	code[addr].handler = 0;
+	for (i = 1; i < FUSE_MAX && i <= addr; i++) {
+		if (code[addr - i].span > i)
+			code[addr - i].handler = 0;
+	}
+}
+
+/**
+ * Decode instruction word
+ */
+static inline void
+decode(struct rbml_insn *insn, rbml_word w, int32_t handler, int span)
+{
+	insn->handler = handler;
+	insn->arg1 = RBML_ARG1(w);
+	insn->arg2 = RBML_ARG2(w);
+	insn->arg3 = RBML_ARG3(w);
+	insn->span = span;
+}
+
+/**
+ * Run machine on the fast engine (or the traced or profiled engine)
+ */
+void
+ENGINE(struct rbml_machine *m, uint64_t budget)
+{
+	rbml_word *memory = m->memory;
+	rbml_word *reg = m->reg;
+	size_t memory_size = m->memory_size;
+
+	rbml_word acc = m->accumulator;
+	rbml_word jump = m->jump;
+	rbml_word less = m->less;
+	rbml_word equal = m->equal;
+	rbml_word greater = m->greater;
+	rbml_word overflow = m->overflow;
+	rbml_word divzero = m->divzero;
+
+	int pc = m->instruction_counter;
+	int64_t limit = budget > INT64_MAX ? INT64_MAX : (int64_t) budget;
+	int64_t left = limit;
+	int32_t handler;
+	struct rbml_insn *code;
+	struct rbml_insn *insn;
+	rbml_word w;
+	int xop, span, i;
+#if defined(RBML_BUILD_TRACED)
+	struct rbml_trace *trace = m->trace;
+	int trace_reg = RBML_TRACE_NONE;
+#elif defined(RBML_BUILD_PROFILED)
+	struct rbml_profile *profile = m->profile;
+#endif
+
+#ifdef RBML_DISPATCH_THREADED
+	static const int handlers[256] = {
+		[0 ... 255] =	&&L_DEFAULT - &&L_DECODE,
+
+		[OP_STO] =	&&L_OP_STO - &&L_DECODE,
+		[OP_STOA] =	&&L_OP_STOA - &&L_DECODE,
+		[OP_STOJ] =	&&L_OP_STOJ - &&L_DECODE,
+
+		[OP_LOD] =	&&L_OP_LOD - &&L_DECODE,
+		[OP_LODA] =	&&L_OP_LODA - &&L_DECODE,
+		[OP_LODJ] =	&&L_OP_LODJ - &&L_DECODE,
+
+		[OP_MOV] =	&&L_OP_MOV - &&L_DECODE,
+		[OP_MOVA] =	&&L_OP_MOVA - &&L_DECODE,
+		[OP_MOVJ] =	&&L_OP_MOVJ - &&L_DECODE,
+
+		[OP_CRDM] =	&&L_OP_CRDM - &&L_DECODE,
+		[OP_CRDR] =	&&L_OP_CRDR - &&L_DECODE,
+		[OP_CRDA] =	&&L_OP_CRDA - &&L_DECODE,
+		[OP_CRDJ] =	&&L_OP_CRDJ - &&L_DECODE,
+
+		[OP_WRIT] =	&&L_OP_WRIT - &&L_DECODE,
+		[OP_WRTA] =	&&L_OP_WRTA - &&L_DECODE,
+		[OP_WRTJ] =	&&L_OP_WRTJ - &&L_DECODE,
+
+		[OP_FRDM] =	&&L_OP_FRDM - &&L_DECODE,
+		[OP_FRDR] =	&&L_OP_FRDR - &&L_DECODE,
+		[OP_FRDA] =	&&L_OP_FRDA - &&L_DECODE,
+		[OP_FRDJ] =	&&L_OP_FRDJ - &&L_DECODE,
+		[OP_FWRT] =	&&L_OP_FWRT - &&L_DECODE,
+		[OP_FWTA] =	&&L_OP_FWTA - &&L_DECODE,
+		[OP_FWTJ] =	&&L_OP_FWTJ - &&L_DECODE,
+		[OP_REPO] =	&&L_OP_REPO - &&L_DECODE,
+		[OP_PRES] =	&&L_OP_PRES - &&L_DECODE,
+		[OP_OPEN] =	&&L_OP_OPEN - &&L_DECODE,
+		[OP_CLOS] =	&&L_OP_CLOS - &&L_DECODE,
+
+		[OP_ADD] =	&&L_OP_ADD - &&L_DECODE,
+		[OP_ADDA] =	&&L_OP_ADDA - &&L_DECODE,
+		[OP_ADDJ] =	&&L_OP_ADDJ - &&L_DECODE,
+
+		[OP_SUB] =	&&L_OP_SUB - &&L_DECODE,
+		[OP_SUBA] =	&&L_OP_SUBA - &&L_DECODE,
+		[OP_SUBJ] =	&&L_OP_SUBJ - &&L_DECODE,
+
+		[OP_DIV] =	&&L_OP_DIV - &&L_DECODE,
+		[OP_DIVA] =	&&L_OP_DIVA - &&L_DECODE,
+		[OP_DIVJ] =	&&L_OP_DIVJ - &&L_DECODE,
+
+		[OP_MULT] =	&&L_OP_MULT - &&L_DECODE,
+		[OP_MLTA] =	&&L_OP_MLTA - &&L_DECODE,
+		[OP_MLTJ] =	&&L_OP_MLTJ - &&L_DECODE,
+
+		[OP_MOD] =	&&L_OP_MOD - &&L_DECODE,
+		[OP_MODA] =	&&L_OP_MODA - &&L_DECODE,
+		[OP_MODJ] =	&&L_OP_MODJ - &&L_DECODE,
+
+		[OP_CJNT] =	&&L_OP_CJNT - &&L_DECODE,
+		[OP_CJNA] =	&&L_OP_CJNA - &&L_DECODE,
+		[OP_CJNJ] =	&&L_OP_CJNJ - &&L_DECODE,
+
+		[OP_DJNT] =	&&L_OP_DJNT - &&L_DECODE,
+		[OP_DJNA] =	&&L_OP_DJNA - &&L_DECODE,
+		[OP_DJNJ] =	&&L_OP_DJNJ - &&L_DECODE,
+
+		[OP_COMP] =	&&L_OP_COMP - &&L_DECODE,
+		[OP_COMPA] =	&&L_OP_COMPA - &&L_DECODE,
+		[OP_COMPJ] =	&&L_OP_COMPJ - &&L_DECODE,
+
+		[OP_LSFT] =	&&L_OP_LSFT - &&L_DECODE,
+		[OP_LSFA] =	&&L_OP_LSFA - &&L_DECODE,
+		[OP_LSFJ] =	&&L_OP_LSFJ - &&L_DECODE,
+
+		[OP_RSFT] =	&&L_OP_RSFT - &&L_DECODE,
+		[OP_RSFA] =	&&L_OP_RSFA - &&L_DECODE,
+		[OP_RSFJ] =	&&L_OP_RSFJ - &&L_DECODE,
+
+		[OP_CMP] =	&&L_OP_CMP - &&L_DECODE,
+		[OP_CMPA] =	&&L_OP_CMPA - &&L_DECODE,
+		[OP_CMPJ] =	&&L_OP_CMPJ - &&L_DECODE,
+		[OP_CMPM] =	&&L_OP_CMPM - &&L_DECODE,
+
+		[OP_BRAN] =	&&L_OP_BRAN - &&L_DECODE,
+		[OP_BRGT] =	&&L_OP_BRGT - &&L_DECODE,
+		[OP_BRLT] =	&&L_OP_BRLT - &&L_DECODE,
+		[OP_BREQ] =	&&L_OP_BREQ - &&L_DECODE,
+		[OP_BRGE] =	&&L_OP_BRGE - &&L_DECODE,
+		[OP_BRLE] =	&&L_OP_BRLE - &&L_DECODE,
+
+		[OP_CALL] =	&&L_OP_CALL - &&L_DECODE,
+		[OP_CAGT] =	&&L_OP_CAGT - &&L_DECODE,
+		[OP_CALT] =	&&L_OP_CALT - &&L_DECODE,
+		[OP_CAEQ] =	&&L_OP_CAEQ - &&L_DECODE,
+		[OP_CAGE] =	&&L_OP_CAGE - &&L_DECODE,
+		[OP_CALE] =	&&L_OP_CALE - &&L_DECODE,
+		[OP_END] =	&&L_OP_END - &&L_DECODE,
+
+		[OP_HALT] =	&&L_OP_HALT - &&L_DECODE,
+		[OP_HERR] =	&&L_OP_HERR - &&L_DECODE,
+	};
+#define XHANDLER(xop)	[xop - 256] = &&L_##xop - &&L_DECODE
+	static const int xhandlers[XOP_MAX - 256] = {
+		XHANDLER(XOP_CMP_BRGT),
+		XHANDLER(XOP_CMP_BRLT),
+		XHANDLER(XOP_CMP_BREQ),
+		XHANDLER(XOP_CMP_BRGE),
+		XHANDLER(XOP_CMP_BRLE),
+		XHANDLER(XOP_CMPA_BRGT),
+		XHANDLER(XOP_CMPA_BRLT),
+		XHANDLER(XOP_CMPA_BREQ),
+		XHANDLER(XOP_CMPA_BRGE),
+		XHANDLER(XOP_CMPA_BRLE),
+		XHANDLER(XOP_CMPJ_BRGT),
+		XHANDLER(XOP_CMPJ_BRLT),
+		XHANDLER(XOP_CMPJ_BREQ),
+		XHANDLER(XOP_CMPJ_BRGE),
+		XHANDLER(XOP_CMPJ_BRLE),
+		XHANDLER(XOP_CMPM_BRGT),
+		XHANDLER(XOP_CMPM_BRLT),
+		XHANDLER(XOP_CMPM_BREQ),
+		XHANDLER(XOP_CMPM_BRGE),
+		XHANDLER(XOP_CMPM_BRLE),
+
+		XHANDLER(XOP_LOD_LOD_ADD_STOA),
+		XHANDLER(XOP_LOD_LOD_SUB_STOA),
+		XHANDLER(XOP_LOD_LOD_MULT_STOA),
+
+		XHANDLER(XOP_ADD_MOVA),
+		XHANDLER(XOP_SUB_MOVA),
+		XHANDLER(XOP_MULT_MOVA),
+
+		XHANDLER(XOP_MOVA_MOVA),
+
+		XHANDLER(XOP_CHECKED),
+	};
+#undef XHANDLER
+#endif
+
+	if ((code = rbml_machine_decoded(m, ENGINE_ID)) == NULL) {
+		rbml_machine_error(m, "Failed to allocate decoded instruction cache");
+		return;
+	}
+
+#ifndef RBML_DISPATCH_THREADED
+dispatch:
+#endif
+	FETCH();
+	handler = insn->handler;
+#ifndef RBML_DISPATCH_THREADED
+redispatch:
+#endif
+	SWITCH (handler) {
+	CASE_DECODE
+		w = memory[pc];
+		if ((xop = FUSE(memory + pc, memory_size - pc, &span)) != 0) {
+			for (i = 0; i < span; i++) {
+				if (!rbml_arg3_valid(memory[pc + i], memory_size))
+					xop = 0;
+			}
+		}
+		if (xop != 0) {
+			/* the other words of the sequence have to be decoded too */
+			for (i = 1; i < span; i++) {
+				if (insn[i].handler == 0)
+					decode(&insn[i], memory[pc + i], HANDLER(RBML_OPCODE(memory[pc + i])), 1);
+			}
+			decode(insn, w, HANDLER(xop), span);
+		} else if (!rbml_arg3_valid(w, memory_size)) {
+			decode(insn, w, HANDLER(XOP_CHECKED), 1);
+		} else {
+			decode(insn, w, HANDLER(RBML_OPCODE(w)), 1);
+		}
+		UNFETCH();
+		DISPATCH();
+
+	CASE(XOP_CHECKED)
+		m->instruction_counter = pc;
+		m->accumulator = acc;
+		m->jump = jump;
+		m->less = less;
+		m->equal = equal;
+		m->greater = greater;
+		m->overflow = overflow;
+		m->divzero = divzero;
+		rbml_engine_table_step(m);
+		if (m->blocked)
+			goto out_blocked;
+		m->instructions--;	/* counted on fetch */
+		pc = m->instruction_counter;
+		acc = m->accumulator;
+		jump = m->jump;
+		less = m->less;
+		equal = m->equal;
+		greater = m->greater;
+		overflow = m->overflow;
+		divzero = m->divzero;
+		if (m->halted)
+			goto out_halt;
+		DISPATCH();
+
+	FUSED_CMP_BR(XOP_CMP_BRGT, reg[ARG1], reg[ARG2], greater)
+	FUSED_CMP_BR(XOP_CMP_BRLT, reg[ARG1], reg[ARG2], less)
+	FUSED_CMP_BR(XOP_CMP_BREQ, reg[ARG1], reg[ARG2], equal)
+	FUSED_CMP_BR(XOP_CMP_BRGE, reg[ARG1], reg[ARG2], greater || equal)
+	FUSED_CMP_BR(XOP_CMP_BRLE, reg[ARG1], reg[ARG2], greater || less)
+	FUSED_CMP_BR(XOP_CMPA_BRGT, acc, reg[ARG1], greater)
+	FUSED_CMP_BR(XOP_CMPA_BRLT, acc, reg[ARG1], less)
+	FUSED_CMP_BR(XOP_CMPA_BREQ, acc, reg[ARG1], equal)
+	FUSED_CMP_BR(XOP_CMPA_BRGE, acc, reg[ARG1], greater || equal)
+	FUSED_CMP_BR(XOP_CMPA_BRLE, acc, reg[ARG1], greater || less)
+	FUSED_CMP_BR(XOP_CMPJ_BRGT, jump, reg[ARG1], greater)
+	FUSED_CMP_BR(XOP_CMPJ_BRLT, jump, reg[ARG1], less)
+	FUSED_CMP_BR(XOP_CMPJ_BREQ, jump, reg[ARG1], equal)
+	FUSED_CMP_BR(XOP_CMPJ_BRGE, jump, reg[ARG1], greater || equal)
+	FUSED_CMP_BR(XOP_CMPJ_BRLE, jump, reg[ARG1], greater || less)
+	FUSED_CMP_BR(XOP_CMPM_BRGT, reg[ARG1], memory[ARG3], greater)
+	FUSED_CMP_BR(XOP_CMPM_BRLT, reg[ARG1], memory[ARG3], less)
+	FUSED_CMP_BR(XOP_CMPM_BREQ, reg[ARG1], memory[ARG3], equal)
+	FUSED_CMP_BR(XOP_CMPM_BRGE, reg[ARG1], memory[ARG3], greater || equal)
+	FUSED_CMP_BR(XOP_CMPM_BRLE, reg[ARG1], memory[ARG3], greater || less)
+
+	FUSED_LOD_LOD_OP_STOA(XOP_LOD_LOD_ADD_STOA, rbml_add, overflow)
+	FUSED_LOD_LOD_OP_STOA(XOP_LOD_LOD_SUB_STOA, rbml_sub, overflow)
+	FUSED_LOD_LOD_OP_STOA(XOP_LOD_LOD_MULT_STOA, rbml_mult, overflow)
+
+	FUSED_OP_MOVA(XOP_ADD_MOVA, rbml_add, overflow)
+	FUSED_OP_MOVA(XOP_SUB_MOVA, rbml_sub, overflow)
+	FUSED_OP_MOVA(XOP_MULT_MOVA, rbml_mult, overflow)
+
+	CASE(XOP_MOVA_MOVA)
+		FUSED(1);
+		if (insn[0].arg1) reg[insn[0].arg2] = acc; else acc = reg[insn[0].arg2];
+		if (insn[1].arg1) reg[insn[1].arg2] = acc; else acc = reg[insn[1].arg2];
+		m->fused[RBML_FUSE_MOVA_MOVA]++;
+		pc += 2;
+		DISPATCH();
+
+	CASE(OP_STO)	STORE(ARG3, reg[ARG1]); NEXT();
+	CASE(OP_STOA)	STORE(ARG3, acc); NEXT();
+	CASE(OP_STOJ)	STORE(ARG3, jump); NEXT();
+
+	CASE(OP_LOD)	reg[ARG1] = memory[ARG3]; NEXT();
+	CASE(OP_LODA)	acc = memory[ARG3]; NEXT();
+	CASE(OP_LODJ)	jump = memory[ARG3]; NEXT();
+
+	CASE(OP_MOV)	reg[ARG2] = reg[ARG1]; NEXT();
+	CASE(OP_MOVA)	if (ARG1) reg[ARG2] = acc; else acc = reg[ARG2]; NEXT();
+	CASE(OP_MOVJ)	if (ARG1) reg[ARG2] = jump; else jump = reg[ARG2]; NEXT();
+
+	CASE(OP_CRDM)	INPUT(ARG1); STORE(ARG3, rbml_cread(m, ARG1)); NEXT();
+	CASE(OP_CRDR)	INPUT(ARG1); reg[ARG2] = rbml_cread(m, ARG1); NEXT();
+	CASE(OP_CRDA)	INPUT(ARG1); acc = rbml_cread(m, ARG1); NEXT();
+	CASE(OP_CRDJ)	INPUT(ARG1); jump = rbml_cread(m, ARG1); NEXT();
+
+	CASE(OP_WRIT)	rbml_cwrite(m, ARG1, reg[ARG2]); NEXT();
+	CASE(OP_WRTA)	rbml_cwrite(m, ARG1, acc); NEXT();
+	CASE(OP_WRTJ)	rbml_cwrite(m, ARG1, jump); NEXT();
+
+	CASE(OP_FRDM)	STORE(ARG3, rbml_disk_read(m, ARG1)); NEXT();
+	CASE(OP_FRDR)	reg[ARG2] = rbml_disk_read(m, ARG1); NEXT();
+	CASE(OP_FRDA)	acc = rbml_disk_read(m, ARG1); NEXT();
+	CASE(OP_FRDJ)	jump = rbml_disk_read(m, ARG1); NEXT();
+	CASE(OP_FWRT)	rbml_disk_write(m, ARG1, reg[ARG2]); NEXT();
+	CASE(OP_FWTA)	rbml_disk_write(m, ARG1, acc); NEXT();
+	CASE(OP_FWTJ)	rbml_disk_write(m, ARG1, jump); NEXT();
+	CASE(OP_REPO)	rbml_disk_move(m, ARG1, ARG2, ARG3); NEXT();
+	CASE(OP_PRES)	rbml_disk_reset(m, ARG1, ARG2); NEXT();
+	CASE(OP_OPEN)	rbml_disk_open(m, ARG1); NEXT();
+	CASE(OP_CLOS)	rbml_disk_close(m, ARG1); NEXT();
+
+	CASE(OP_ADD)	acc = rbml_add(reg[ARG1], reg[ARG2], &overflow); NEXT();
+	CASE(OP_ADDA)	acc = rbml_add(acc, reg[ARG1], &overflow); NEXT();
+	CASE(OP_ADDJ)	acc = rbml_add(jump, reg[ARG1], &overflow); NEXT();
+
+	CASE(OP_SUB)	acc = rbml_sub(reg[ARG1], reg[ARG2], &overflow); NEXT();
+	CASE(OP_SUBA)	acc = rbml_sub(acc, reg[ARG1], &overflow); NEXT();
+	CASE(OP_SUBJ)	acc = rbml_sub(jump, reg[ARG1], &overflow); NEXT();
+
+	CASE(OP_DIV)	acc = rbml_div(reg[ARG1], reg[ARG2], &divzero); NEXT();
+	CASE(OP_DIVA)	acc = rbml_div(acc, reg[ARG1], &divzero); NEXT();
+	CASE(OP_DIVJ)	acc = rbml_div(jump, reg[ARG1], &divzero); NEXT();
+
+	CASE(OP_MULT)	acc = rbml_mult(reg[ARG1], reg[ARG2], &overflow); NEXT();
+	CASE(OP_MLTA)	acc = rbml_mult(acc, reg[ARG1], &overflow); NEXT();
+	CASE(OP_MLTJ)	acc = rbml_mult(jump, reg[ARG1], &overflow); NEXT();
+
+	CASE(OP_MOD)	acc = rbml_mod(reg[ARG1], reg[ARG2], &divzero); NEXT();
+	CASE(OP_MODA)	acc = rbml_mod(acc, reg[ARG1], &divzero); NEXT();
+	CASE(OP_MODJ)	acc = rbml_mod(jump, reg[ARG1], &divzero); NEXT();
+
+	CASE(OP_CJNT)	acc = reg[ARG1] & reg[ARG2]; NEXT();
+	CASE(OP_CJNA)	acc = acc & reg[ARG1]; NEXT();
+	CASE(OP_CJNJ)	acc = jump & reg[ARG1]; NEXT();
+
+	CASE(OP_DJNT)	acc = reg[ARG1] | reg[ARG2]; NEXT();
+	CASE(OP_DJNA)	acc = acc | reg[ARG1]; NEXT();
+	CASE(OP_DJNJ)	acc = jump | reg[ARG1]; NEXT();
+
+	CASE(OP_COMP)	acc = ~reg[ARG1]; NEXT();
+	CASE(OP_COMPA)	acc = ~acc; NEXT();
+	CASE(OP_COMPJ)	acc = ~jump; NEXT();
+
+	CASE(OP_LSFT)	acc = reg[ARG1] << reg[ARG2]; NEXT();
+	CASE(OP_LSFA)	acc = acc << reg[ARG1]; NEXT();
+	CASE(OP_LSFJ)	acc = jump << reg[ARG1]; NEXT();
+
+	CASE(OP_RSFT)	acc = reg[ARG1] >> reg[ARG2]; NEXT();
+	CASE(OP_RSFA)	acc = acc >> reg[ARG1]; NEXT();
+	CASE(OP_RSFJ)	acc = jump >> reg[ARG1]; NEXT();
+
+	CASE(OP_CMP)	COMPARE(reg[ARG1], reg[ARG2]); NEXT();
+	CASE(OP_CMPA)	COMPARE(acc, reg[ARG1]); NEXT();
+	CASE(OP_CMPJ)	COMPARE(jump, reg[ARG1]); NEXT();
+	CASE(OP_CMPM)	COMPARE(reg[ARG1], memory[ARG3]); NEXT();
+
+	CASE(OP_BRAN)	PROFILE_TAKEN(); JUMP(ARG3);
+	CASE(OP_BRGT)	BRANCH_IF(greater, ARG3);
+	CASE(OP_BRLT)	BRANCH_IF(less, ARG3);
+	CASE(OP_BREQ)	BRANCH_IF(equal, ARG3);
+	CASE(OP_BRGE)	BRANCH_IF(greater || equal, ARG3);
+	CASE(OP_BRLE)	BRANCH_IF(greater || less, ARG3);
+
+	CASE(OP_CALL)	PROFILE_TAKEN(); CALL(ARG3);
+	CASE(OP_CAGT)	CALL_IF(greater, ARG3);
+	CASE(OP_CALT)	CALL_IF(less, ARG3);
+	CASE(OP_CAEQ)	CALL_IF(equal, ARG3);
+	CASE(OP_CAGE)	CALL_IF(greater || equal, ARG3);
+	CASE(OP_CALE)	CALL_IF(less || equal, ARG3);
+	CASE(OP_END) {
+		int target = jump;
+
+		if (m->call_stack_counter == 0) {
+			jump = m->call_stack[0];
+			m->call_stack[0] = 0;
+		} else {
+			jump = m->call_stack[--m->call_stack_counter];
+		}
+		JUMP(target + 1);
+	}
+
+	CASE(OP_HALT)
+		m->exit_status = RBML_EXIT_HALT;
+		goto out_halt;
+	CASE(OP_HERR)
+		m->exit_status = RBML_EXIT_HERR;
+		goto out_halt;
+
+	DEFAULT
+		if ((size_t) pc >= memory_size) {
+			UNFETCH();
+			goto out_of_region;
+		}
+		rbml_machine_flush(m);
+		fprintf(stderr, "Unknown opcode %x at %x\n", RBML_OPCODE(memory[pc]), pc);
+		NEXT();
+	}
+
+out_blocked:
+	UNFETCH();
+	m->blocked = 1;
+	goto out;
+out_budget:
+	left++;
+	goto out;
+out_of_region:
+	rbml_machine_error(m, "Instruction counter out of memory region");
+out_halt:
+	m->halted = 1;
+out:
+	TRACE_COMPLETE();
+	m->instruction_counter = pc;
+	m->instructions += limit - left;
+
+	m->accumulator = acc;
+	m->jump = jump;
+	m->less = less;
+	m->equal = equal;
+	m->greater = greater;
+	m->overflow = overflow;
+	m->divzero = divzero;
+}
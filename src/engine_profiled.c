@@ -0,0 +1,11 @@
+/**
+ * RBML machine: profiled engine
+ *
+ * The fast engine built with RBML_BUILD_PROFILED: every instruction it
+ * fetches is counted in the machine's execution profile (profile.c).
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#define RBML_BUILD_PROFILED
+#include "engine.c"
@@ -0,0 +1,291 @@
+/**
+ * RBML machine: reference engine
+ *
+ * One function per instruction, dispatched through the opcode table.
+ * This is the engine the others are checked against, and the checked
+ * engine: memory operands and the instruction counter are checked on
+ * every step, unless the program has been verified (see verify.c) not
+ * to need it.
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#include <stdio.h>
+
+#include "machine_impl.h"
+
+// Instructions -- these function simulate each CPU instruction.
+typedef void (*opcode_fn)(struct rbml_machine *m, int arg1, int arg2, int arg3);
+#define OPCODE(name) static void name(struct rbml_machine *m, int arg1, int arg2, int arg3)
+
+OPCODE(sto) { m->memory[arg3] = m->reg[arg1]; }
+OPCODE(stoa) { m->memory[arg3] = m->accumulator; }
+OPCODE(stoj) { m->memory[arg3] = m->jump; }
+
+OPCODE(lod) { m->reg[arg1] = m->memory[arg3]; }
+OPCODE(loda) { m->accumulator = m->memory[arg3]; }
+OPCODE(lodj) { m->jump = m->memory[arg3]; }
+
+OPCODE(mov) { m->reg[arg2] = m->reg[arg1]; }
+OPCODE(mova) { if (arg1) m->reg[arg2] = m->accumulator; else m->accumulator = m->reg[arg2]; }
+OPCODE(movj) { if (arg1) m->reg[arg2] = m->jump; else m->jump = m->reg[arg2]; }
+
+OPCODE(writ) { rbml_cwrite(m, arg1, m->reg[arg2]); }
+OPCODE(wrta) { rbml_cwrite(m, arg1, m->accumulator); }
+OPCODE(wrtj) { rbml_cwrite(m, arg1, m->jump); }
+
+OPCODE(crdm) { m->memory[arg3] = rbml_cread(m, arg1); }
+OPCODE(crda) { m->accumulator = rbml_cread(m, arg1); }
+OPCODE(crdj) { m->jump = rbml_cread(m, arg1); }
+OPCODE(crdr) { m->reg[arg2] = rbml_cread(m, arg1); }
+
+OPCODE(open) { rbml_disk_open(m, arg1); }
+OPCODE(clos) { rbml_disk_close(m, arg1); }
+OPCODE(frdm) { m->memory[arg3] = rbml_disk_read(m, arg1); }
+OPCODE(frdr) { m->reg[arg2] = rbml_disk_read(m, arg1); }
+OPCODE(frda) { m->accumulator = rbml_disk_read(m, arg1); }
+OPCODE(frdj) { m->jump = rbml_disk_read(m, arg1); }
+OPCODE(fwrt) { rbml_disk_write(m, arg1, m->reg[arg2]); }
+OPCODE(fwta) { rbml_disk_write(m, arg1, m->accumulator); }
+OPCODE(fwtj) { rbml_disk_write(m, arg1, m->jump); }
+OPCODE(repo) { rbml_disk_move(m, arg1, arg2, arg3); }
+OPCODE(pres) { rbml_disk_reset(m, arg1, arg2); }
+
+OPCODE(add) { m->accumulator = rbml_add(m->reg[arg1], m->reg[arg2], &m->overflow); }
+OPCODE(adda) { m->accumulator = rbml_add(m->accumulator, m->reg[arg1], &m->overflow); }
+OPCODE(addj) { m->accumulator = rbml_add(m->jump, m->reg[arg1], &m->overflow); }
+
+OPCODE(sub) { m->accumulator = rbml_sub(m->reg[arg1], m->reg[arg2], &m->overflow); }
+OPCODE(suba) { m->accumulator = rbml_sub(m->accumulator, m->reg[arg1], &m->overflow); }
+OPCODE(subj) { m->accumulator = rbml_sub(m->jump, m->reg[arg1], &m->overflow); }
+
+OPCODE(mult) { m->accumulator = rbml_mult(m->reg[arg1], m->reg[arg2], &m->overflow); }
+OPCODE(mlta) { m->accumulator = rbml_mult(m->accumulator, m->reg[arg1], &m->overflow); }
+OPCODE(mltj) { m->accumulator = rbml_mult(m->jump, m->reg[arg1], &m->overflow); }
+
+OPCODE(div_) { m->accumulator = rbml_div(m->reg[arg1], m->reg[arg2], &m->divzero); }
+OPCODE(diva) { m->accumulator = rbml_div(m->accumulator, m->reg[arg1], &m->divzero); }
+OPCODE(divj) { m->accumulator = rbml_div(m->jump, m->reg[arg1], &m->divzero); }
+
+OPCODE(mod) { m->accumulator = rbml_mod(m->reg[arg1], m->reg[arg2], &m->divzero); }
+OPCODE(moda) { m->accumulator = rbml_mod(m->accumulator, m->reg[arg1], &m->divzero); }
+OPCODE(modj) { m->accumulator = rbml_mod(m->jump, m->reg[arg1], &m->divzero); }
+
+OPCODE(cjnt) { m->accumulator = m->reg[arg1] & m->reg[arg2]; }
+OPCODE(cjna) { m->accumulator = m->accumulator & m->reg[arg1]; }
+OPCODE(cjnj) { m->accumulator = m->jump & m->reg[arg1]; }
+
+OPCODE(djnt) { m->accumulator = m->reg[arg1] | m->reg[arg2]; }
+OPCODE(djna) { m->accumulator = m->accumulator | m->reg[arg1]; }
+OPCODE(djnj) { m->accumulator = m->jump | m->reg[arg1]; }
+
+OPCODE(comp) { m->accumulator = ~m->reg[arg1]; }
+OPCODE(compa) { m->accumulator = ~m->accumulator; }
+OPCODE(compj) { m->accumulator = ~m->jump; }
+
+OPCODE(lsft) { m->accumulator = m->reg[arg1] << m->reg[arg2]; }
+OPCODE(lsfa) { m->accumulator = m->accumulator << m->reg[arg1]; }
+OPCODE(lsfj) { m->accumulator = m->jump << m->reg[arg1]; }
+
+OPCODE(rsft) { m->accumulator = m->reg[arg1] >> m->reg[arg2]; }
+OPCODE(rsfa) { m->accumulator = m->accumulator >> m->reg[arg1]; }
+OPCODE(rsfj) { m->accumulator = m->jump >> m->reg[arg1]; }
+
+static void
+compare(struct rbml_machine *m, rbml_word a, rbml_word b)
+{
+	m->less = a < b;
+	m->equal = a == b;
+	m->greater = a > b;
+}
+
+OPCODE(cmp) { compare(m, m->reg[arg1], m->reg[arg2]); }
+OPCODE(cmpa) { compare(m, m->accumulator, m->reg[arg1]); }
+OPCODE(cmpj) { compare(m, m->jump, m->reg[arg1]); }
+OPCODE(cmpm) { compare(m, m->reg[arg1], m->memory[arg3]); }
+
+OPCODE(bran) { m->instruction_counter = arg3 - 1; }
+OPCODE(brgt) { if (m->greater) bran(m, arg1, arg2, arg3); }
+OPCODE(brlt) { if (m->less) bran(m, arg1, arg2, arg3); }
+OPCODE(breq) { if (m->equal) bran(m, arg1, arg2, arg3); }
+OPCODE(brge) { if (m->greater || m->equal) bran(m, arg1, arg2, arg3); }
+OPCODE(brle) { if (m->greater || m->less) bran(m, arg1, arg2, arg3); }
+
+OPCODE(call) {
+	if (rbml_call(m, m->jump) < 0)
+		return;
+	m->jump = m->instruction_counter;
+	m->instruction_counter = arg3 - 1;
+}
+OPCODE(cagt) { if (m->greater) call(m, arg1, arg2, arg3); }
+OPCODE(calt) { if (m->less) call(m, arg1, arg2, arg3); }
+OPCODE(caeq) { if (m->equal) call(m, arg1, arg2, arg3); }
+OPCODE(cage) { if (m->greater || m->equal) call(m, arg1, arg2, arg3); }
+OPCODE(cale) { if (m->less || m->equal) call(m, arg1, arg2, arg3); }
+OPCODE(end) {
+	m->instruction_counter = m->jump;
+	if (m->call_stack_counter == 0) {
+		m->jump = m->call_stack[0];
+		m->call_stack[0] = 0;
+	} else {
+		m->jump = m->call_stack[--m->call_stack_counter];
+	}
+}
+
+OPCODE(halt) { m->halted = 1; m->exit_status = RBML_EXIT_HALT; }
+OPCODE(herr) { m->halted = 1; m->exit_status = RBML_EXIT_HERR; }
+
+// Opcode table. It is never written, so machines running on different
+// threads can share it.
+static const opcode_fn opcodes[256] = {
+	[OP_STO] =	sto,
+	[OP_STOA] =	stoa,
+	[OP_STOJ] =	stoj,
+
+	[OP_LOD] =	lod,
+	[OP_LODA] =	loda,
+	[OP_LODJ] =	lodj,
+
+	[OP_MOV] =	mov,
+	[OP_MOVA] =	mova,
+	[OP_MOVJ] =	movj,
+
+	[OP_CRDM] =	crdm,
+	[OP_CRDR] =	crdr,
+	[OP_CRDA] =	crda,
+	[OP_CRDJ] =	crdj,
+
+	[OP_WRIT] =	writ,
+	[OP_WRTA] =	wrta,
+	[OP_WRTJ] =	wrtj,
+
+	[OP_FRDM] =	frdm,
+	[OP_FRDR] =	frdr,
+	[OP_FRDA] =	frda,
+	[OP_FRDJ] =	frdj,
+	[OP_FWRT] =	fwrt,
+	[OP_FWTA] =	fwta,
+	[OP_FWTJ] =	fwtj,
+	[OP_REPO] =	repo,
+	[OP_PRES] =	pres,
+	[OP_OPEN] =	open,
+	[OP_CLOS] =	clos,
+
+	[OP_ADD] =	add,
+	[OP_ADDA] =	adda,
+	[OP_ADDJ] =	addj,
+
+	[OP_SUB] =	sub,
+	[OP_SUBA] =	suba,
+	[OP_SUBJ] =	subj,
+
+	[OP_DIV] =	div_,
+	[OP_DIVA] =	diva,
+	[OP_DIVJ] =	divj,
+
+	[OP_MULT] =	mult,
+	[OP_MLTA] =	mlta,
+	[OP_MLTJ] =	mltj,
+
+	[OP_MOD] =	mod,
+	[OP_MODA] =	moda,
+	[OP_MODJ] =	modj,
+
+	[OP_CJNT] =	cjnt,
+	[OP_CJNA] =	cjna,
+	[OP_CJNJ] =	cjnj,
+
+	[OP_DJNT] =	djnt,
+	[OP_DJNA] =	djna,
+	[OP_DJNJ] =	djnj,
+
+	[OP_COMP] =	comp,
+	[OP_COMPA] =	compa,
+	[OP_COMPJ] =	compj,
+
+	[OP_LSFT] =	lsft,
+	[OP_LSFA] =	lsfa,
+	[OP_LSFJ] =	lsfj,
+
+	[OP_RSFT] =	rsft,
+	[OP_RSFA] =	rsfa,
+	[OP_RSFJ] =	rsfj,
+
+	[OP_CMP] =	cmp,
+	[OP_CMPA] =	cmpa,
+	[OP_CMPJ] =	cmpj,
+	[OP_CMPM] =	cmpm,
+
+	[OP_BRAN] =	bran,
+	[OP_BRGT] =	brgt,
+	[OP_BRLT] =	brlt,
+	[OP_BREQ] =	breq,
+	[OP_BRGE] =	brge,
+	[OP_BRLE] =	brle,
+
+	[OP_CALL] =	call,
+	[OP_CAGT] =	cagt,
+	[OP_CALT] =	calt,
+	[OP_CAEQ] =	caeq,
+	[OP_CAGE] =	cage,
+	[OP_CALE] =	cale,
+	[OP_END] =	end,
+
+	[OP_HALT] =	halt,
+	[OP_HERR] =	herr,
+};
+
+static void
+evaluateInstruction(struct rbml_machine *m)
+{
+	opcode_fn op;
+	rbml_word w = m->instruction_register;
+	uint8_t opcode = RBML_OPCODE(w);
+
+	op = opcodes[opcode];
+	if (op == NULL) {
+		rbml_machine_flush(m);
+		fprintf(stderr, "Unknown opcode %x at %x\n", opcode, m->instruction_counter);
+		return;
+	}
+
+	if (!m->verified && rbml_is_memory_operand(w) && RBML_ARG3(w) >= m->memory_size) {
+		rbml_machine_error(m, "Memory address %x out of memory region at %x",
+		    RBML_ARG3(w), m->instruction_counter);
+		return;
+	}
+
+	op(m, RBML_ARG1(w), RBML_ARG2(w), RBML_ARG3(w));
+}
+
+/**
+ * Execute one instruction on the reference engine
+ */
+void
+rbml_engine_table_step(struct rbml_machine *m)
+{
+	m->instruction_register = m->memory[m->instruction_counter];
+	if (RBML_IS_CREAD(RBML_OPCODE(m->instruction_register)) &&
+	    !rbml_cread_ready(m, RBML_ARG1(m->instruction_register))) {
+		m->blocked = 1;
+		return;
+	}
+	evaluateInstruction(m);
+	m->instructions++;
+	if (m->halted)
+		return;
+
+	m->instruction_counter++;
+	if (!m->verified && m->instruction_counter >= m->memory_size)
+		rbml_machine_error(m, "Instruction counter out of memory region");
+}
+
+/**
+ * Run machine on the reference engine
+ */
+void
+rbml_engine_table(struct rbml_machine *m, uint64_t budget)
+{
+	for (; budget > 0 && !m->halted && !m->blocked; budget--)
+		rbml_engine_table_step(m);
+}
@@ -0,0 +1,11 @@
+/**
+ * RBML machine: traced engine
+ *
+ * The fast engine built with RBML_BUILD_TRACED: every instruction it
+ * fetches is recorded in the machine's trace ring buffer (trace.c).
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#define RBML_BUILD_TRACED
+#include "engine.c"
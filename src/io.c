@@ -0,0 +1,932 @@
+/**
+ * RBML machine: console and disk I/O
+ *
+ * Console output is collected in a buffer of the machine and written
+ * with one write() per flush, instead of going through stdio a byte or a
+ * printf() at a time. Console input is read from m->in in blocks, or
+ * mapped if it is a regular file, and parsed as the input fed by the
+ * host is, the same way fgets() and scanf("%d") would.
+ *
+ * Disks are files mapped shared (struct rbml_disk): FRD* and FWT* copy a
+ * word and advance the position, REPO and PRES only set it. With the disk
+ * I/O thread on, accesses go a window at a time (see diskio.c). RAM disks
+ * are the same, with anonymous memory loaded from a template for a file.
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "machine_impl.h"
+
+/**
+ * Decide whether console output is line buffered
+ */
+static void
+output_mode(struct rbml_machine *m, struct rbml_output *o)
+{
+	o->fp = m->out;
+	if (m->output_buffering == RBML_OUTPUT_AUTO)
+		o->line = fileno(m->out) >= 0 && isatty(fileno(m->out));
+	else
+		o->line = m->output_buffering == RBML_OUTPUT_LINE;
+}
+
+/**
+ * Allocate console output buffer
+ */
+static struct rbml_output *
+output_alloc(struct rbml_machine *m)
+{
+	struct rbml_output *o;
+
+	if ((o = calloc(1, sizeof(*o))) == NULL)
+		return NULL;
+	if ((o->buf = malloc(RBML_OUTPUT_SIZE)) == NULL) {
+		free(o);
+		return NULL;
+	}
+	m->output = o;
+
+	return o;
+}
+
+/**
+ * Write console output buffered so far
+ */
+void
+rbml_machine_flush(struct rbml_machine *m)
+{
+	struct rbml_output *o = m->output;
+	size_t done = 0;
+	ssize_t n;
+	int fd;
+
+	if (o == NULL || o->len == 0)
+		return;
+
+	// whatever the host wrote to the stream goes first
+	fflush(m->out);
+	if ((fd = fileno(m->out)) < 0) {
+		fwrite(o->buf, 1, o->len, m->out);
+		fflush(m->out);
+	} else {
+		while (done < o->len) {
+			if ((n = write(fd, o->buf + done, o->len - done)) < 0) {
+				if (errno == EINTR)
+					continue;
+				break;	// dropped, as stdio would
+			}
+			done += n;
+		}
+	}
+	o->len = 0;
+}
+
+// Generic method for writing characters to console
+void
+rbml_cwrite(struct rbml_machine *m, int fcontrol, rbml_word w)
+{
+	struct rbml_output *o = m->output;
+	char digits[16], *p;
+	unsigned int v;
+	int i, n;
+
+	if (o == NULL && (o = output_alloc(m)) == NULL) {
+		// unbuffered
+		if (fcontrol) {
+			char *s = (char *) &w;
+
+			for (i = sizeof(w) - 1; i >= 0; i--)
+				putc(s[i], m->out);
+		} else {
+			fprintf(m->out, "%d\n", w);
+		}
+		return;
+	}
+	if (o->fp != m->out)
+		output_mode(m, o);
+	if (o->len > RBML_OUTPUT_SIZE - sizeof(digits))
+		rbml_machine_flush(m);
+	p = o->buf + o->len;
+
+	if (fcontrol) {
+		char *s = (char *) &w;
+
+		for (i = sizeof(w) - 1; i >= 0; i--)
+			*p++ = s[i];
+		o->len += sizeof(w);
+		if (o->line && memchr(p - sizeof(w), '\n', sizeof(w)) != NULL)
+			rbml_machine_flush(m);
+	} else {
+		// as printf("%d\n"), digits formed backwards
+		v = w < 0 ? -(unsigned int) w : (unsigned int) w;
+		n = 0;
+		do {
+			digits[n++] = '0' + v % 10;
+			v /= 10;
+		} while (v != 0);
+		if (w < 0)
+			*p++ = '-';
+		while (n > 0)
+			*p++ = digits[--n];
+		*p++ = '\n';
+		o->len = p - o->buf;
+		if (o->line)
+			rbml_machine_flush(m);
+	}
+}
+
+/**
+ * Find the end of the number at the start of fed input, as scanf("%d")
+ * reads it: white space, sign and digits
+ *
+ * @return number of bytes read, or -1 if more input could extend it
+ */
+static ssize_t
+scan_number(const struct rbml_input *in)
+{
+	const char *p = in->buf + in->pos;
+	size_t n = in->len - in->pos;
+	size_t i = 0;
+
+	while (i < n && isspace((unsigned char) p[i]))
+		i++;
+	if (i < n && (p[i] == '-' || p[i] == '+'))
+		i++;
+	while (i < n && isdigit((unsigned char) p[i]))
+		i++;
+	if (i == n && !in->eof)
+		return -1;
+
+	return i;
+}
+
+/**
+ * Check that the input buffered is enough to read a word
+ */
+static int
+input_ready(const struct rbml_input *in, int fcontrol)
+{
+	size_t n;
+
+	if (in->eof)
+		return 1;
+
+	n = in->len - in->pos;
+	if (fcontrol)
+		return n >= sizeof(rbml_word) - 1 || memchr(in->buf + in->pos, '\n', n) != NULL;
+
+	return scan_number(in) >= 0;
+}
+
+/**
+ * Read word from input buffer
+ */
+static rbml_word
+read_input(struct rbml_input *in, int fcontrol)
+{
+	const char *p = in->buf + in->pos;
+	rbml_word w = 0;
+	ssize_t end;
+	size_t i, n;
+
+	if (fcontrol) {
+		// as fgets() into the word: up to 3 characters, through the newline
+		n = in->len - in->pos;
+		for (i = 0; i < n && i < sizeof(w) - 1; i++) {
+			if (p[i] == '\n') {
+				i++;
+				break;
+			}
+		}
+		memcpy(&w, p, i);
+		in->pos += i;
+	} else {
+		long v = 0;
+		int neg = 0;
+
+		// at the end of the input buffered so far if called without waiting for more
+		n = (end = scan_number(in)) >= 0 ? end : in->len - in->pos;
+		for (i = 0; i < n && isspace((unsigned char) p[i]); i++)
+			;
+		if (i < n && (p[i] == '-' || p[i] == '+'))
+			neg = p[i++] == '-';
+		// saturating like strtol(), then truncated to a word like scanf()
+		for (; i < n; i++) {
+			int d = p[i] - '0';
+
+			if (v > (LONG_MAX - d) / 10)
+				v = LONG_MAX;
+			else
+				v = v * 10 + d;
+		}
+		w = neg ? (v == LONG_MAX ? LONG_MIN : -v) : v;
+		in->pos += n;
+	}
+
+	return w;
+}
+
+/**
+ * Free console input
+ */
+void
+rbml_input_free(struct rbml_input *in)
+{
+	if (in == NULL)
+		return;
+	if (in->mapped)
+		munmap(in->buf, in->size);
+	else
+		free(in->buf);
+	free(in);
+}
+
+/**
+ * Read next block of m->in into input buffer (sets eof at its end)
+ */
+static void
+read_block(struct rbml_input *in)
+{
+	size_t size;
+	ssize_t n;
+	char *buf;
+
+	// drop what has been read, and grow if the rest fills the buffer
+	memmove(in->buf, in->buf + in->pos, in->len - in->pos);
+	in->len -= in->pos;
+	in->pos = 0;
+	if (in->len == in->size) {
+		size = in->size * 2;
+		if ((buf = realloc(in->buf, size)) == NULL) {
+			in->eof = 1;
+			return;
+		}
+		in->buf = buf;
+		in->size = size;
+	}
+
+	// whatever is there: a terminal returns a line at a time
+	while ((n = read(fileno(in->fp), in->buf + in->len, in->size - in->len)) < 0 && errno == EINTR)
+		;
+	if (n <= 0)
+		in->eof = 1;
+	else
+		in->len += n;
+}
+
+/**
+ * Get input buffer of m->in: the file mapped from the current position
+ * if it is a regular file, else a buffer filled a block at a time
+ *
+ * @return input, or NULL if out of memory
+ */
+static struct rbml_input *
+stream_input(struct rbml_machine *m)
+{
+	struct rbml_input *in = m->input;
+	struct stat sb;
+	off_t pos;
+	void *p;
+
+	if (in != NULL && in->fp == m->in)
+		return in;
+
+	rbml_input_free(in);
+	if ((m->input = in = calloc(1, sizeof(*in))) == NULL)
+		return NULL;
+	in->fp = m->in;
+
+	if (fstat(fileno(in->fp), &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0
+	    && (pos = ftello(in->fp)) >= 0 && pos <= sb.st_size
+	    && (p = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fileno(in->fp), 0)) != MAP_FAILED) {
+		madvise(p, sb.st_size, MADV_SEQUENTIAL);
+		in->buf = p;
+		in->size = in->len = sb.st_size;
+		in->pos = pos;
+		in->eof = 1;
+		in->mapped = 1;
+		return in;
+	}
+
+	if ((in->buf = malloc(RBML_INPUT_SIZE)) == NULL) {
+		free(in);
+		m->input = NULL;
+		return NULL;
+	}
+	in->size = RBML_INPUT_SIZE;
+
+	return in;
+}
+
+// General read function--called by all console input instructions
+// The fcontrol parameter controls the format of the output.
+//	If fcontrol is high, then the characters will be kept in ASCII
+//	If fcontrol is low, then the characters will be converted to
+//	numeric.
+//	This is important mainly for differentiating between input that is
+//	intended to be kept in character format, and input that should be
+//	converted to a numeric format, when reading in numbers.
+rbml_word
+rbml_cread(struct rbml_machine *m, int fcontrol)
+{
+	struct rbml_input *in;
+	rbml_word w = 0;
+
+	// a prompt is seen before the program waits for the answer
+	rbml_machine_flush(m);
+	if (m->in == NULL)
+		return m->input != NULL ? read_input(m->input, fcontrol) : 0;
+
+	if ((in = stream_input(m)) != NULL) {
+		while (!input_ready(in, fcontrol))
+			read_block(in);
+		return read_input(in, fcontrol);
+	}
+
+	// out of memory: a word at a time
+	if (fcontrol) {
+		fgets((char *) &w, sizeof(w), m->in);
+	} else {
+		fscanf(m->in, "%d", &w);
+	}
+
+	return w;
+}
+
+/**
+ * Check that a console read can complete without waiting for input
+ */
+int
+rbml_cread_ready(struct rbml_machine *m, int fcontrol)
+{
+	if (m->in != NULL)
+		return 1;
+	if (m->input == NULL)
+		return 0;
+
+	return input_ready(m->input, fcontrol);
+}
+
+/**
+ * Feed console input
+ */
+int
+rbml_machine_feed(struct rbml_machine *m, const void *data, size_t len)
+{
+	struct rbml_input *in = m->input;
+	size_t size;
+	char *buf;
+
+	if (in != NULL && in->fp != NULL) {
+		rbml_input_free(in);
+		in = m->input = NULL;
+	}
+	if (in == NULL) {
+		if ((in = calloc(1, sizeof(*in))) == NULL)
+			return -1;
+		m->input = in;
+	}
+	if (data == NULL) {
+		in->eof = 1;
+		return 0;
+	}
+
+	// drop what has been read, and grow
+	memmove(in->buf, in->buf + in->pos, in->len - in->pos);
+	in->len -= in->pos;
+	in->pos = 0;
+	if (in->len + len > in->size) {
+		for (size = in->size ? in->size : 256; size < in->len + len; size *= 2)
+			;
+		if ((buf = realloc(in->buf, size)) == NULL)
+			return -1;
+		in->buf = buf;
+		in->size = size;
+	}
+	memcpy(in->buf + in->len, data, len);
+	in->len += len;
+
+	return 0;
+}
+
+/**
+ * Get monotonic time (ns), to measure disk stalls
+ */
+static uint64_t
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Set end of the inline disk accesses
+ */
+static void
+disk_limit(struct rbml_machine *m, struct rbml_disk *d)
+{
+	size_t limit = d->words;
+
+	if (m->io != NULL && d->fd >= 0) {
+		if (d->window == SIZE_MAX || d->pos / RBML_DISK_WINDOW != d->window)
+			limit = 0;
+		else if ((d->window + 1) * RBML_DISK_WINDOW < limit)
+			limit = (d->window + 1) * RBML_DISK_WINDOW;
+	}
+	d->limit = limit;
+}
+
+/**
+ * Enter the window of the disk position: wait for it to be read in, read
+ * the next one ahead and write the one left behind
+ */
+static void
+disk_window(struct rbml_machine *m, int n, struct rbml_disk *d)
+{
+	const off_t size = RBML_DISK_WINDOW * sizeof(rbml_word);
+	size_t win = d->pos / RBML_DISK_WINDOW;
+	uint64_t start;
+
+	if (m->io == NULL || d->fd < 0 || win == d->window)
+		return;
+
+	// the window was read ahead unless the program moved elsewhere
+	if (d->window == SIZE_MAX || win != d->window + 1)
+		rbml_io_submit(m, d, RBML_IO_PREFETCH, win * size, (win + 1) * size);
+	start = now();
+	rbml_io_wait(m, d);
+	m->disk_stall[n] += now() - start;
+
+	rbml_io_submit(m, d, RBML_IO_PREFETCH, (win + 1) * size, (win + 2) * size);
+	if (d->window != SIZE_MAX)
+		rbml_io_submit(m, d, RBML_IO_WRITEBACK, d->window * size, (d->window + 1) * size);
+	d->window = win;
+}
+
+/**
+ * Make the next disk access check its window
+ */
+void
+rbml_disk_window_reset(struct rbml_machine *m, struct rbml_disk *d)
+{
+	disk_limit(m, d);
+}
+
+/**
+ * Write disk through to stable storage, with the I/O thread on
+ */
+static void
+disk_barrier(struct rbml_machine *m, int n)
+{
+	struct rbml_disk *d = m->disk[n];
+	uint64_t start;
+
+	if (m->io == NULL || d == NULL || d->fd < 0)
+		return;
+
+	start = now();
+	if (rbml_disk_sync(m, n) < 0
+	    || (d->bytes > 0 && msync(d->map, d->bytes, MS_SYNC) < 0)
+	    || fdatasync(d->fd) < 0)
+		m->ioerr = 1;
+	m->disk_stall[n] += now() - start;
+}
+
+/**
+ * Write all disks through to stable storage (HALT)
+ */
+void
+rbml_disk_barrier_all(struct rbml_machine *m)
+{
+	int i;
+
+	for (i = 0; i < countof(m->disk); i++)
+		disk_barrier(m, i);
+}
+
+/**
+ * Get path of disk file in dir (NULL: the current directory)
+ */
+static void
+disk_path(char *path, size_t size, const char *dir, int n)
+{
+	if (dir != NULL)
+		snprintf(path, size, "%s/disk%d.rbdi", dir, n);
+	else
+		snprintf(path, size, "disk%d.rbdi", n);
+}
+
+/**
+ * Load RAM disk from its template
+ */
+static struct rbml_disk *
+ram_load(struct rbml_machine *m, int n)
+{
+	struct rbml_disk *d;
+	struct stat sb;
+	char path[PATH_MAX];
+	ssize_t len;
+	off_t at = 0;
+	int fd;
+
+	disk_path(path, sizeof(path), m->disk_template, n);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat(fd, &sb) < 0 || (d = calloc(1, sizeof(*d))) == NULL) {
+		close(fd);
+		return NULL;
+	}
+	d->fd = -1;
+	d->bytes = d->allocated = sb.st_size;
+	d->words = sb.st_size / sizeof(rbml_word);
+	if (sb.st_size > 0) {
+		d->map = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (d->map == MAP_FAILED) {
+			close(fd);
+			free(d);
+			return NULL;
+		}
+		d->mapped = sb.st_size;
+		for (; at < sb.st_size; at += len) {
+			if ((len = pread(fd, (char *) d->map + at, sb.st_size - at, at)) <= 0)
+				break;
+		}
+	}
+	close(fd);
+	if (at < sb.st_size) {
+		munmap(d->map, d->mapped);
+		free(d);
+		return NULL;
+	}
+
+	return d;
+}
+
+/**
+ * Drop RAM disks
+ */
+void
+rbml_disk_ram_drop(struct rbml_machine *m)
+{
+	struct rbml_disk *d;
+	int i;
+
+	for (i = 0; i < countof(m->ram_disk); i++) {
+		if ((d = m->ram_disk[i]) == NULL)
+			continue;
+		if (m->disk[i] == d)
+			m->disk[i] = NULL;
+		if (d->map != NULL)
+			munmap(d->map, d->mapped);
+		free(d);
+		m->ram_disk[i] = NULL;
+	}
+}
+
+/**
+ * Set directory of the disk files
+ */
+int
+rbml_machine_disk_dir(struct rbml_machine *m, const char *dir)
+{
+	char *copy = NULL;
+
+	if (dir != NULL && (copy = strdup(dir)) == NULL)
+		return -1;
+	free(m->disk_dir);
+	m->disk_dir = copy;
+
+	return 0;
+}
+
+/**
+ * Keep disks in memory
+ */
+int
+rbml_machine_ram_disks(struct rbml_machine *m, const char *template_dir)
+{
+	char *copy = NULL;
+	int i;
+
+	if (template_dir != NULL && (copy = strdup(template_dir)) == NULL)
+		return -1;
+	for (i = 0; i < countof(m->disk); i++)
+		rbml_disk_close(m, i);
+	rbml_disk_ram_drop(m);
+	free(m->disk_template);
+	m->disk_template = copy;
+
+	return 0;
+}
+
+/**
+ * Write RAM disks to the disk directory
+ */
+int
+rbml_machine_save_disks(struct rbml_machine *m)
+{
+	struct rbml_disk *d;
+	char path[PATH_MAX];
+	ssize_t len;
+	off_t at;
+	int i, fd, rc = 0;
+
+	for (i = 0; i < countof(m->ram_disk); i++) {
+		if ((d = m->ram_disk[i]) == NULL)
+			continue;
+		disk_path(path, sizeof(path), m->disk_dir, i);
+		if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+			fprintf(stderr, "Failed to save disk %d to %s: %s\n", i, path, strerror(errno));
+			rc = -1;
+			continue;
+		}
+		for (at = 0; at < d->bytes; at += len) {
+			if ((len = write(fd, (char *) d->map + at, d->bytes - at)) < 0)
+				break;
+		}
+		if (at < d->bytes || close(fd) < 0) {
+			fprintf(stderr, "Failed to save disk %d to %s: %s\n", i, path, strerror(errno));
+			rc = -1;
+		}
+	}
+
+	return rc;
+}
+
+/**
+ * Open disk
+ */
+void
+rbml_disk_open(struct rbml_machine *m, int n)
+{
+	struct rbml_disk *d;
+	struct stat sb;
+	char name[PATH_MAX];
+	int fd;
+
+	rbml_disk_close(m, n);
+	m->ioerr = 0;
+
+	// a RAM disk is loaded once, then reopened where it was left
+	if (m->disk_template != NULL) {
+		if (m->ram_disk[n] == NULL && (m->ram_disk[n] = ram_load(m, n)) == NULL) {
+			m->ioerr = 1;
+			return;
+		}
+		d = m->ram_disk[n];
+		d->pos = 0;
+		disk_limit(m, d);
+		m->disk[n] = d;
+		return;
+	}
+
+	disk_path(name, sizeof(name), m->disk_dir, n);
+	if ((fd = open(name, O_RDWR)) < 0) {
+		m->ioerr = 1;
+		return;
+	}
+	if (fstat(fd, &sb) < 0 || (d = calloc(1, sizeof(*d))) == NULL) {
+		close(fd);
+		m->ioerr = 1;
+		return;
+	}
+	d->fd = fd;
+	d->bytes = d->allocated = sb.st_size;
+	d->words = sb.st_size / sizeof(rbml_word);
+	if (sb.st_size > 0) {
+		d->map = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (d->map == MAP_FAILED) {
+			close(fd);
+			free(d);
+			m->ioerr = 1;
+			return;
+		}
+		d->mapped = sb.st_size;
+	}
+	d->window = SIZE_MAX;
+	disk_limit(m, d);
+	m->disk[n] = d;
+}
+
+/**
+ * Close disk
+ */
+void
+rbml_disk_close(struct rbml_machine *m, int n)
+{
+	struct rbml_disk *d = m->disk[n];
+
+	if (d == NULL)
+		return;
+	if (d->fd < 0) {
+		// RAM disks stay loaded
+		m->disk[n] = NULL;
+		return;
+	}
+	disk_barrier(m, n);
+	rbml_disk_sync(m, n);
+	// a disk only read has its next window still being read ahead
+	rbml_io_wait(m, d);
+	if (d->map != NULL)
+		munmap(d->map, d->mapped);
+	close(d->fd);
+	free(d);
+	m->disk[n] = NULL;
+}
+
+/**
+ * Cut disk file back to the bytes written
+ */
+int
+rbml_disk_sync(struct rbml_machine *m, int n)
+{
+	struct rbml_disk *d = m->disk[n];
+
+	if (d == NULL || d->fd < 0 || d->bytes == d->allocated)
+		return 0;
+
+	// the thread must be done with the pages past the end
+	rbml_io_wait(m, d);
+
+	// the mapping stays as large, only the file pages past the end go
+	if (ftruncate(d->fd, d->bytes) < 0)
+		return -1;
+	d->allocated = d->bytes;
+
+	return 0;
+}
+
+/**
+ * Grow disk file and its mapping to hold at least bytes
+ */
+static int
+disk_grow(struct rbml_disk *d, off_t bytes)
+{
+	off_t allocated = d->allocated;
+	void *map;
+
+	while (allocated < bytes)
+		allocated += allocated > RBML_DISK_EXTENT ? allocated : RBML_DISK_EXTENT;
+
+	if (d->fd < 0) {
+		map = mmap(NULL, allocated, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (map == MAP_FAILED)
+			return -1;
+		if (d->map != NULL) {
+			memcpy(map, d->map, d->bytes);
+			munmap(d->map, d->mapped);
+		}
+		d->map = map;
+		d->mapped = d->allocated = allocated;
+		return 0;
+	}
+
+	if (ftruncate(d->fd, allocated) < 0)
+		return -1;
+	if ((size_t) allocated > d->mapped) {
+		map = mmap(NULL, allocated, PROT_READ | PROT_WRITE, MAP_SHARED, d->fd, 0);
+		if (map == MAP_FAILED) {
+			ftruncate(d->fd, d->allocated);
+			return -1;
+		}
+		if (d->map != NULL)
+			munmap(d->map, d->mapped);
+		d->map = map;
+		d->mapped = allocated;
+	}
+	d->allocated = allocated;
+
+	return 0;
+}
+
+/**
+ * Read word at the end of the disk, or with the disk closed
+ */
+rbml_word
+rbml_disk_read_slow(struct rbml_machine *m, int n)
+{
+	struct rbml_disk *d = m->disk[n];
+	rbml_word w = 0;
+	off_t at;
+
+	if (d == NULL) {
+		m->ioerr = 1;
+		return 0;
+	}
+
+	// a window boundary
+	if (d->pos < d->words) {
+		disk_window(m, n, d);
+		disk_limit(m, d);
+		return d->map[d->pos++];
+	}
+
+	// a partial word at the end of the file reads padded with zeros
+	at = (off_t) d->pos * sizeof(rbml_word);
+	if (at >= d->bytes) {
+		m->ioerr = 1;
+		return 0;
+	}
+	memcpy(&w, (char *) d->map + at, d->bytes - at);
+	d->pos++;
+
+	return w;
+}
+
+/**
+ * Write word at the end of the disk, or with the disk closed
+ */
+void
+rbml_disk_write_slow(struct rbml_machine *m, int n, rbml_word w)
+{
+	struct rbml_disk *d = m->disk[n];
+	off_t end;
+
+	if (d == NULL) {
+		m->ioerr = 1;
+		return;
+	}
+
+	end = (off_t) (d->pos + 1) * sizeof(rbml_word);
+	if (end > d->allocated) {
+		uint64_t start = now();
+
+		// growing may move the mapping the thread is reading
+		rbml_io_wait(m, d);
+		if (disk_grow(d, end) < 0) {
+			m->ioerr = 1;
+			return;
+		}
+		m->disk_stall[n] += now() - start;
+	}
+	disk_window(m, n, d);
+	d->map[d->pos++] = w;
+	if (end > d->bytes) {
+		d->bytes = end;
+		d->words = end / sizeof(rbml_word);
+	}
+	disk_limit(m, d);
+}
+
+/**
+ * Get disk size (words, a partial word at the end counts)
+ */
+static size_t
+disk_end(const struct rbml_disk *d)
+{
+	return (d->bytes + sizeof(rbml_word) - 1) / sizeof(rbml_word);
+}
+
+/**
+ * Move disk position forward or backward
+ */
+void
+rbml_disk_move(struct rbml_machine *m, int n, int backward, int steps)
+{
+	struct rbml_disk *d = m->disk[n];
+	size_t end;
+
+	if (d == NULL) {
+		m->ioerr = 1;
+		return;
+	}
+
+	end = disk_end(d);
+	if (backward)
+		d->pos = d->pos > (size_t) steps ? d->pos - steps : 0;
+	else if (d->pos < end)
+		d->pos = end - d->pos > (size_t) steps ? d->pos + steps : end;
+	disk_limit(m, d);
+}
+
+/**
+ * Move disk position to the start or the end
+ */
+void
+rbml_disk_reset(struct rbml_machine *m, int n, int end)
+{
+	struct rbml_disk *d = m->disk[n];
+
+	if (d == NULL) {
+		m->ioerr = 1;
+		return;
+	}
+
+	d->pos = end ? disk_end(d) : 0;
+	disk_limit(m, d);
+}
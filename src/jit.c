@@ -0,0 +1,1053 @@
+/**
+ * RBML machine: JIT engine
+ *
+ * Basic blocks are compiled to x86-64 machine code once they have been
+ * entered JIT_HOT times; everything else runs one instruction at a time
+ * on the reference engine. A block is a run of register, memory,
+ * arithmetic and compare instructions, ending with a branch or before the
+ * first instruction the JIT leaves to the reference engine (console and
+ * disk I/O, CALL, END, HALT, ..., and any instruction whose ARG3 memory
+ * operand or branch target is out of memory, for the reference engine to
+ * check). A block returns the address to continue
+ * at; a branch back to the start of its own block loops in machine code
+ * for as long as another pass fits in the instruction budget.
+ *
+ * In a block, the accumulator, the jump register and the machine registers
+ * used most by the block live in host registers (the others are accessed
+ * in place), and are written back when the block exits. Flags are only
+ * produced where they can be read, that is by the last instruction
+ * writing them before the block can exit: compares set the comparison
+ * flags (and a branch right after a compare tests the host flags), and
+ * divisions the divide by zero flag. For the overflow flag, the block
+ * only records the operands of the add, subtract or multiply; the ALU
+ * functions compute it when the machine stops or the reference engine
+ * takes over.
+ *
+ * Stores into a word compiled into a block leave the block, and the
+ * blocks covering the word are dropped to be compiled again from the new
+ * contents.
+ *
+ * Code is generated into an mmap()ed region that is only writable while
+ * blocks are compiled, and executable otherwise. When the region fills
+ * up, all blocks are dropped.
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "machine_impl.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+#include <sys/mman.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * Number of times a block is entered before it is compiled
+ */
+#define JIT_HOT		16
+
+/**
+ * Longest block (number of instructions)
+ */
+#define JIT_BLOCK_MAX	32
+
+/**
+ * Code region size, and room left for compiling one block
+ */
+#define JIT_CODE_SIZE	(1024 * 1024)
+#define JIT_CODE_BLOCK	(16 * 1024)
+
+/*
+ * Operations recorded for the overflow flag
+ */
+#define OVF_NONE	0
+#define OVF_ADD		1
+#define OVF_SUB		2
+#define OVF_MULT	3
+
+/**
+ * Compiled block
+ */
+struct jit_block {
+	int (*fn)(struct rbml_machine *m, struct rbml_jit *j);
+				/**< compiled code */
+	int start;		/**< first word */
+	int end;		/**< word after the last one */
+	struct jit_block *next;	/**< next block */
+};
+
+/**
+ * JIT state of a machine
+ */
+struct rbml_jit {
+	/* read and written by compiled code */
+	int32_t ovf_op;		/**< last operation writing overflow (OVF_*) */
+	int32_t ovf_a;		/**< its first operand */
+	int32_t ovf_b;		/**< its second operand */
+	int32_t inval;		/**< word stored into by a block (-1: none) */
+	uint64_t limit;		/**< instruction count blocks stop at */
+	uint8_t *covered;	/**< number of blocks covering each word */
+
+	struct jit_block **entry;
+				/**< block starting at each word */
+	uint8_t *heat;		/**< number of times each word was entered */
+	struct jit_block *blocks;
+				/**< all blocks */
+
+	uint8_t *code;		/**< code region */
+	size_t code_used;	/**< bytes of code region used */
+	size_t words;		/**< words covered by the per word arrays
+				     (main memory when allocated) */
+};
+
+/*
+ * Host registers
+ */
+#define RAX	0
+#define RCX	1
+#define RDX	2
+#define RBX	3
+#define RSP	4
+#define RBP	5
+#define RSI	6
+#define RDI	7
+#define R8	8
+#define R9	9
+#define R10	10
+#define R11	11
+#define R12	12
+#define R13	13
+#define R14	14
+#define R15	15
+
+/*
+ * Register assignment: RAX, RCX and RDX are scratch, RBX holds the
+ * machine, RBP the JIT state and R14 main memory.
+ */
+#define HOST_M		RBX
+#define HOST_J		RBP
+#define HOST_MEMORY	R14
+#define HOST_ACC	R13
+#define HOST_JUMP	R15
+static const int host_regs[] = { RSI, RDI, R8, R9, R10, R11, R12 };
+
+/*
+ * Condition codes
+ */
+#define CC_E		0x4
+#define CC_NE		0x5
+#define CC_BE		0x6
+#define CC_L		0xc
+#define CC_GE		0xd
+#define CC_G		0xf
+
+/**
+ * Instruction operand: host register or memory at base + disp
+ */
+struct operand {
+	int reg;
+	int base;
+	int32_t disp;
+};
+
+/**
+ * Block being compiled
+ */
+struct compiler {
+	uint8_t *p;		/**< output */
+	uint8_t *end;		/**< end of output */
+
+	size_t memory_size;	/**< main memory size (number of words) */
+	int len;		/**< block length (number of instructions) */
+	int map[16];		/**< host register of each machine register
+				     (-1: accessed in place) */
+};
+
+/*
+ * Flags written by an instruction that can be seen
+ */
+#define LIVE_CMP	0x01	/**< comparison flags */
+#define LIVE_OVERFLOW	0x02	/**< overflow flag */
+#define LIVE_DIVZERO	0x04	/**< divide by zero flag */
+#define LIVE_ALL	(LIVE_CMP | LIVE_OVERFLOW | LIVE_DIVZERO)
+
+static struct operand
+reg_operand(int reg)
+{
+	struct operand o = { reg, -1, 0 };
+	return o;
+}
+
+static struct operand
+mem_operand(int base, int32_t disp)
+{
+	struct operand o = { -1, base, disp };
+	return o;
+}
+
+#define M_FIELD(field)	mem_operand(HOST_M, offsetof(struct rbml_machine, field))
+#define J_FIELD(field)	mem_operand(HOST_J, offsetof(struct rbml_jit, field))
+#define WORD(addr)	mem_operand(HOST_MEMORY, (addr) * (int32_t) sizeof(rbml_word))
+
+/*
+ * Instruction encoding
+ */
+
+static void
+emit8(struct compiler *c, int b)
+{
+	if (c->p < c->end)
+		*c->p = b;
+	c->p++;
+}
+
+static void
+emit32(struct compiler *c, uint32_t v)
+{
+	emit8(c, v);
+	emit8(c, v >> 8);
+	emit8(c, v >> 16);
+	emit8(c, v >> 24);
+}
+
+/**
+ * Emit instruction with ModR/M operand
+ *
+ * @param w64 64 bit operand size
+ * @param opcode opcode (two bytes if > 0xff)
+ * @param r register (or opcode extension) field
+ * @param o register or memory operand
+ */
+static void
+emit_rm(struct compiler *c, int w64, int opcode, int r, struct operand o)
+{
+	int rm = o.reg >= 0 ? o.reg : o.base;
+	int rex = 0x40 | (w64 ? 0x08 : 0) | (r >= 8 ? 0x04 : 0) | (rm >= 8 ? 0x01 : 0);
+
+	if (rex != 0x40)
+		emit8(c, rex);
+	if (opcode > 0xff)
+		emit8(c, opcode >> 8);
+	emit8(c, opcode);
+
+	if (o.reg >= 0) {
+		emit8(c, 0xc0 | (r & 7) << 3 | (rm & 7));
+	} else {
+		emit8(c, 0x80 | (r & 7) << 3 | (rm & 7));
+		if ((rm & 7) == RSP)
+			emit8(c, 0x24);
+		emit32(c, o.disp);
+	}
+}
+
+#define MOV_LOAD(c, r, o)	emit_rm(c, 0, 0x8b, r, o)
+#define MOV_STORE(c, o, r)	emit_rm(c, 0, 0x89, r, o)
+#define MOV_LOAD64(c, r, o)	emit_rm(c, 1, 0x8b, r, o)
+#define MOV_STORE64(c, o, r)	emit_rm(c, 1, 0x89, r, o)
+#define ADD(c, r, o)		emit_rm(c, 0, 0x03, r, o)
+#define SUB(c, r, o)		emit_rm(c, 0, 0x2b, r, o)
+#define AND(c, r, o)		emit_rm(c, 0, 0x23, r, o)
+#define OR(c, r, o)		emit_rm(c, 0, 0x0b, r, o)
+#define XOR(c, r, o)		emit_rm(c, 0, 0x33, r, o)
+#define CMP(c, r, o)		emit_rm(c, 0, 0x3b, r, o)
+#define CMP64(c, r, o)		emit_rm(c, 1, 0x3b, r, o)
+#define TEST(c, r, o)		emit_rm(c, 0, 0x85, r, o)
+#define IMUL(c, r, o)		emit_rm(c, 0, 0x0faf, r, o)
+#define NOT(c, o)		emit_rm(c, 0, 0xf7, 2, o)
+#define IDIV(c, o)		emit_rm(c, 0, 0xf7, 7, o)
+#define SHL_CL(c, o)		emit_rm(c, 0, 0xd3, 4, o)
+#define SAR_CL(c, o)		emit_rm(c, 0, 0xd3, 7, o)
+#define SETCC(c, cc, o)		emit_rm(c, 0, 0x0f90 | (cc), 0, o)
+#define CDQ(c)			emit8(c, 0x99)
+#define RET(c)			emit8(c, 0xc3)
+
+static void
+mov_imm(struct compiler *c, struct operand o, int32_t imm)
+{
+	emit_rm(c, 0, 0xc7, 0, o);
+	emit32(c, imm);
+}
+
+static void
+cmp_imm8(struct compiler *c, struct operand o, int8_t imm)
+{
+	emit_rm(c, 0, 0x83, 7, o);
+	emit8(c, imm);
+}
+
+static void
+cmp_byte_imm8(struct compiler *c, struct operand o, int8_t imm)
+{
+	emit_rm(c, 0, 0x80, 7, o);
+	emit8(c, imm);
+}
+
+static void
+add64_imm(struct compiler *c, struct operand o, int32_t imm)
+{
+	emit_rm(c, 1, 0x81, 0, o);
+	emit32(c, imm);
+}
+
+static void
+push(struct compiler *c, int r)
+{
+	if (r >= 8)
+		emit8(c, 0x41);
+	emit8(c, 0x50 | (r & 7));
+}
+
+static void
+pop(struct compiler *c, int r)
+{
+	if (r >= 8)
+		emit8(c, 0x41);
+	emit8(c, 0x58 | (r & 7));
+}
+
+/**
+ * Emit conditional jump
+ *
+ * @return location to patch with patch()
+ */
+static uint8_t *
+jcc(struct compiler *c, int cc)
+{
+	emit8(c, 0x0f);
+	emit8(c, 0x80 | cc);
+	emit32(c, 0);
+
+	return c->p;
+}
+
+/**
+ * Emit jump
+ *
+ * @return location to patch with patch()
+ */
+static uint8_t *
+jmp(struct compiler *c)
+{
+	emit8(c, 0xe9);
+	emit32(c, 0);
+
+	return c->p;
+}
+
+/**
+ * Point jump emitted by jcc() or jmp() at target
+ */
+static void
+patch(struct compiler *c, uint8_t *from, uint8_t *target)
+{
+	int32_t rel = target - from;
+
+	if (from <= c->end)
+		memcpy(from - 4, &rel, 4);
+}
+
+/*
+ * Machine state
+ */
+
+static struct operand
+machine_reg(struct compiler *c, int n)
+{
+	if (c->map[n] >= 0)
+		return reg_operand(c->map[n]);
+
+	return M_FIELD(reg[n]);
+}
+
+/**
+ * Copy word between operands
+ */
+static void
+move(struct compiler *c, struct operand dst, struct operand src)
+{
+	if (dst.reg >= 0) {
+		if (dst.reg != src.reg)
+			MOV_LOAD(c, dst.reg, src);
+	} else if (src.reg >= 0) {
+		MOV_STORE(c, dst, src.reg);
+	} else {
+		MOV_LOAD(c, RAX, src);
+		MOV_STORE(c, dst, RAX);
+	}
+}
+
+#define set_reg(c, n, src)	move(c, machine_reg(c, n), src)
+#define set_acc(c, src)		move(c, reg_operand(HOST_ACC), src)
+#define set_jump(c, src)	move(c, reg_operand(HOST_JUMP), src)
+
+/**
+ * Emit block exit: count instructions retired, write back registers and
+ * return next address
+ */
+static void
+emit_exit(struct compiler *c, int next, int retired)
+{
+	int i;
+
+	// a block can loop, so any exit may follow any write
+	add64_imm(c, M_FIELD(instructions), retired);
+	for (i = 0; i < countof(c->map); i++) {
+		if (c->map[i] >= 0)
+			MOV_STORE(c, M_FIELD(reg[i]), c->map[i]);
+	}
+	MOV_STORE(c, M_FIELD(accumulator), HOST_ACC);
+	MOV_STORE(c, M_FIELD(jump), HOST_JUMP);
+
+	mov_imm(c, reg_operand(RAX), next);
+	pop(c, R15);
+	pop(c, R14);
+	pop(c, R13);
+	pop(c, R12);
+	pop(c, RBP);
+	pop(c, RBX);
+	RET(c);
+}
+
+/**
+ * Store into word may leave the block (the word may be compiled)
+ */
+static int
+exits_on_store(struct compiler *c, int addr)
+{
+	return addr < c->memory_size;
+}
+
+/**
+ * Emit store into main memory, leaving the block if the word is compiled
+ */
+static void
+emit_store(struct compiler *c, int addr, struct operand src, int pc, int retired)
+{
+	uint8_t *skip;
+
+	move(c, WORD(addr), src);
+	if (!exits_on_store(c, addr))
+		return;
+
+	MOV_LOAD64(c, RAX, J_FIELD(covered));
+	cmp_byte_imm8(c, mem_operand(RAX, addr), 0);
+	skip = jcc(c, CC_E);
+	mov_imm(c, J_FIELD(inval), addr);
+	emit_exit(c, pc + 1, retired);
+	patch(c, skip, c->p);
+}
+
+/*
+ * Block compilation
+ */
+
+/**
+ * Instruction can be compiled
+ */
+static int
+compilable(int op)
+{
+	return (op >= OP_STO && op <= OP_MOVJ) ||
+	    (op >= OP_ADD && op <= OP_MODJ) ||
+	    (op >= OP_CJNT && op <= OP_RSFJ) ||
+	    (op >= OP_CMP && op <= OP_CMPM) ||
+	    (op >= OP_BRAN && op <= OP_BRLE);
+}
+
+/**
+ * Instruction writes overflow flag
+ */
+static int
+writes_overflow(int op)
+{
+	return (op >= OP_ADD && op <= OP_SUBJ) || (op >= OP_MULT && op <= OP_MLTJ);
+}
+
+/**
+ * Instruction writes divide by zero flag
+ */
+static int
+writes_divzero(int op)
+{
+	return (op >= OP_DIV && op <= OP_DIVJ) || (op >= OP_MOD && op <= OP_MODJ);
+}
+
+/**
+ * Get the operands of an arithmetic or logic instruction: reg1, reg2 for
+ * the plain form, acc, reg1 for the A form and jump, reg1 for the J form
+ *
+ * @param base opcode of the plain form
+ */
+static void
+alu_operands(struct compiler *c, rbml_word w, int base, struct operand *x, struct operand *y)
+{
+	switch (RBML_OPCODE(w) - base) {
+	case 0:
+		*x = machine_reg(c, RBML_ARG1(w));
+		*y = machine_reg(c, RBML_ARG2(w));
+		break;
+	case 1:
+		*x = reg_operand(HOST_ACC);
+		*y = machine_reg(c, RBML_ARG1(w));
+		break;
+	default:
+		*x = reg_operand(HOST_JUMP);
+		*y = machine_reg(c, RBML_ARG1(w));
+		break;
+	}
+}
+
+/**
+ * Emit arithmetic or logic instruction
+ *
+ * @param flag_writer the error flag written by the instruction can be seen
+ */
+static void
+emit_alu(struct compiler *c, rbml_word w, int flag_writer)
+{
+	int op = RBML_OPCODE(w);
+	struct operand x, y;
+	uint8_t *zero, *done;
+
+	switch (op) {
+	case OP_ADD: case OP_ADDA: case OP_ADDJ:
+	case OP_SUB: case OP_SUBA: case OP_SUBJ:
+	case OP_MULT: case OP_MLTA: case OP_MLTJ:
+		alu_operands(c, w, op <= OP_ADDJ ? OP_ADD : op <= OP_SUBJ ? OP_SUB : OP_MULT, &x, &y);
+		MOV_LOAD(c, RAX, x);
+		MOV_LOAD(c, RCX, y);
+		if (flag_writer) {
+			MOV_STORE(c, J_FIELD(ovf_a), RAX);
+			MOV_STORE(c, J_FIELD(ovf_b), RCX);
+			mov_imm(c, J_FIELD(ovf_op), op <= OP_ADDJ ? OVF_ADD : op <= OP_SUBJ ? OVF_SUB : OVF_MULT);
+		}
+		if (op <= OP_ADDJ)
+			ADD(c, RAX, reg_operand(RCX));
+		else if (op <= OP_SUBJ)
+			SUB(c, RAX, reg_operand(RCX));
+		else
+			IMUL(c, RAX, reg_operand(RCX));
+		break;
+
+	case OP_DIV: case OP_DIVA: case OP_DIVJ:
+	case OP_MOD: case OP_MODA: case OP_MODJ:
+		alu_operands(c, w, op <= OP_DIVJ ? OP_DIV : OP_MOD, &x, &y);
+		MOV_LOAD(c, RCX, y);
+		MOV_LOAD(c, RAX, x);
+		TEST(c, RCX, reg_operand(RCX));
+		if (flag_writer)
+			SETCC(c, CC_E, M_FIELD(divzero));
+		zero = jcc(c, CC_E);
+		CDQ(c);
+		IDIV(c, reg_operand(RCX));
+		if (op >= OP_MOD)
+			MOV_LOAD(c, RAX, reg_operand(RDX));
+		done = jmp(c);
+		patch(c, zero, c->p);
+		XOR(c, RAX, reg_operand(RAX));
+		patch(c, done, c->p);
+		break;
+
+	case OP_CJNT: case OP_CJNA: case OP_CJNJ:
+		alu_operands(c, w, OP_CJNT, &x, &y);
+		MOV_LOAD(c, RAX, x);
+		AND(c, RAX, y);
+		break;
+
+	case OP_DJNT: case OP_DJNA: case OP_DJNJ:
+		alu_operands(c, w, OP_DJNT, &x, &y);
+		MOV_LOAD(c, RAX, x);
+		OR(c, RAX, y);
+		break;
+
+	case OP_COMP: case OP_COMPA: case OP_COMPJ:
+		alu_operands(c, w, OP_COMP, &x, &y);
+		MOV_LOAD(c, RAX, x);
+		NOT(c, reg_operand(RAX));
+		break;
+
+	case OP_LSFT: case OP_LSFA: case OP_LSFJ:
+	case OP_RSFT: case OP_RSFA: case OP_RSFJ:
+		alu_operands(c, w, op <= OP_LSFJ ? OP_LSFT : OP_RSFT, &x, &y);
+		MOV_LOAD(c, RCX, y);
+		MOV_LOAD(c, RAX, x);
+		if (op <= OP_LSFJ)
+			SHL_CL(c, reg_operand(RAX));
+		else
+			SAR_CL(c, reg_operand(RAX));
+		break;
+	}
+
+	set_acc(c, reg_operand(RAX));
+}
+
+/**
+ * Emit conditional branch condition
+ *
+ * @param host_flags the host flags still hold the last compare
+ * @return location to patch with the branch target
+ */
+static uint8_t *
+emit_condition(struct compiler *c, int op, int host_flags)
+{
+	if (host_flags) {
+		switch (op) {
+		case OP_BRGT:	return jcc(c, CC_G);
+		case OP_BRLT:	return jcc(c, CC_L);
+		case OP_BREQ:	return jcc(c, CC_E);
+		case OP_BRGE:	return jcc(c, CC_GE);
+		default:	return jcc(c, CC_NE);	/* BRLE: greater || less */
+		}
+	}
+
+	switch (op) {
+	case OP_BRGT:
+		cmp_imm8(c, M_FIELD(greater), 0);
+		break;
+	case OP_BRLT:
+		cmp_imm8(c, M_FIELD(less), 0);
+		break;
+	case OP_BREQ:
+		cmp_imm8(c, M_FIELD(equal), 0);
+		break;
+	case OP_BRGE:
+		MOV_LOAD(c, RAX, M_FIELD(greater));
+		OR(c, RAX, M_FIELD(equal));
+		break;
+	default:
+		MOV_LOAD(c, RAX, M_FIELD(greater));
+		OR(c, RAX, M_FIELD(less));
+		break;
+	}
+
+	return jcc(c, CC_NE);
+}
+
+/**
+ * Emit jump to branch target: loop if it is the start of the block (and
+ * one more pass fits in the instruction budget), leave the block otherwise
+ */
+static void
+emit_branch(struct compiler *c, int target, int start, uint8_t *body, int retired)
+{
+	if (target == start) {
+		add64_imm(c, M_FIELD(instructions), retired);
+		MOV_LOAD64(c, RAX, M_FIELD(instructions));
+		add64_imm(c, reg_operand(RAX), c->len);
+		CMP64(c, RAX, J_FIELD(limit));
+		patch(c, jcc(c, CC_BE), body);
+		emit_exit(c, start, 0);
+	} else {
+		emit_exit(c, target, retired);
+	}
+}
+
+/**
+ * Compile block starting at start
+ *
+ * @return code, or NULL if the block is empty or did not fit
+ */
+static void *
+compile(struct rbml_machine *m, struct rbml_jit *j, int start, int *end)
+{
+	struct compiler c;
+	const rbml_word *memory = m->memory;
+	int n, i, k, op, pc, need;
+	int uses[16] = { 0 };
+	uint8_t live[JIT_BLOCK_MAX];
+	uint8_t *code, *body, *taken;
+	rbml_word w;
+
+	memset(&c, 0, sizeof(c));
+	c.memory_size = m->memory_size;
+
+	// find block
+	for (n = 0, pc = start; pc < m->memory_size && n < JIT_BLOCK_MAX; n++, pc++) {
+		w = memory[pc];
+		op = RBML_OPCODE(w);
+		if (!compilable(op) || !rbml_arg3_valid(w, m->memory_size))
+			break;
+
+		uses[RBML_ARG1(w)]++;
+		uses[RBML_ARG2(w)]++;
+		if (op >= OP_BRAN && op <= OP_BRLE) {
+			n++;
+			break;
+		}
+	}
+	if (n == 0)
+		return NULL;
+	*end = start + n;
+	c.len = n;
+
+	// flags are only seen if the block can exit before they are written again
+	need = LIVE_ALL;
+	for (i = n - 1; i >= 0; i--) {
+		w = memory[start + i];
+		op = RBML_OPCODE(w);
+
+		live[i] = 0;
+		if (op >= OP_CMP && op <= OP_CMPM) {
+			live[i] |= need & LIVE_CMP;
+			need &= ~LIVE_CMP;
+		}
+		if (writes_overflow(op)) {
+			live[i] |= need & LIVE_OVERFLOW;
+			need &= ~LIVE_OVERFLOW;
+		}
+		if (writes_divzero(op)) {
+			live[i] |= need & LIVE_DIVZERO;
+			need &= ~LIVE_DIVZERO;
+		}
+		if ((op == OP_STO || op == OP_STOA || op == OP_STOJ) && exits_on_store(&c, RBML_ARG3(w)))
+			need = LIVE_ALL;
+	}
+
+	// keep the machine registers used most in host registers
+	for (i = 0; i < countof(c.map); i++)
+		c.map[i] = -1;
+	for (k = 0; k < countof(host_regs); k++) {
+		int best = -1;
+
+		for (i = 0; i < countof(uses); i++) {
+			if (c.map[i] < 0 && uses[i] > 0 && (best < 0 || uses[i] > uses[best]))
+				best = i;
+		}
+		if (best < 0)
+			break;
+		c.map[best] = host_regs[k];
+	}
+
+	code = j->code + j->code_used;
+	c.p = code;
+	c.end = j->code + JIT_CODE_SIZE;
+
+	// prologue
+	push(&c, RBX);
+	push(&c, RBP);
+	push(&c, R12);
+	push(&c, R13);
+	push(&c, R14);
+	push(&c, R15);
+	MOV_STORE64(&c, reg_operand(HOST_M), RDI);
+	MOV_STORE64(&c, reg_operand(HOST_J), RSI);
+	MOV_LOAD64(&c, HOST_MEMORY, M_FIELD(memory));
+	MOV_LOAD(&c, HOST_ACC, M_FIELD(accumulator));
+	MOV_LOAD(&c, HOST_JUMP, M_FIELD(jump));
+	for (i = 0; i < countof(c.map); i++) {
+		if (c.map[i] >= 0)
+			MOV_LOAD(&c, c.map[i], M_FIELD(reg[i]));
+	}
+	body = c.p;
+
+	for (i = 0, pc = start; i < n; i++, pc++) {
+		struct operand x, y;
+		int arg1, arg2, arg3;
+
+		w = memory[pc];
+		op = RBML_OPCODE(w);
+		arg1 = RBML_ARG1(w);
+		arg2 = RBML_ARG2(w);
+		arg3 = RBML_ARG3(w);
+
+		switch (op) {
+		case OP_STO:	emit_store(&c, arg3, machine_reg(&c, arg1), pc, i + 1); break;
+		case OP_STOA:	emit_store(&c, arg3, reg_operand(HOST_ACC), pc, i + 1); break;
+		case OP_STOJ:	emit_store(&c, arg3, reg_operand(HOST_JUMP), pc, i + 1); break;
+
+		case OP_LOD:	set_reg(&c, arg1, WORD(arg3)); break;
+		case OP_LODA:	set_acc(&c, WORD(arg3)); break;
+		case OP_LODJ:	set_jump(&c, WORD(arg3)); break;
+
+		case OP_MOV:	set_reg(&c, arg2, machine_reg(&c, arg1)); break;
+		case OP_MOVA:
+			if (arg1)
+				set_reg(&c, arg2, reg_operand(HOST_ACC));
+			else
+				set_acc(&c, machine_reg(&c, arg2));
+			break;
+		case OP_MOVJ:
+			if (arg1)
+				set_reg(&c, arg2, reg_operand(HOST_JUMP));
+			else
+				set_jump(&c, machine_reg(&c, arg2));
+			break;
+
+		case OP_CMP:
+		case OP_CMPA:
+		case OP_CMPJ:
+		case OP_CMPM:
+			if (!live[i])
+				break;
+			if (op == OP_CMPM) {
+				x = machine_reg(&c, arg1);
+				y = WORD(arg3);
+			} else {
+				alu_operands(&c, w, OP_CMP, &x, &y);
+			}
+			MOV_LOAD(&c, RAX, x);
+			CMP(&c, RAX, y);
+			SETCC(&c, CC_L, M_FIELD(less));
+			SETCC(&c, CC_E, M_FIELD(equal));
+			SETCC(&c, CC_G, M_FIELD(greater));
+			break;
+
+		case OP_BRAN:
+			emit_branch(&c, arg3, start, body, i + 1);
+			break;
+		case OP_BRGT:
+		case OP_BRLT:
+		case OP_BREQ:
+		case OP_BRGE:
+		case OP_BRLE:
+			// the host flags still hold a compare just before
+			taken = emit_condition(&c, op, i > 0 && RBML_OPCODE(memory[pc - 1]) >= OP_CMP &&
+			    RBML_OPCODE(memory[pc - 1]) <= OP_CMPM);
+			emit_exit(&c, pc + 1, i + 1);
+			patch(&c, taken, c.p);
+			emit_branch(&c, arg3, start, body, i + 1);
+			break;
+
+		default:
+			emit_alu(&c, w, live[i] != 0);
+			break;
+		}
+	}
+	if (op < OP_BRAN || op > OP_BRLE)
+		emit_exit(&c, pc, n);
+
+	if (c.p > c.end)
+		return NULL;
+	j->code_used += c.p - code;
+
+	return code;
+}
+
+/**
+ * Drop all blocks
+ */
+static void
+flush(struct rbml_machine *m, struct rbml_jit *j)
+{
+	struct jit_block *b;
+
+	while ((b = j->blocks) != NULL) {
+		j->blocks = b->next;
+		free(b);
+	}
+	rbml_reserve_clear(j->entry, j->words * sizeof(*j->entry));
+	rbml_reserve_clear(j->covered, j->words * sizeof(*j->covered));
+	rbml_reserve_clear(j->heat, j->words * sizeof(*j->heat));
+	j->code_used = 0;
+}
+
+/**
+ * Compile block starting at pc
+ */
+static struct jit_block *
+compile_block(struct rbml_machine *m, struct rbml_jit *j, int pc)
+{
+	struct jit_block *b;
+	void *code;
+	int end, i;
+
+	if ((b = malloc(sizeof(*b))) == NULL)
+		return NULL;
+	if (JIT_CODE_SIZE - j->code_used < JIT_CODE_BLOCK)
+		flush(m, j);
+
+	mprotect(j->code, JIT_CODE_SIZE, PROT_READ | PROT_WRITE);
+	code = compile(m, j, pc, &end);
+	mprotect(j->code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC);
+	if (code == NULL) {
+		free(b);
+		return NULL;
+	}
+
+	b->fn = code;
+	b->start = pc;
+	b->end = end;
+	b->next = j->blocks;
+	j->blocks = b;
+	j->entry[pc] = b;
+	for (i = b->start; i < b->end; i++)
+		j->covered[i]++;
+
+	return b;
+}
+
+/**
+ * Drop blocks covering word
+ */
+static void
+invalidate(struct rbml_machine *m, struct rbml_jit *j, int addr)
+{
+	struct jit_block **bp, *b;
+	int i;
+
+	for (bp = &j->blocks; (b = *bp) != NULL; ) {
+		if (addr < b->start || addr >= b->end) {
+			bp = &b->next;
+			continue;
+		}
+
+		*bp = b->next;
+		j->entry[b->start] = NULL;
+		j->heat[b->start] = 0;
+		for (i = b->start; i < b->end; i++)
+			j->covered[i]--;
+		free(b);
+	}
+}
+
+/**
+ * Set overflow flag from the last operation recorded by compiled code
+ */
+static void
+materialize(struct rbml_machine *m, struct rbml_jit *j)
+{
+	switch (j->ovf_op) {
+	case OVF_ADD:
+		rbml_add(j->ovf_a, j->ovf_b, &m->overflow);
+		break;
+	case OVF_SUB:
+		rbml_sub(j->ovf_a, j->ovf_b, &m->overflow);
+		break;
+	case OVF_MULT:
+		rbml_mult(j->ovf_a, j->ovf_b, &m->overflow);
+		break;
+	}
+	j->ovf_op = OVF_NONE;
+}
+
+/**
+ * Get JIT state of machine
+ */
+static struct rbml_jit *
+jit_get(struct rbml_machine *m)
+{
+	struct rbml_jit *j;
+
+	if (m->jit != NULL)
+		return m->jit;
+
+	if ((j = calloc(1, sizeof(*j))) == NULL)
+		return NULL;
+	m->jit = j;
+
+	j->inval = -1;
+	j->words = m->memory_size;
+	j->covered = rbml_reserve(j->words * sizeof(*j->covered));
+	j->entry = rbml_reserve(j->words * sizeof(*j->entry));
+	j->heat = rbml_reserve(j->words * sizeof(*j->heat));
+	j->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (j->code == MAP_FAILED)
+		j->code = NULL;
+	if (j->covered == NULL || j->entry == NULL || j->heat == NULL || j->code == NULL) {
+		rbml_jit_free(m);
+		return NULL;
+	}
+
+	return j;
+}
+
+/**
+ * Drop JIT compiled code and state
+ */
+void
+rbml_jit_free(struct rbml_machine *m)
+{
+	struct rbml_jit *j = m->jit;
+	struct jit_block *b;
+
+	if (j == NULL)
+		return;
+
+	while ((b = j->blocks) != NULL) {
+		j->blocks = b->next;
+		free(b);
+	}
+	if (j->code != NULL)
+		munmap(j->code, JIT_CODE_SIZE);
+	rbml_release(j->covered, j->words * sizeof(*j->covered));
+	rbml_release(j->entry, j->words * sizeof(*j->entry));
+	rbml_release(j->heat, j->words * sizeof(*j->heat));
+	free(j);
+	m->jit = NULL;
+}
+
+/**
+ * Run machine on the JIT engine
+ */
+void
+rbml_engine_jit(struct rbml_machine *m, uint64_t budget)
+{
+	struct rbml_jit *j;
+	struct jit_block *b;
+	rbml_word w;
+	int pc, op;
+
+	if ((j = jit_get(m)) == NULL) {
+		rbml_machine_error(m, "Failed to allocate JIT code region");
+		return;
+	}
+
+	j->limit = budget > UINT64_MAX - m->instructions ? UINT64_MAX : m->instructions + budget;
+	while (!m->halted && !m->blocked && m->instructions < j->limit) {
+		pc = m->instruction_counter;
+		if ((size_t) pc >= m->memory_size) {
+			rbml_machine_error(m, "Instruction counter out of memory region");
+			break;
+		}
+
+		b = j->entry[pc];
+		if (b == NULL && j->heat[pc] < JIT_HOT && ++j->heat[pc] == JIT_HOT)
+			b = compile_block(m, j, pc);
+		// a block runs only if it cannot overrun the budget
+		if (b != NULL && m->instructions + (b->end - b->start) <= j->limit) {
+			m->instruction_counter = b->fn(m, j);
+			if (j->inval >= 0) {
+				invalidate(m, j, j->inval);
+				j->inval = -1;
+			}
+			continue;
+		}
+
+		// the reference engine sets the flags itself
+		materialize(m, j);
+
+		w = m->memory[pc];
+		op = RBML_OPCODE(w);
+		rbml_engine_table_step(m);
+		if ((op == OP_STO || op == OP_STOA || op == OP_STOJ || op == OP_CRDM || op == OP_FRDM) &&
+		    RBML_ARG3(w) < m->memory_size && j->covered[RBML_ARG3(w)])
+			invalidate(m, j, RBML_ARG3(w));
+	}
+
+	materialize(m, j);
+}
+
+#else
+
+/**
+ * Drop JIT compiled code and state
+ */
+void
+rbml_jit_free(struct rbml_machine *m)
+{
+}
+
+/**
+ * Run machine on the JIT engine (not supported on this host)
+ */
+void
+rbml_engine_jit(struct rbml_machine *m, uint64_t budget)
+{
+	rbml_engine_fast(m, budget);
+}
+
+#endif
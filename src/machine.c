@@ -0,0 +1,555 @@
+//Rumbaugh-Bricker Machine Language Emulator
+//copyright: 2015, Douglas Rumbaugh. All rights reserved.
+//
+//This is an emulator for a chipset capable of executing RBML.
+//It represents a machine with a word length of 32 bits, 16 registers
+//and an arbitrarily sized main memory. It takes advantage of C functions
+//to enable file, display, and arthimatic operations. In a true machine
+//this functionality would all be coded in RBML as subroutines.
+//
+//All machine state lives in struct rbml_machine, so the emulator can be
+//embedded and run any number of machines in one process.
+//
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "machine_impl.h"
+
+/**
+ * Round size up to whole pages
+ */
+static size_t
+round_pages(size_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	return (size + page - 1) & ~(page - 1);
+}
+
+/**
+ * Size of main memory mapping (memory and guard words)
+ */
+static size_t
+memory_bytes(size_t memory_size)
+{
+	return round_pages((memory_size + RBML_GUARD_WORDS) * sizeof(rbml_word));
+}
+
+/**
+ * Map zero pages for main memory (at addr, or anywhere if NULL)
+ *
+ * The pages are only reserved; each is committed when first touched.
+ */
+static void *
+map_zero(struct rbml_machine *m, void *addr, size_t size)
+{
+	void *p;
+
+	p = mmap(addr, size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | (addr != NULL ? MAP_FIXED : 0), -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+#ifdef MADV_HUGEPAGE
+	if (m->hugepages)
+		madvise(p, size, MADV_HUGEPAGE);
+#endif
+
+	return p;
+}
+
+/**
+ * Reserve zeroed array beside main memory
+ */
+void *
+rbml_reserve(size_t size)
+{
+	void *p;
+
+	p = mmap(NULL, round_pages(size), PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	return p != MAP_FAILED ? p : NULL;
+}
+
+/**
+ * Zero reserved array, giving its pages back
+ */
+void
+rbml_reserve_clear(void *p, size_t size)
+{
+	// private anonymous pages read back as zero once dropped
+	if (madvise(p, round_pages(size), MADV_DONTNEED) < 0)
+		memset(p, 0, size);
+}
+
+/**
+ * Release reserved array
+ */
+void
+rbml_release(void *p, size_t size)
+{
+	if (p != NULL)
+		munmap(p, round_pages(size));
+}
+
+/**
+ * Allocate machine
+ */
+struct rbml_machine *
+rbml_machine_alloc(size_t memory_size)
+{
+	struct rbml_machine *m;
+
+	if (posix_memalign((void **) &m, RBML_CACHE_LINE, sizeof(*m)) != 0)
+		return NULL;
+	memset(m, 0, sizeof(*m));
+
+	m->in = stdin;
+	m->out = stdout;
+
+	// initialize call stack
+	m->call_stack_size = RBML_DEFAULT_CALL_STACK_SIZE;
+	m->call_stack_limit = RBML_DEFAULT_CALL_STACK_LIMIT;
+	m->call_stack = calloc(m->call_stack_size, sizeof(*m->call_stack));
+
+	// initialize main memory
+	m->memory_size = memory_size;
+	// mapped, so a program image can be mapped over its low part
+	m->memory = map_zero(m, NULL, memory_bytes(memory_size));
+
+	if (m->call_stack == NULL || m->memory == NULL) {
+		rbml_machine_free(m);
+		return NULL;
+	}
+	m->memory[m->memory_size] = RBML_GUARD_WORD;
+
+	return m;
+}
+
+/**
+ * Drop console input fed by the host or read ahead from m->in
+ */
+static void
+drop_input(struct rbml_machine *m)
+{
+	rbml_input_free(m->input);
+	m->input = NULL;
+}
+
+/**
+ * Free machine
+ */
+void
+rbml_machine_free(struct rbml_machine *m)
+{
+	int i;
+
+	if (m == NULL)
+		return;
+
+	for (i = 0; i < countof(m->disk); i++)
+		rbml_disk_close(m, i);
+	rbml_machine_disk_thread(m, 0);
+	rbml_disk_ram_drop(m);
+	free(m->disk_dir);
+	free(m->disk_template);
+	rbml_machine_flush_decoded(m);
+	rbml_jit_free(m);
+	rbml_machine_trace(m, 0);
+	rbml_machine_profile(m, 0);
+	drop_input(m);
+	if (m->output != NULL) {
+		free(m->output->buf);
+		free(m->output);
+	}
+	if (m->memory != NULL)
+		munmap(m->memory, memory_bytes(m->memory_size));
+	free(m->call_stack);
+	free(m);
+}
+
+/**
+ * Open program image
+ */
+struct rbml_image *
+rbml_image_open(const char *program_file)
+{
+	struct rbml_image *image;
+	struct stat sb;
+	int fd;
+
+	if ((fd = open(program_file, O_RDONLY)) < 0) {
+		fprintf(stderr, "Failed to open program %s: %s\n", program_file, strerror(errno));
+		return NULL;
+	}
+	if (fstat(fd, &sb) < 0) {
+		fprintf(stderr, "Failed to stat program %s: %s\n", program_file, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	if ((sb.st_size % sizeof(rbml_word)) != 0) {
+		fprintf(stderr, "Corrupted program %s: Not multiple of RBML word (%d bytes)\n",
+		    program_file, (int) sizeof(rbml_word));
+		close(fd);
+		return NULL;
+	}
+
+	if ((image = calloc(1, sizeof(*image))) == NULL
+	    || (image->file = strdup(program_file)) == NULL) {
+		fprintf(stderr, "Failed to allocate program %s\n", program_file);
+		free(image);
+		close(fd);
+		return NULL;
+	}
+	image->fd = fd;
+	image->size = sb.st_size / sizeof(rbml_word);
+
+	return image;
+}
+
+/**
+ * Close program image
+ */
+void
+rbml_image_close(struct rbml_image *image)
+{
+	if (image == NULL)
+		return;
+
+	close(image->fd);
+	free(image->file);
+	free(image);
+}
+
+/**
+ * Map file contents into main memory
+ */
+int
+rbml_machine_map(struct rbml_machine *m, size_t memory_size, int fd, off_t offset, size_t size,
+    const char *file)
+{
+	rbml_word *memory;
+	size_t total, mapped = 0;
+
+	if (memory_size != m->memory_size) {
+		if ((memory = map_zero(m, NULL, memory_bytes(memory_size))) == NULL) {
+			fprintf(stderr, "Failed to allocate %zu words of memory\n", memory_size);
+			return -1;
+		}
+		munmap(m->memory, memory_bytes(m->memory_size));
+		m->memory = memory;
+		m->memory_size = memory_size;
+		if (m->profile != NULL && rbml_machine_profile(m, 1) < 0) {
+			fprintf(stderr, "Failed to allocate profile for %zu words of memory\n", memory_size);
+			return -1;
+		}
+	}
+	total = memory_bytes(m->memory_size);
+
+	// The file is mapped copy-on-write over the low part of main memory,
+	// in whole pages (the end of the last one reads as zeros), and fresh
+	// zero pages over the rest. Machines mapping the same file share its
+	// pages until they write to them.
+	if (size > 0) {
+		mapped = round_pages(size * sizeof(rbml_word));
+		if (mmap(m->memory, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+		    fd, offset) == MAP_FAILED) {
+			fprintf(stderr, "Failed to map %s: %s\n", file, strerror(errno));
+			return -1;
+		}
+	}
+	if (mapped < total) {
+		if (map_zero(m, (char *) m->memory + mapped, total - mapped) == NULL) {
+			fprintf(stderr, "Failed to map main memory: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+	m->memory[m->memory_size] = RBML_GUARD_WORD;
+
+	rbml_machine_flush_decoded(m);
+	rbml_jit_free(m);
+	m->verified = 0;
+
+	return 0;
+}
+
+/**
+ * Load program image into main memory
+ */
+int
+rbml_machine_load_image(struct rbml_machine *m, const struct rbml_image *image)
+{
+	if (image->size > m->memory_size) {
+		fprintf(stderr, "Program %s too large: %zu words, main memory is %zu words\n",
+		    image->file, image->size, m->memory_size);
+		return -1;
+	}
+
+	if (rbml_machine_map(m, m->memory_size, image->fd, 0, image->size, image->file) < 0)
+		return -1;
+	rbml_machine_verify(m, NULL);
+
+	return 0;
+}
+
+/**
+ * Load program into main memory
+ */
+int
+rbml_machine_load(struct rbml_machine *m, const char *program_file)
+{
+	struct rbml_image *image;
+	int rc;
+
+	if ((image = rbml_image_open(program_file)) == NULL)
+		return -1;
+	rc = rbml_machine_load_image(m, image);
+	rbml_image_close(image);
+
+	return rc;
+}
+
+/**
+ * Back main memory with transparent huge pages
+ */
+int
+rbml_machine_hugepages(struct rbml_machine *m, int enable)
+{
+#ifdef MADV_HUGEPAGE
+	if (madvise(m->memory, memory_bytes(m->memory_size), enable ? MADV_HUGEPAGE : MADV_NOHUGEPAGE) < 0)
+		return -1;
+	m->hugepages = enable;
+
+	return 0;
+#else
+	return enable ? -1 : 0;
+#endif
+}
+
+/**
+ * Get main memory resident
+ */
+size_t
+rbml_machine_memory_resident(const struct rbml_machine *m)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t size = memory_bytes(m->memory_size);
+	size_t i, resident = 0;
+	unsigned char *vec;
+
+	if ((vec = malloc(size / page)) == NULL)
+		return 0;
+	if (mincore(m->memory, size, vec) == 0) {
+		for (i = 0; i < size / page; i++)
+			resident += vec[i] & 1;
+	}
+	free(vec);
+
+	return resident * page;
+}
+
+/**
+ * Reset machine to run a program from the start
+ */
+void
+rbml_machine_reset(struct rbml_machine *m)
+{
+	int i;
+
+	for (i = 0; i < countof(m->disk); i++)
+		rbml_disk_close(m, i);
+	rbml_disk_ram_drop(m);
+	drop_input(m);
+
+	m->accumulator = 0;
+	m->jump = 0;
+	memset(m->reg, 0, sizeof(m->reg));
+	m->instruction_register = 0;
+	m->instruction_counter = 0;
+	m->less = m->equal = m->greater = 0;
+	m->overflow = m->ioerr = m->divzero = 0;
+
+	memset(m->call_stack, 0, m->call_stack_size * sizeof(*m->call_stack));
+	m->call_stack_counter = 0;
+	m->call_depth_max = 0;
+	memset(m->call_depth, 0, sizeof(m->call_depth));
+
+	m->halted = 0;
+	m->blocked = 0;
+	m->exit_status = 0;
+	m->instructions = 0;
+	memset(m->disk_stall, 0, sizeof(m->disk_stall));
+	memset(m->fused, 0, sizeof(m->fused));
+}
+
+/**
+ * Dump registers
+ */
+void
+rbml_machine_dump_registers(struct rbml_machine *m, FILE *fp)
+{
+	int i;
+
+	for (i = 0; i < countof(m->reg) / 2; i++) {
+		fprintf(fp, "r%d:\t0x%08x\tr%d:\t0x%08x\n",
+		    i, m->reg[i], i + (int) countof(m->reg) / 2, m->reg[i + countof(m->reg) / 2]);
+	}
+	fprintf(fp, "acc:\t0x%08x\tjump:\t0x%08x\n", m->accumulator, m->jump);
+}
+
+/**
+ * Grow call stack
+ */
+int
+rbml_call_stack_grow(struct rbml_machine *m)
+{
+	rbml_word *call_stack;
+	size_t size;
+
+	if ((size_t) m->call_stack_counter >= m->call_stack_limit) {
+		rbml_machine_error(m, "Call stack overflow: more than %zu nested calls",
+		    m->call_stack_limit + 1);
+		return -1;
+	}
+
+	size = m->call_stack_size * 2;
+	if (size > m->call_stack_limit)
+		size = m->call_stack_limit;
+	if ((call_stack = realloc(m->call_stack, size * sizeof(*call_stack))) == NULL) {
+		rbml_machine_error(m, "Failed to grow call stack to %zu words", size);
+		return -1;
+	}
+	m->call_stack = call_stack;
+	m->call_stack_size = size;
+
+	return 0;
+}
+
+/**
+ * Get predecoded instruction cache for engine
+ */
+struct rbml_insn *
+rbml_machine_decoded(struct rbml_machine *m, int engine)
+{
+	if (m->decoded != NULL && m->decoded_engine == engine)
+		return m->decoded;
+
+	rbml_machine_flush_decoded(m);
+	m->decoded_bytes = (m->memory_size + RBML_GUARD_WORDS) * sizeof(*m->decoded);
+	m->decoded = rbml_reserve(m->decoded_bytes);
+	m->decoded_engine = engine;
+
+	return m->decoded;
+}
+
+/**
+ * Drop predecoded instruction cache
+ */
+void
+rbml_machine_flush_decoded(struct rbml_machine *m)
+{
+	rbml_release(m->decoded, m->decoded_bytes);
+	m->decoded = NULL;
+}
+
+/**
+ * Stop machine on a machine error
+ */
+void
+rbml_machine_error(struct rbml_machine *m, const char *format, ...)
+{
+	va_list ap;
+
+	// program output first, in case both go to the same terminal
+	rbml_machine_flush(m);
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	fputc('\n', stderr);
+	va_end(ap);
+
+	m->halted = 1;
+	m->exit_status = RBML_EXIT_ERROR;
+}
+
+/**
+ * Run loaded program for at most budget instructions
+ */
+int
+rbml_machine_run_budget(struct rbml_machine *m, uint64_t budget)
+{
+	if (!m->halted) {
+		m->blocked = 0;
+
+		// engines only keep their own caches up to date
+		if (m->trace != NULL) {
+			rbml_jit_free(m);
+			rbml_engine_traced(m, budget);
+		} else if (m->profile != NULL) {
+			rbml_jit_free(m);
+			rbml_engine_profiled(m, budget);
+		} else if (m->engine == RBML_ENGINE_TABLE) {
+			rbml_machine_flush_decoded(m);
+			rbml_jit_free(m);
+			rbml_engine_table(m, budget);
+		} else if (m->engine == RBML_ENGINE_JIT) {
+			rbml_machine_flush_decoded(m);
+			rbml_engine_jit(m, budget);
+		} else {
+			rbml_jit_free(m);
+			rbml_engine_fast(m, budget);
+		}
+
+		rbml_machine_flush(m);
+		if (m->halted)
+			rbml_disk_barrier_all(m);
+	}
+
+	if (m->halted)
+		return m->exit_status == RBML_EXIT_ERROR ? RBML_RUN_ERROR : RBML_RUN_HALTED;
+
+	return m->blocked ? RBML_RUN_BLOCKED : RBML_RUN_BUDGET;
+}
+
+/**
+ * Run loaded program until it is about to execute the instruction at addr
+ */
+int
+rbml_machine_run_until(struct rbml_machine *m, int addr)
+{
+	if (!m->halted) {
+		m->blocked = 0;
+
+		rbml_machine_flush_decoded(m);
+		rbml_jit_free(m);
+		while (!m->halted && !m->blocked && m->instruction_counter != addr)
+			rbml_engine_table_step(m);
+
+		rbml_machine_flush(m);
+		if (m->halted)
+			rbml_disk_barrier_all(m);
+	}
+
+	if (m->halted)
+		return m->exit_status == RBML_EXIT_ERROR ? RBML_RUN_ERROR : RBML_RUN_HALTED;
+
+	return m->blocked ? RBML_RUN_BLOCKED : RBML_RUN_STOPPED;
+}
+
+/**
+ * Run loaded program until it halts
+ */
+int
+rbml_machine_run(struct rbml_machine *m)
+{
+	rbml_machine_run_budget(m, RBML_BUDGET_UNLIMITED);
+
+	return m->exit_status;
+}
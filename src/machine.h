@@ -0,0 +1,568 @@
+/**
+ * RBML machine: embeddable emulator library (librbml)
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#ifndef _MACHINE_H_
+#define _MACHINE_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "rbml.h"
+
+struct rbml_insn;
+struct rbml_jit;
+struct rbml_trace;
+struct rbml_input;
+struct rbml_output;
+struct rbml_disk;
+struct rbml_io;
+
+/**
+ * Cache line size the machine state is aligned to
+ */
+#define RBML_CACHE_LINE		64
+
+/**
+ * Default main memory size (number of words)
+ */
+#define RBML_DEFAULT_MEMORY_SIZE	1024
+
+/**
+ * Initial call stack size (number of words)
+ */
+#define RBML_DEFAULT_CALL_STACK_SIZE	100
+
+/**
+ * Default call stack size limit (number of words)
+ */
+#define RBML_DEFAULT_CALL_STACK_LIMIT	(1 << 20)
+
+/**
+ * Number of call depth histogram buckets: bucket i counts calls reaching
+ * a depth of 2^i to 2^(i+1) - 1, the last one also those reaching deeper
+ */
+#define RBML_CALL_DEPTH_BUCKETS	32
+
+/**
+ * Number of sequential access disks
+ */
+#define RBML_NUM_DISKS		16
+
+/**
+ * Execution engines
+ */
+#define RBML_ENGINE_FAST	0	/**< inlined handlers, threaded dispatch */
+#define RBML_ENGINE_TABLE	1	/**< reference opcode table engine */
+#define RBML_ENGINE_JIT		2	/**< x86-64 JIT, reference engine fallback */
+#define RBML_ENGINE_TRACED	3	/**< fast engine recording every instruction
+					     (selected by rbml_machine_trace()) */
+#define RBML_ENGINE_PROFILED	4	/**< fast engine counting every instruction
+					     (selected by rbml_machine_profile()) */
+
+/**
+ * Superinstruction families fused by the fast engine
+ */
+#define RBML_FUSE_CMP_BR	0	/**< compare + conditional branch */
+#define RBML_FUSE_LOD_OP_STO	1	/**< load + load + operate + store */
+#define RBML_FUSE_OP_MOVA	2	/**< operate + move accumulator */
+#define RBML_FUSE_MOVA_MOVA	3	/**< move accumulator + move accumulator */
+#define RBML_NUM_FUSE		4
+
+/**
+ * Default trace ring buffer size (number of records)
+ */
+#define RBML_DEFAULT_TRACE_SIZE	65536
+
+/**
+ * Registers named by trace records besides r0-r15
+ */
+#define RBML_TRACE_ACC		16	/**< accumulator */
+#define RBML_TRACE_JUMP		17	/**< jump register */
+#define RBML_TRACE_NONE		0xff	/**< no register written */
+
+/**
+ * Trace record: one executed instruction
+ */
+struct rbml_trace_record {
+	uint32_t pc;		/**< instruction address */
+	rbml_word word;		/**< instruction word */
+	rbml_word value;	/**< value written to register */
+	uint8_t reg;		/**< register written (0-15, RBML_TRACE_*) */
+	uint8_t pad[3];
+};
+
+/**
+ * Trace file header, followed by the records oldest first
+ */
+#define RBML_TRACE_MAGIC	"RBMLTRC1"
+struct rbml_trace_header {
+	char magic[8];		/**< RBML_TRACE_MAGIC */
+	uint32_t record_size;	/**< sizeof(struct rbml_trace_record) */
+	uint32_t records;	/**< number of records in the file */
+	uint64_t total;		/**< number of instructions traced, including
+				     those dropped from the ring buffer */
+};
+
+/**
+ * Alignment of main memory in a checkpoint file (bytes), a multiple of
+ * the page size so that it can be mapped
+ */
+#define RBML_CHECKPOINT_ALIGN	65536
+
+/**
+ * Checkpoint file header
+ *
+ * A checkpoint file holds the whole state of a machine, in host byte
+ * order: this header, the call stack (call_stack_words words), then main
+ * memory (memory_size words) at memory_offset.
+ */
+#define RBML_CHECKPOINT_MAGIC	"RBMLCKP1"
+struct rbml_checkpoint_header {
+	char magic[8];		/**< RBML_CHECKPOINT_MAGIC */
+	uint32_t header_size;	/**< sizeof(struct rbml_checkpoint_header) */
+	uint32_t pad;
+	uint64_t memory_size;	/**< main memory size (number of words) */
+	uint64_t memory_offset;	/**< file offset of main memory (multiple of
+				     RBML_CHECKPOINT_ALIGN) */
+	uint64_t call_stack_words;
+				/**< call stack words saved */
+	uint64_t instructions;	/**< number of instructions executed */
+	int64_t disk[RBML_NUM_DISKS];
+				/**< disk position (bytes, -1: disk not
+				     open) */
+
+	rbml_word reg[16];
+	rbml_word accumulator;
+	rbml_word jump;
+	rbml_word less;
+	rbml_word equal;
+	rbml_word greater;
+	rbml_word overflow;
+	rbml_word ioerr;
+	rbml_word divzero;
+	int32_t instruction_counter;
+	int32_t call_stack_counter;
+	int32_t halted;
+	int32_t exit_status;
+};
+
+/**
+ * Execution profile
+ *
+ * Per address counts have one entry per word of main memory.
+ */
+struct rbml_profile {
+	uint64_t opcode[256];	/**< instructions retired per opcode */
+	uint64_t *count;	/**< instructions retired per address */
+	uint64_t *taken;	/**< BR* and CA* taken per address */
+	uint64_t *not_taken;	/**< BR* and CA* not taken per address */
+};
+
+/**
+ * Machine exit status
+ */
+#define RBML_EXIT_HALT		0	/**< program executed HALT */
+#define RBML_EXIT_ERROR		1	/**< machine error (bad program, etc.) */
+#define RBML_EXIT_HERR		2	/**< program executed HERR */
+
+/**
+ * Run status (rbml_machine_run_budget())
+ */
+#define RBML_RUN_HALTED		0	/**< program executed HALT or HERR */
+#define RBML_RUN_BUDGET		1	/**< instruction budget used up */
+#define RBML_RUN_BLOCKED	2	/**< waiting for console input */
+#define RBML_RUN_ERROR		3	/**< machine error */
+#define RBML_RUN_STOPPED	4	/**< stopped at the address given to
+					     rbml_machine_run_until() */
+
+/**
+ * Console output buffering (struct rbml_machine output_buffering)
+ */
+#define RBML_OUTPUT_AUTO	0	/**< line buffered on a terminal, fully
+					     buffered otherwise */
+#define RBML_OUTPUT_LINE	1	/**< written at every newline */
+#define RBML_OUTPUT_FULL	2	/**< written when the buffer fills up */
+
+/**
+ * Unlimited instruction budget
+ */
+#define RBML_BUDGET_UNLIMITED	UINT64_MAX
+
+/**
+ * RBML machine
+ *
+ * All the state of one machine instance lives here, so any number of
+ * machines can run in one process (one machine per thread at a time).
+ * The registers and flags touched by every instruction are kept together
+ * at the start of the structure.
+ */
+struct rbml_machine {
+	/* machine registers */
+	rbml_word accumulator;	/**< accumulator */
+	rbml_word jump;		/**< jump register */
+	rbml_word reg[16];	/**< general purpose registers */
+
+	rbml_word instruction_register;
+				/**< current instruction */
+	int instruction_counter;
+				/**< address of current instruction */
+
+	/* comparison flags */
+	rbml_word less;
+	rbml_word equal;
+	rbml_word greater;
+
+	/* error flags */
+	rbml_word overflow;
+	rbml_word ioerr;
+	rbml_word divzero;
+
+	/* main memory */
+	rbml_word *memory;	/**< main memory (call
+				     rbml_machine_load() after changing it
+				     outside of the machine) */
+	size_t memory_size;	/**< main memory size (number of words) */
+	int hugepages;		/**< main memory is backed by huge pages */
+	int verified;		/**< loaded program is verified (see
+				     rbml_machine_verify()) */
+
+	struct rbml_insn *decoded;
+				/**< predecoded instruction cache */
+	size_t decoded_bytes;	/**< size of its mapping */
+	int decoded_engine;	/**< engine the cache was built by */
+	struct rbml_jit *jit;	/**< JIT compiled code */
+
+	/* call stack */
+	rbml_word *call_stack;	/**< call stack (grown as needed) */
+	int call_stack_counter;	/**< call stack depth */
+	size_t call_stack_size;	/**< call stack size (number of words) */
+	size_t call_stack_limit;
+				/**< call stack size limit (number of
+				     words): a call past it is a machine
+				     error */
+	size_t call_depth_max;	/**< deepest call nesting reached */
+	uint64_t call_depth[RBML_CALL_DEPTH_BUCKETS];
+				/**< call depth histogram: calls made per
+				     depth reached (RBML_CALL_DEPTH_BUCKETS) */
+
+	int halted;		/**< machine is halted */
+	int blocked;		/**< machine is waiting for console input */
+	int exit_status;	/**< exit status once halted */
+	uint64_t instructions;	/**< number of instructions executed */
+	uint64_t fused[RBML_NUM_FUSE];
+				/**< number of superinstructions executed */
+
+	int engine;		/**< execution engine (RBML_ENGINE_*) */
+	struct rbml_trace *trace;
+				/**< instruction trace (runs the traced
+				     engine, see rbml_machine_trace()) */
+	struct rbml_profile *profile;
+				/**< execution profile (runs the profiled
+				     engine, see rbml_machine_profile()) */
+
+	FILE *in;		/**< console input (NULL: fed by the host,
+				     see rbml_machine_feed()); read ahead
+				     in blocks, so the host must not read
+				     from it itself */
+	struct rbml_input *input;
+				/**< console input fed by the host or
+				     read ahead from in */
+	FILE *out;		/**< console output (call
+				     rbml_machine_flush() before changing
+				     it while a program runs) */
+	struct rbml_output *output;
+				/**< console output buffer */
+	int output_buffering;	/**< console output buffering
+				     (RBML_OUTPUT_*) */
+
+	/* sequential access disks (disk<n>.rbdi, mapped) */
+	struct rbml_disk *disk[RBML_NUM_DISKS];
+	char *disk_dir;		/**< directory of the disk files (NULL:
+				     current directory) */
+	char *disk_template;	/**< RAM disks: directory of the images
+				     (NULL: disks are the files) */
+	struct rbml_disk *ram_disk[RBML_NUM_DISKS];
+				/**< RAM disks loaded, open or not */
+	struct rbml_io *io;	/**< disk I/O thread (see
+				     rbml_machine_disk_thread()) */
+	uint64_t disk_stall[RBML_NUM_DISKS];
+				/**< time spent waiting for disk I/O per
+				     disk (ns) */
+} __attribute__((aligned(RBML_CACHE_LINE)));
+
+/**
+ * Program image
+ */
+struct rbml_image {
+	char *file;		/**< program file */
+	int fd;			/**< program file, mapped by machines loading it */
+	size_t size;		/**< image size (number of words) */
+};
+
+/**
+ * Allocate machine
+ *
+ * @param memory_size main memory size (number of words)
+ * @return machine or NULL on allocation failure
+ */
+struct rbml_machine *rbml_machine_alloc(size_t memory_size);
+
+/**
+ * Free machine
+ */
+void rbml_machine_free(struct rbml_machine *m);
+
+/**
+ * Open program image, to be loaded into any number of machines
+ *
+ * @return image or NULL on failure (reported on stderr)
+ */
+struct rbml_image *rbml_image_open(const char *program_file);
+
+/**
+ * Close program image (machines it is loaded into keep their copy)
+ */
+void rbml_image_close(struct rbml_image *image);
+
+/**
+ * Load program image into main memory (the rest of memory is cleared)
+ *
+ * The image is mapped copy-on-write, so machines loading the same image
+ * share its pages until they write to them. The program file must not
+ * be changed or truncated while it is loaded.
+ *
+ * @return 0 on success, -1 if the image does not fit in main memory or
+ * on failure (reported on stderr)
+ */
+int rbml_machine_load_image(struct rbml_machine *m, const struct rbml_image *image);
+
+/**
+ * Load program into main memory (see rbml_machine_load_image())
+ *
+ * @return 0 on success, -1 if the program does not fit in main memory or
+ * on failure (reported on stderr)
+ */
+int rbml_machine_load(struct rbml_machine *m, const char *program_file);
+
+/**
+ * Back main memory with transparent huge pages (for programs that use
+ * most of a large memory; the program image itself is not)
+ *
+ * @return 0 on success, -1 if huge pages are not supported
+ */
+int rbml_machine_hugepages(struct rbml_machine *m, int enable);
+
+/**
+ * Read disks ahead and write them behind on an I/O thread
+ *
+ * Sequential disk reads and writes then only wait when the program gets
+ * ahead of the thread, and CLOS and halting wait for the disks written
+ * to reach stable storage. Meant for disks too large to stay resident.
+ *
+ * @return 0 on success, -1 if the thread cannot be started
+ */
+int rbml_machine_disk_thread(struct rbml_machine *m, int enable);
+
+/**
+ * Set directory of the disk files (NULL: the current directory), so
+ * machines running side by side each get their own disks
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int rbml_machine_disk_dir(struct rbml_machine *m, const char *dir);
+
+/**
+ * Keep disks in memory (NULL: back them with the disk files again)
+ *
+ * A RAM disk is loaded from disk<n>.rbdi in template_dir the first time
+ * the program opens it, and stays in memory when it is closed. RAM disks
+ * start over from the template when the machine is reset, and are only
+ * written out by rbml_machine_save_disks(). Open disks are closed.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int rbml_machine_ram_disks(struct rbml_machine *m, const char *template_dir);
+
+/**
+ * Write RAM disks loaded since the reset to the disk directory
+ *
+ * @return 0 on success, -1 on failure (reported on stderr)
+ */
+int rbml_machine_save_disks(struct rbml_machine *m);
+
+/**
+ * Get main memory resident (bytes)
+ *
+ * The pages of main memory in RAM, as mincore() reports them: those the
+ * program touched, and also those of a mapped program image or checkpoint
+ * that are in the page cache, read or not. Clean file pages are shared
+ * and can be dropped, so this is not the memory the machine committed.
+ */
+size_t rbml_machine_memory_resident(const struct rbml_machine *m);
+
+/**
+ * Write checkpoint file: registers, flags, call stack, main memory and
+ * disk positions (disks are flushed first)
+ *
+ * Pages of main memory that are all zero are left as holes in the file.
+ *
+ * @return 0 on success, -1 on failure (reported on stderr)
+ */
+int rbml_machine_checkpoint(struct rbml_machine *m, const char *checkpoint_file);
+
+/**
+ * Restore machine from checkpoint file, to resume where it was written
+ *
+ * Main memory is resized to that of the checkpoint, and mapped from the
+ * file copy-on-write like a program image (see rbml_machine_load_image()).
+ * Disks open at the checkpoint are opened again at the same positions
+ * (RAM disks cannot be checkpointed). Engine, call stack limit and console streams are kept.
+ *
+ * @return 0 on success, -1 on failure (reported on stderr)
+ */
+int rbml_machine_restore(struct rbml_machine *m, const char *checkpoint_file);
+
+/**
+ * Verify loaded program: prove that no word it can execute from its start
+ * or from where the machine is takes it out of main memory
+ *
+ * Every reachable word is checked for memory operands and branch targets
+ * out of memory, falling through the last word, stores into code and
+ * writes to the jump register. The reference engine skips its per step
+ * checks on a verified program. Programs are verified when loaded and
+ * restored, so this only needs calling for the report.
+ *
+ * @return 1 if verified, 0 if not (problems printed to report, unless it
+ * is NULL), -1 on allocation failure
+ */
+int rbml_machine_verify(struct rbml_machine *m, FILE *report);
+
+/**
+ * Reset machine to run a program from the start
+ *
+ * Clears registers, flags, call stack and counters, closes disks, drops
+ * RAM disks and console input fed or read ahead. Main memory, engine and console
+ * streams are kept.
+ */
+void rbml_machine_reset(struct rbml_machine *m);
+
+/**
+ * Run loaded program until it halts
+ *
+ * @return machine exit status (RBML_EXIT_*)
+ */
+int rbml_machine_run(struct rbml_machine *m);
+
+/**
+ * Run loaded program for at most budget instructions
+ *
+ * The machine stops with all its state saved when the program halts,
+ * when budget instructions have been executed, or when a console input
+ * instruction finds no input fed by the host yet (the instruction is not
+ * executed). Calling it again resumes where the machine stopped, so one
+ * thread can time-slice any number of machines.
+ *
+ * @return run status (RBML_RUN_*)
+ */
+int rbml_machine_run_budget(struct rbml_machine *m, uint64_t budget);
+
+/**
+ * Run loaded program until it is about to execute the instruction at
+ * addr (at once if it is there already)
+ *
+ * The machine runs on the reference engine, one instruction at a time,
+ * and is neither traced nor profiled.
+ *
+ * @return run status (RBML_RUN_*, RBML_RUN_STOPPED when it got to addr)
+ */
+int rbml_machine_run_until(struct rbml_machine *m, int addr);
+
+/**
+ * Feed console input
+ *
+ * Used with m->in set to NULL: console input instructions read the bytes
+ * fed here, and block the machine until enough input has been fed to
+ * complete them. data = NULL (len = 0) marks the end of the input.
+ *
+ * @return 0 on success, -1 on allocation failure
+ */
+int rbml_machine_feed(struct rbml_machine *m, const void *data, size_t len);
+
+/**
+ * Write console output buffered so far to m->out
+ *
+ * Console output is buffered by the machine, and written when the buffer
+ * fills up, before console input is read, when a run returns, and at
+ * every newline if line buffered (see output_buffering).
+ */
+void rbml_machine_flush(struct rbml_machine *m);
+
+/**
+ * Trace every instruction executed into a ring buffer
+ *
+ * While tracing, the machine runs on the traced engine whatever engine is
+ * selected. The buffer keeps the last records executed (rounded up to a
+ * power of two); records = 0 stops tracing and drops the buffer.
+ *
+ * @return 0 on success, -1 on allocation failure
+ */
+int rbml_machine_trace(struct rbml_machine *m, size_t records);
+
+/**
+ * Write trace file (header and records) to fd
+ *
+ * Only calls write(), so it can be called from a signal handler to save
+ * the trace of a crashed run.
+ *
+ * @return 0 on success, -1 on write error (errno set)
+ */
+int rbml_machine_trace_dump(const struct rbml_machine *m, int fd);
+
+/**
+ * Count instructions executed per opcode and address, and branches taken
+ *
+ * While profiling, the machine runs on the profiled engine whatever engine
+ * is selected (tracing takes precedence). Counts add up over runs until
+ * profiling is stopped (enable = 0), which drops the profile.
+ *
+ * @return 0 on success, -1 on allocation failure
+ */
+int rbml_machine_profile(struct rbml_machine *m, int enable);
+
+/**
+ * Print profile report: hottest addresses and opcode histogram
+ *
+ * @param top number of addresses listed
+ */
+void rbml_machine_profile_report(const struct rbml_machine *m, FILE *fp, int top);
+
+/**
+ * Write profile as JSON
+ *
+ * @return 0 on success, -1 on write error
+ */
+int rbml_machine_profile_json(const struct rbml_machine *m, FILE *fp);
+
+/**
+ * Dump registers
+ */
+void rbml_machine_dump_registers(struct rbml_machine *m, FILE *fp);
+
+/**
+ * Get instruction mnemonic
+ *
+ * @return mnemonic or NULL if the opcode is not assigned
+ */
+const char *rbml_opcode_name(int opcode);
+
+/**
+ * Disassemble instruction word ("MNEMONIC arg1 arg2 arg3")
+ *
+ * @return length of the disassembly (as snprintf())
+ */
+int rbml_disasm(rbml_word w, char *buf, size_t size);
+
+#endif /* _MACHINE_H_ */
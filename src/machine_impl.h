@@ -0,0 +1,530 @@
+/**
+ * RBML machine: implementation shared by the execution engines
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#ifndef _MACHINE_IMPL_H_
+#define _MACHINE_IMPL_H_
+
+#include <sys/types.h>
+
+#include "machine.h"
+
+#define countof(a)	(sizeof(a) / sizeof((a)[0]))
+
+/**
+ * Words allocated past the end of main memory. The guard word holds an
+ * unassigned opcode, so an engine falling through the last word of memory
+ * lands on it instead of checking the instruction counter every step.
+ */
+#define RBML_GUARD_WORDS	1
+#define RBML_GUARD_WORD		RBML_INST(0x7f, 0, 0, 0)
+
+/**
+ * Predecoded instruction
+ */
+struct rbml_insn {
+	int32_t handler;	/**< engine handler (0: not decoded yet) */
+	uint16_t arg3;		/**< ARG3 */
+	uint8_t arg1;		/**< ARG1 */
+	uint8_t arg2;		/**< ARG2 */
+	uint8_t span;		/**< number of words executed by handler
+				     (> 1 for superinstructions) */
+};
+
+/**
+ * Console input: fed by the host, or read from m->in in blocks
+ */
+struct rbml_input {
+	char *buf;		/**< input */
+	size_t pos;		/**< bytes read */
+	size_t len;		/**< bytes fed */
+	size_t size;		/**< buffer size */
+	int eof;		/**< end of input has been fed */
+	FILE *fp;		/**< stream read from (NULL: fed by the
+				     host) */
+	int mapped;		/**< buf is the stream file mapped */
+};
+
+/**
+ * Console input block size (bytes)
+ */
+#define RBML_INPUT_SIZE		65536
+
+/**
+ * Sequential access disk: disk<n>.rbdi mapped shared, so reads and
+ * writes are word copies
+ *
+ * The file is grown ahead of the writes in extents and mapped whole; it
+ * is cut back to the bytes written when the disk is closed (or synced).
+ * A RAM disk has no file (fd -1) and anonymous memory for its mapping.
+ * Reads and writes below limit take the inline path; with the I/O thread
+ * on (see diskio.c), limit is the end of the current window.
+ */
+struct rbml_disk {
+	int fd;
+	rbml_word *map;		/**< file mapping */
+	size_t pos;		/**< read/write position (words) */
+	size_t limit;		/**< inline reads and writes end (words) */
+	size_t words;		/**< whole words in the file */
+	off_t bytes;		/**< file size */
+	off_t allocated;	/**< file size including the extent
+				     not written yet */
+	size_t mapped;		/**< size of the mapping (bytes) */
+	size_t window;		/**< current window (SIZE_MAX: none) */
+	int pending;		/**< I/O requests queued (under the I/O
+				     thread lock) */
+};
+
+/**
+ * Disk window read ahead and written behind by the I/O thread (words)
+ */
+#define RBML_DISK_WINDOW	65536
+
+/**
+ * I/O thread requests
+ */
+#define RBML_IO_PREFETCH	0	/**< read pages in */
+#define RBML_IO_WRITEBACK	1	/**< start writing pages back */
+
+/**
+ * Disk extent: the least a disk file is grown by (bytes)
+ */
+#define RBML_DISK_EXTENT	(1 << 20)
+
+/**
+ * Console output buffer size (bytes)
+ */
+#define RBML_OUTPUT_SIZE	65536
+
+/**
+ * Console output buffer
+ */
+struct rbml_output {
+	char *buf;		/**< output not written yet */
+	size_t len;		/**< bytes in buffer */
+	FILE *fp;		/**< stream line was decided for */
+	int line;		/**< line buffered */
+};
+
+/**
+ * Instruction trace ring buffer
+ *
+ * The record at head is filled in when the instruction is fetched and
+ * completed (register written, head advanced) when the next one is. The
+ * fields are volatile so a signal handler sees every record stored so far.
+ */
+struct rbml_trace {
+	volatile struct rbml_trace_record *records;
+	size_t mask;		/**< ring buffer size - 1 */
+	volatile uint64_t head;	/**< number of completed records */
+	volatile int pending;	/**< record at head is being executed */
+};
+
+/**
+ * Get register written by instruction (RBML_TRACE_*)
+ */
+static inline int
+rbml_trace_reg(rbml_word w)
+{
+	switch (RBML_OPCODE(w)) {
+	case OP_LOD:
+		return RBML_ARG1(w);
+	case OP_MOV:
+	case OP_CRDR:
+	case OP_FRDR:
+		return RBML_ARG2(w);
+	case OP_MOVA:
+		return RBML_ARG1(w) ? RBML_ARG2(w) : RBML_TRACE_ACC;
+	case OP_MOVJ:
+		return RBML_ARG1(w) ? RBML_ARG2(w) : RBML_TRACE_JUMP;
+
+	case OP_LODA:	case OP_CRDA:	case OP_FRDA:
+	case OP_ADD:	case OP_ADDA:	case OP_ADDJ:
+	case OP_SUB:	case OP_SUBA:	case OP_SUBJ:
+	case OP_DIV:	case OP_DIVA:	case OP_DIVJ:
+	case OP_MULT:	case OP_MLTA:	case OP_MLTJ:
+	case OP_MOD:	case OP_MODA:	case OP_MODJ:
+	case OP_CJNT:	case OP_CJNA:	case OP_CJNJ:
+	case OP_DJNT:	case OP_DJNA:	case OP_DJNJ:
+	case OP_COMP:	case OP_COMPA:	case OP_COMPJ:
+	case OP_LSFT:	case OP_LSFA:	case OP_LSFJ:
+	case OP_RSFT:	case OP_RSFA:	case OP_RSFJ:
+		return RBML_TRACE_ACC;
+
+	case OP_LODJ:	case OP_CRDJ:	case OP_FRDJ:
+	case OP_CALL:	case OP_CAGT:	case OP_CALT:
+	case OP_CAEQ:	case OP_CAGE:	case OP_CALE:
+	case OP_END:
+		return RBML_TRACE_JUMP;
+	}
+
+	return RBML_TRACE_NONE;
+}
+
+/*
+ * ALU. Every engine goes through these so they agree bit for bit.
+ */
+
+static inline rbml_word
+rbml_add(rbml_word a, rbml_word b, rbml_word *overflow)
+{
+	*overflow = 0;
+	if ((a > 0 && b > RBML_WORD_MAX - a) || (a < 0 && b < RBML_WORD_MIN - a))
+		*overflow = 1;
+
+	return a + b;
+}
+
+// Generic subtraction method, with overflow capture.
+static inline rbml_word
+rbml_sub(rbml_word a, rbml_word b, rbml_word *overflow)
+{
+	*overflow = 0;
+	if ((a > 0 && b > RBML_WORD_MAX - a) || (a < 0 && b < RBML_WORD_MIN - a))
+		*overflow = 1;
+
+	return a - b;
+}
+
+static inline rbml_word
+rbml_mult(rbml_word a, rbml_word b, rbml_word *overflow)
+{
+	*overflow = 0;
+	if (a == 0 || b == 0)
+		return 0;
+	if ((a > 0 && b > RBML_WORD_MAX / a) || (a < 0 && b < RBML_WORD_MIN / a))
+		*overflow = 1;
+
+	return a * b;
+}
+
+static inline rbml_word
+rbml_div(rbml_word a, rbml_word b, rbml_word *divzero)
+{
+	if (b == 0) {
+		*divzero = 1;
+		return 0;
+	}
+
+	*divzero = 0;
+	return a / b;
+}
+
+static inline rbml_word
+rbml_mod(rbml_word a, rbml_word b, rbml_word *divzero)
+{
+	if (b == 0) {
+		*divzero = 1;
+		return 0;
+	}
+
+	*divzero = 0;
+	return a % b;
+}
+
+/**
+ * Does instruction word take a memory address in ARG3 (LOD*, STO*, CRDM,
+ * CMPM, FRDM)
+ */
+static inline int
+rbml_is_memory_operand(rbml_word w)
+{
+	switch (RBML_OPCODE(w)) {
+	case OP_STO:	case OP_STOA:	case OP_STOJ:
+	case OP_LOD:	case OP_LODA:	case OP_LODJ:
+	case OP_CRDM:	case OP_CMPM:	case OP_FRDM:
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Does instruction word take a branch target in ARG3 (BR*, CA*)
+ */
+static inline int
+rbml_is_branch(rbml_word w)
+{
+	int op = RBML_OPCODE(w);
+
+	return (op >= OP_BRAN && op <= OP_BRLE) || (op >= OP_CALL && op <= OP_CALE);
+}
+
+/**
+ * Is ARG3 in range: memory operands and branch targets must be addresses
+ * in main memory (ARG3 is 16 bits, so they always are with 64K words)
+ */
+static inline int
+rbml_arg3_valid(rbml_word w, size_t memory_size)
+{
+	if (RBML_ARG3(w) < memory_size)
+		return 1;
+
+	return !rbml_is_memory_operand(w) && !rbml_is_branch(w);
+}
+
+/*
+ * Console and disk I/O (io.c)
+ */
+
+/**
+ * Write word to console
+ */
+void rbml_cwrite(struct rbml_machine *m, int fcontrol, rbml_word w);
+
+/**
+ * Read word from console
+ */
+rbml_word rbml_cread(struct rbml_machine *m, int fcontrol);
+
+/**
+ * Check that a console read can complete without waiting for input
+ * (always true unless the host feeds the input)
+ */
+int rbml_cread_ready(struct rbml_machine *m, int fcontrol);
+
+/**
+ * Free console input
+ */
+void rbml_input_free(struct rbml_input *in);
+
+/**
+ * Is opcode a console read (CRD*)
+ */
+#define RBML_IS_CREAD(op)	((op) >= OP_CRDM && (op) <= OP_CRDJ)
+
+/**
+ * Open disk
+ */
+void rbml_disk_open(struct rbml_machine *m, int n);
+
+/**
+ * Close disk
+ */
+void rbml_disk_close(struct rbml_machine *m, int n);
+
+/**
+ * Cut disk file back to the bytes written, as when it is closed
+ *
+ * @return 0 on success, -1 on failure
+ */
+int rbml_disk_sync(struct rbml_machine *m, int n);
+
+/**
+ * Read or write word at the end of the disk, or with the disk closed
+ */
+rbml_word rbml_disk_read_slow(struct rbml_machine *m, int n);
+void rbml_disk_write_slow(struct rbml_machine *m, int n, rbml_word w);
+
+/**
+ * Read word from disk (FRD*) and advance the position
+ */
+static inline rbml_word
+rbml_disk_read(struct rbml_machine *m, int n)
+{
+	struct rbml_disk *d = m->disk[n];
+
+	if (d != NULL && d->pos < d->limit)
+		return d->map[d->pos++];
+	return rbml_disk_read_slow(m, n);
+}
+
+/**
+ * Write word to disk (FWRT, FWTA, FWTJ) and advance the position
+ */
+static inline void
+rbml_disk_write(struct rbml_machine *m, int n, rbml_word w)
+{
+	struct rbml_disk *d = m->disk[n];
+
+	if (d != NULL && d->pos < d->limit)
+		d->map[d->pos++] = w;
+	else
+		rbml_disk_write_slow(m, n, w);
+}
+
+/**
+ * Make the next disk access check its window (I/O thread switched on or
+ * off, or position moved)
+ */
+void rbml_disk_window_reset(struct rbml_machine *m, struct rbml_disk *d);
+
+/**
+ * Wait for I/O on all open disks to reach stable storage (HALT)
+ */
+void rbml_disk_barrier_all(struct rbml_machine *m);
+
+/**
+ * Drop RAM disks (reset)
+ */
+void rbml_disk_ram_drop(struct rbml_machine *m);
+
+/**
+ * Move disk position steps words forward, or backward, stopping at the
+ * start and end of the disk (REPO)
+ */
+void rbml_disk_move(struct rbml_machine *m, int n, int backward, int steps);
+
+/**
+ * Move disk position to the start, or the end, of the disk (PRES)
+ */
+void rbml_disk_reset(struct rbml_machine *m, int n, int end);
+
+/*
+ * Disk I/O thread (diskio.c)
+ */
+
+/**
+ * Queue I/O request (RBML_IO_*) for a byte range of disk
+ */
+void rbml_io_submit(struct rbml_machine *m, struct rbml_disk *d, int op, off_t start, off_t end);
+
+/**
+ * Wait for the I/O queued for disk (returns at once without I/O thread)
+ */
+void rbml_io_wait(struct rbml_machine *m, struct rbml_disk *d);
+
+/*
+ * Call stack (machine.c)
+ */
+
+/**
+ * Grow call stack (up to its limit)
+ *
+ * @return 0 on success, -1 on call stack overflow (machine error)
+ */
+int rbml_call_stack_grow(struct rbml_machine *m);
+
+/**
+ * Save return address on call, pushing the one in the jump register (if
+ * any) on the call stack, and count the call depth reached
+ *
+ * @return 0 on success, -1 on call stack overflow (machine error)
+ */
+static inline int
+rbml_call(struct rbml_machine *m, rbml_word jump)
+{
+	size_t depth;
+	int bucket;
+
+	if (jump != 0) {
+		// the stack may be allocated past a limit set after it
+		if (((size_t) m->call_stack_counter == m->call_stack_size
+		    || (size_t) m->call_stack_counter == m->call_stack_limit) && rbml_call_stack_grow(m) < 0)
+			return -1;
+		m->call_stack[m->call_stack_counter++] = jump;
+	}
+
+	// the jump register holds the innermost return address
+	depth = m->call_stack_counter + 1;
+	if (depth > m->call_depth_max)
+		m->call_depth_max = depth;
+	bucket = 63 - __builtin_clzll(depth);
+	m->call_depth[bucket < RBML_CALL_DEPTH_BUCKETS ? bucket : RBML_CALL_DEPTH_BUCKETS - 1]++;
+
+	return 0;
+}
+
+/*
+ * Execution engines
+ *
+ * An engine runs the machine until it halts, has executed budget
+ * instructions, or blocks on console input (setting m->blocked), and
+ * leaves the state in the machine so that the next run resumes there.
+ */
+
+/**
+ * Run machine on the reference engine: opcode table dispatch through
+ * one function per instruction
+ */
+void rbml_engine_table(struct rbml_machine *m, uint64_t budget);
+
+/**
+ * Execute one instruction on the reference engine (or set m->blocked
+ * instead if it is a console read that would have to wait for input)
+ */
+void rbml_engine_table_step(struct rbml_machine *m);
+
+/**
+ * Run machine on the fast engine: inlined handlers dispatched with
+ * computed goto (or a switch where that is not available)
+ */
+void rbml_engine_fast(struct rbml_machine *m, uint64_t budget);
+
+/**
+ * Run machine on the traced engine: the fast engine recording every
+ * instruction into the trace ring buffer
+ */
+void rbml_engine_traced(struct rbml_machine *m, uint64_t budget);
+
+/**
+ * Run machine on the profiled engine: the fast engine counting every
+ * instruction into the execution profile
+ */
+void rbml_engine_profiled(struct rbml_machine *m, uint64_t budget);
+
+/**
+ * Run machine on the JIT engine: hot basic blocks compiled to host code,
+ * everything else on the reference engine (the fast engine on hosts the
+ * JIT does not support)
+ */
+void rbml_engine_jit(struct rbml_machine *m, uint64_t budget);
+
+/**
+ * Drop JIT compiled code and state
+ */
+void rbml_jit_free(struct rbml_machine *m);
+
+/**
+ * Reserve zeroed array beside main memory
+ *
+ * Like main memory, the pages are only reserved; each is committed when
+ * first touched, so a per word array costs what the program uses.
+ *
+ * @return array or NULL on failure
+ */
+void *rbml_reserve(size_t size);
+
+/**
+ * Zero reserved array, giving its pages back
+ */
+void rbml_reserve_clear(void *p, size_t size);
+
+/**
+ * Release reserved array
+ */
+void rbml_release(void *p, size_t size);
+
+/**
+ * Get predecoded instruction cache for engine
+ *
+ * The cache is kept across runs as long as the same engine runs the
+ * machine; a different engine starts over with a clean cache.
+ *
+ * @return cache (one entry per memory word) or NULL on allocation failure
+ */
+struct rbml_insn *rbml_machine_decoded(struct rbml_machine *m, int engine);
+
+/**
+ * Drop predecoded instruction cache
+ */
+void rbml_machine_flush_decoded(struct rbml_machine *m);
+
+/**
+ * Map size words of file contents at offset (a multiple of the page size)
+ * copy-on-write into main memory, resized to memory_size words first
+ * if need be; the rest of memory is cleared
+ *
+ * @return 0 on success, -1 on failure (reported on stderr)
+ */
+int rbml_machine_map(struct rbml_machine *m, size_t memory_size, int fd, off_t offset, size_t size,
+    const char *file);
+
+/**
+ * Stop machine on a machine error
+ */
+void rbml_machine_error(struct rbml_machine *m, const char *format, ...);
+
+#endif /* _MACHINE_IMPL_H_ */
@@ -0,0 +1,63 @@
+/**
+ * RBML relocatable object file format (rbmlc -c, rbml-ld)
+ *
+ * An object file holds the header, the program text, the relocations,
+ * the symbols and the names of the symbols, one after the other. Text
+ * offsets are relative to the start of the object's text. rbml-ld lays
+ * objects out one after the other and rewrites ARG3 of every word that
+ * has a relocation: a local one adds where the object was placed, one
+ * against a symbol sets the address the symbol was given.
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#ifndef _OBJECT_H_
+#define _OBJECT_H_
+
+#include <stdint.h>
+
+/**
+ * Object file magic
+ */
+#define RBML_OBJECT_MAGIC	"RBMLOBJ1"
+
+/**
+ * Object file header
+ */
+struct rbml_object_header {
+	char magic[8];		/**< RBML_OBJECT_MAGIC */
+	uint32_t text_words;	/**< program text size (number of words) */
+	uint32_t num_relocs;	/**< number of relocations */
+	uint32_t num_symbols;	/**< number of symbols */
+	uint32_t names_size;	/**< size of the symbol names (bytes) */
+};
+
+/**
+ * Relocation symbol of a reference to a label of the same object
+ */
+#define RBML_RELOC_LOCAL	UINT32_MAX
+
+/**
+ * Relocation: ARG3 of a text word is an address
+ */
+struct rbml_object_reloc {
+	uint32_t offset;	/**< text offset of the word */
+	uint32_t symbol;	/**< symbol index, or RBML_RELOC_LOCAL */
+};
+
+/**
+ * Symbol flags
+ */
+#define RBML_SYMBOL_EXPORT	0x1	/**< defined here (else imported) */
+
+/**
+ * Symbol exported or imported by the object
+ */
+struct rbml_object_symbol {
+	uint32_t name;		/**< offset of the NUL terminated name in the
+				     names */
+	uint32_t flags;		/**< RBML_SYMBOL_* */
+	uint32_t offset;	/**< text offset (exported symbols) */
+};
+
+#endif /* _OBJECT_H_ */
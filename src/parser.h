@@ -17,6 +17,9 @@ struct code;
 struct parser {
 	const char *input_file;	/**< input file */
 	FILE *fp;		/**< input file */
+	char *source;		/**< input file mapped for the scanner */
+	size_t source_size;	/**< size of the mapping (0: source read into
+				     memory instead) */
 
 	unsigned line_num;	/**< current line number */
 	unsigned num_errors;	/**< number of errors */
@@ -0,0 +1,212 @@
+/**
+ * RBML machine: execution profile
+ *
+ * The profiled engine (engine_profiled.c) counts every instruction it
+ * retires per opcode and per address, and the BR* and CA* instructions
+ * taken and not taken per address. This file allocates the counters and
+ * writes the report and JSON output.
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "machine_impl.h"
+
+/**
+ * Address count, sorted by rbml_machine_profile_report()
+ */
+struct hot {
+	uint64_t count;
+	size_t addr;
+};
+
+/**
+ * Count instructions executed per opcode and address, and branches taken
+ */
+int
+rbml_machine_profile(struct rbml_machine *m, int enable)
+{
+	struct rbml_profile *p;
+	size_t size = m->memory_size + RBML_GUARD_WORDS;
+
+	if (m->profile != NULL) {
+		free(m->profile->count);
+		free(m->profile->taken);
+		free(m->profile->not_taken);
+		free(m->profile);
+		m->profile = NULL;
+	}
+	if (!enable)
+		return 0;
+
+	if ((p = calloc(1, sizeof(*p))) == NULL)
+		return -1;
+	p->count = calloc(size, sizeof(*p->count));
+	p->taken = calloc(size, sizeof(*p->taken));
+	p->not_taken = calloc(size, sizeof(*p->not_taken));
+	m->profile = p;
+	if (p->count == NULL || p->taken == NULL || p->not_taken == NULL) {
+		rbml_machine_profile(m, 0);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Is opcode a branch or call (BR*, CA*)
+ */
+static int
+is_branch(int opcode)
+{
+	return (opcode >= OP_BRAN && opcode <= OP_BRLE) || (opcode >= OP_CALL && opcode <= OP_CALE);
+}
+
+/**
+ * Print opcode name
+ */
+static const char *
+opcode_name(int opcode, char *buf, size_t size)
+{
+	const char *name;
+
+	if ((name = rbml_opcode_name(opcode)) != NULL)
+		return name;
+	snprintf(buf, size, "0x%02x", opcode);
+	return buf;
+}
+
+/**
+ * Compare address counts: hottest first, then by address
+ */
+static int
+hot_cmp(const void *a, const void *b)
+{
+	const struct hot *ha = a, *hb = b;
+
+	if (ha->count != hb->count)
+		return ha->count < hb->count ? 1 : -1;
+	return ha->addr < hb->addr ? -1 : ha->addr > hb->addr;
+}
+
+/**
+ * Print profile report: hottest addresses and opcode histogram
+ */
+void
+rbml_machine_profile_report(const struct rbml_machine *m, FILE *fp, int top)
+{
+	const struct rbml_profile *p = m->profile;
+	struct hot hot[256], *hots;
+	uint64_t total = 0;
+	size_t i, n = 0;
+	char insn[32], name[8];
+
+	if (p == NULL)
+		return;
+
+	for (i = 0; i < countof(p->opcode); i++)
+		total += p->opcode[i];
+	fprintf(fp, "Profile: %llu instructions\n", (unsigned long long) total);
+	if (total == 0)
+		return;
+
+	if ((hots = malloc(m->memory_size * sizeof(*hots))) != NULL) {
+		for (i = 0; i < m->memory_size; i++) {
+			if (p->count[i] != 0) {
+				hots[n].count = p->count[i];
+				hots[n].addr = i;
+				n++;
+			}
+		}
+		qsort(hots, n, sizeof(*hots), hot_cmp);
+		if (top >= 0 && n > (size_t) top)
+			n = top;
+
+		fprintf(fp, "\n%12s %7s  %-8s %-8s  %-20s %12s %12s\n",
+		    "count", "%", "address", "word", "instruction", "taken", "not taken");
+		for (i = 0; i < n; i++) {
+			size_t addr = hots[i].addr;
+			rbml_word w = m->memory[addr];
+
+			rbml_disasm(w, insn, sizeof(insn));
+			fprintf(fp, "%12llu %6.2f%%  0x%04zx   %08x  ", (unsigned long long) hots[i].count,
+			    100.0 * hots[i].count / total, addr, (unsigned) w);
+			if (is_branch(RBML_OPCODE(w)))
+				fprintf(fp, "%-20s %12llu %12llu\n", insn, (unsigned long long) p->taken[addr],
+				    (unsigned long long) p->not_taken[addr]);
+			else
+				fprintf(fp, "%s\n", insn);
+		}
+		free(hots);
+	}
+
+	n = 0;
+	for (i = 0; i < countof(p->opcode); i++) {
+		if (p->opcode[i] != 0) {
+			hot[n].count = p->opcode[i];
+			hot[n].addr = i;
+			n++;
+		}
+	}
+	qsort(hot, n, sizeof(*hot), hot_cmp);
+
+	fprintf(fp, "\n%12s %7s  %s\n", "count", "%", "opcode");
+	for (i = 0; i < n; i++) {
+		fprintf(fp, "%12llu %6.2f%%  %s\n", (unsigned long long) hot[i].count,
+		    100.0 * hot[i].count / total, opcode_name(hot[i].addr, name, sizeof(name)));
+	}
+}
+
+/**
+ * Write profile as JSON
+ */
+int
+rbml_machine_profile_json(const struct rbml_machine *m, FILE *fp)
+{
+	const struct rbml_profile *p = m->profile;
+	uint64_t total = 0;
+	const char *sep;
+	size_t i;
+	char insn[32], name[8];
+
+	if (p == NULL)
+		return 0;
+
+	for (i = 0; i < countof(p->opcode); i++)
+		total += p->opcode[i];
+	fprintf(fp, "{\n\t\"instructions\": %llu,\n", (unsigned long long) total);
+
+	fprintf(fp, "\t\"opcodes\": {");
+	sep = "\n";
+	for (i = 0; i < countof(p->opcode); i++) {
+		if (p->opcode[i] == 0)
+			continue;
+		fprintf(fp, "%s\t\t\"%s\": %llu", sep, opcode_name(i, name, sizeof(name)),
+		    (unsigned long long) p->opcode[i]);
+		sep = ",\n";
+	}
+	fprintf(fp, "\n\t},\n");
+
+	// by address; words are as they were when the program stopped
+	fprintf(fp, "\t\"addresses\": [");
+	sep = "\n";
+	for (i = 0; i < m->memory_size; i++) {
+		rbml_word w = m->memory[i];
+
+		if (p->count[i] == 0)
+			continue;
+		rbml_disasm(w, insn, sizeof(insn));
+		fprintf(fp, "%s\t\t{ \"address\": %zu, \"word\": %u, \"instruction\": \"%s\", \"count\": %llu",
+		    sep, i, (unsigned) w, insn, (unsigned long long) p->count[i]);
+		if (is_branch(RBML_OPCODE(w)))
+			fprintf(fp, ", \"taken\": %llu, \"not_taken\": %llu",
+			    (unsigned long long) p->taken[i], (unsigned long long) p->not_taken[i]);
+		fprintf(fp, " }");
+		sep = ",\n";
+	}
+	fprintf(fp, "\n\t]\n}\n");
+
+	return ferror(fp) ? -1 : 0;
+}
@@ -0,0 +1,511 @@
+//Rumbaugh-Bricker Machine Language Emulator
+//copyright: 2015, Douglas Rumbaugh. All rights reserved.
+//
+//Batch runner: runs one program against any number of input files.
+//The program image (or a checkpoint to resume) is opened once and mapped
+//by all the machines; each
+//input runs on its own machine, on a pool of worker threads (one per
+//core by default) that steal jobs from each other when they run out,
+//with console output going to one output file per input. With -R every
+//input also gets its own RAM disks, so inputs do not share disk files.
+//
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "machine.h"
+
+/**
+ * Batch job: one input file
+ */
+struct job {
+	const char *input_file;	/**< console input */
+	char *output_file;	/**< console output */
+
+	int ran;		/**< the program ran */
+	int exit_status;	/**< machine exit status (RBML_EXIT_*) */
+	uint64_t instructions;	/**< instructions executed */
+	double elapsed;		/**< run time (seconds) */
+	size_t memory;		/**< main memory resident after the run
+				     (bytes) */
+	size_t call_depth;	/**< deepest call nesting reached */
+	int worker;		/**< worker that ran it */
+};
+
+/**
+ * Worker thread, with the queue of jobs it runs
+ *
+ * A worker takes jobs from the tail of its own queue; when that is empty
+ * it steals from the head of the others'. Jobs are never added once the
+ * workers run, so a worker finding every queue empty is done.
+ */
+struct worker {
+	pthread_t thread;
+	int id;
+	struct batch *batch;	/**< batch the worker runs */
+
+	pthread_mutex_t lock;	/**< protects the queue */
+	struct job **queue;	/**< jobs */
+	int head;		/**< first job left */
+	int tail;		/**< after the last job left */
+
+	struct rbml_machine *m;	/**< machine, reused by every job */
+	int steals;		/**< jobs taken from other workers */
+};
+
+/**
+ * Batch shared by the workers (read-only while they run)
+ */
+struct batch {
+	const struct rbml_image *image;
+				/**< program image */
+	const char *checkpoint_file;
+				/**< checkpoint to restore instead */
+	size_t memory_size;	/**< main memory size (number of words) */
+	int engine;		/**< execution engine */
+	int hugepages;		/**< back main memory with huge pages */
+	size_t call_stack_limit;
+				/**< call stack size limit (number of words) */
+	const char *ram_disks;	/**< RAM disk template directory (NULL: disk
+				     files) */
+
+	struct worker *workers;
+	int nworkers;
+};
+
+/**
+ * Print message and die
+ */
+void
+die(const char *format, ...)
+{
+	va_list ap;
+
+	if (format) {
+		va_start(ap, format);
+		vfprintf(stderr, format, ap);
+		fputc('\n', stderr);
+		va_end(ap);
+	}
+
+	exit(1);
+}
+
+/**
+ * Print usage and exit
+ */
+static void
+usage(const char *argv0)
+{
+	const char *program_name;
+
+	if ((program_name = strrchr(argv0, PATH_SEP)) != NULL)
+		program_name++;
+	else
+		program_name = argv0;
+
+	die("Usage: %s [-H] [-c <call-stack-limit>] [-e <engine>] [-j <threads>] [-m <memory-size>]\n"
+	    "	[-o <output-dir>] [-R <template-dir>] <program-file> <input-file>...\n"
+	    "       %s [options] -r <checkpoint-file> <input-file>...\n"
+	    "\n"
+	    "-c <call-stack-limit>	- call stack size limit (number of words)\n"
+	    "-e <engine>		- execution engine (fast, table, jit)\n"
+	    "-H			- back main memory with huge pages\n"
+	    "-j <threads>		- number of worker threads (default: number of cores)\n"
+	    "-m <memory-size>	- specify memory size (number of words)\n"
+	    "-o <output-dir>		- write <input-file>.out files to directory\n"
+	    "			  (default: next to the input files)\n"
+	    "-r <checkpoint-file>	- resume every input from checkpoint (see rbml\n"
+	    "			  --checkpoint-at) instead of running a program\n"
+	    "-R <template-dir>	- give every input its own RAM disks, loaded from\n"
+	    "			  the disk files in template-dir",
+	    program_name, program_name);
+}
+
+/**
+ * Parse engine name
+ */
+static int
+parse_engine(const char *argv0, const char *name)
+{
+	if (strcmp(name, "fast") == 0)
+		return RBML_ENGINE_FAST;
+	if (strcmp(name, "table") == 0)
+		return RBML_ENGINE_TABLE;
+	if (strcmp(name, "jit") == 0)
+		return RBML_ENGINE_JIT;
+
+	usage(argv0);
+	/* NOTREACHED */
+	return -1;
+}
+
+/**
+ * Parse count option argument: a number from 1 to max
+ */
+static size_t
+parse_count(const char *argv0, const char *arg, size_t max)
+{
+	unsigned long n;
+	char *end_ptr;
+
+	errno = 0;
+	n = strtoul(arg, &end_ptr, 0);
+	if (*arg == '\0' || *end_ptr != '\0' || errno != 0 || n == 0 || n > max)
+		usage(argv0);
+
+	return n;
+}
+
+/**
+ * Get output file name for input file
+ */
+static char *
+output_name(const char *input_file, const char *output_dir)
+{
+	const char *base;
+	char *name;
+	size_t size;
+
+	if (output_dir == NULL) {
+		base = input_file;
+		size = strlen(base) + sizeof(".out");
+	} else {
+		if ((base = strrchr(input_file, PATH_SEP)) != NULL)
+			base++;
+		else
+			base = input_file;
+		size = strlen(output_dir) + 1 + strlen(base) + sizeof(".out");
+	}
+
+	if ((name = malloc(size)) == NULL)
+		die("Failed to allocate output file name");
+	if (output_dir == NULL)
+		snprintf(name, size, "%s.out", base);
+	else
+		snprintf(name, size, "%s%c%s.out", output_dir, PATH_SEP, base);
+
+	return name;
+}
+
+/**
+ * Take next job: from the tail of the worker's own queue, else from the
+ * head of another worker's
+ *
+ * @return job or NULL if there are none left
+ */
+static struct job *
+take_job(struct batch *b, struct worker *w)
+{
+	struct job *job = NULL;
+	struct worker *v;
+	int i;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->head < w->tail)
+		job = w->queue[--w->tail];
+	pthread_mutex_unlock(&w->lock);
+
+	for (i = 1; job == NULL && i < b->nworkers; i++) {
+		v = &b->workers[(w->id + i) % b->nworkers];
+		pthread_mutex_lock(&v->lock);
+		if (v->head < v->tail) {
+			job = v->queue[v->head++];
+			w->steals++;
+		}
+		pthread_mutex_unlock(&v->lock);
+	}
+
+	return job;
+}
+
+/**
+ * Run job on the worker's machine
+ */
+static void
+run_job(struct batch *b, struct worker *w, struct job *job)
+{
+	struct rbml_machine *m = w->m;
+	struct timespec start, end;
+	uint64_t restored;
+	FILE *in, *out;
+	int rc;
+
+	job->worker = w->id;
+	if ((in = fopen(job->input_file, "r")) == NULL) {
+		fprintf(stderr, "Failed to open input %s: %s\n", job->input_file, strerror(errno));
+		return;
+	}
+	if ((out = fopen(job->output_file, "w")) == NULL) {
+		fprintf(stderr, "Failed to create output %s: %s\n", job->output_file, strerror(errno));
+		fclose(in);
+		return;
+	}
+
+	rbml_machine_reset(m);
+	if (b->checkpoint_file != NULL)
+		rc = rbml_machine_restore(m, b->checkpoint_file);
+	else
+		rc = rbml_machine_load_image(m, b->image);
+	if (rc < 0) {
+		fclose(in);
+		fclose(out);
+		return;
+	}
+	restored = m->instructions;
+	m->in = in;
+	m->out = out;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	job->exit_status = rbml_machine_run(m);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	job->elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	job->instructions = m->instructions - restored;
+	job->memory = rbml_machine_memory_resident(m);
+	job->call_depth = m->call_depth_max;
+	job->ran = 1;
+
+	m->in = NULL;
+	m->out = NULL;
+	fclose(in);
+	if (fclose(out) != 0) {
+		fprintf(stderr, "Failed to write output %s: %s\n", job->output_file, strerror(errno));
+		job->ran = 0;
+	}
+}
+
+/**
+ * Worker thread
+ */
+static void *
+worker_main(void *arg)
+{
+	struct worker *w = arg;
+	struct batch *b = w->batch;
+	struct job *job;
+
+	if ((w->m = rbml_machine_alloc(b->memory_size)) == NULL) {
+		fprintf(stderr, "Failed to allocate machine with %zu words of memory\n", b->memory_size);
+		return NULL;
+	}
+	w->m->engine = b->engine;
+	w->m->call_stack_limit = b->call_stack_limit;
+	if (b->hugepages)
+		rbml_machine_hugepages(w->m, 1);
+	if (b->ram_disks != NULL && rbml_machine_ram_disks(w->m, b->ram_disks) < 0) {
+		fprintf(stderr, "Failed to allocate RAM disks\n");
+		rbml_machine_free(w->m);
+		w->m = NULL;
+		return NULL;
+	}
+
+	while ((job = take_job(b, w)) != NULL)
+		run_job(b, w, job);
+
+	rbml_machine_free(w->m);
+	w->m = NULL;
+
+	return NULL;
+}
+
+/**
+ * Print batch summary
+ */
+static void
+print_summary(struct batch *b, struct job *jobs, int njobs, double elapsed)
+{
+	static const char *const status[] = {
+		[RBML_EXIT_HALT] =	"halt",
+		[RBML_EXIT_ERROR] =	"error",
+		[RBML_EXIT_HERR] =	"herr",
+	};
+	uint64_t instructions = 0;
+	double busy = 0;
+	size_t peak = 0, depth = 0;
+	int i, failed = 0, steals = 0;
+
+	printf("%-6s %-6s %14s %10s %10s %8s %6s  %s\n", "job", "status", "instructions", "time", "memory",
+	    "depth", "worker", "input");
+	for (i = 0; i < njobs; i++) {
+		struct job *job = &jobs[i];
+
+		if (!job->ran) {
+			printf("%-6d %-6s %14s %10s %10s %8s %6s  %s\n", i, "failed", "-", "-", "-", "-", "-",
+			    job->input_file);
+			failed++;
+			continue;
+		}
+		printf("%-6d %-6s %14llu %9.3fs %7zuKiB %8zu %6d  %s\n", i, status[job->exit_status],
+		    (unsigned long long) job->instructions, job->elapsed, job->memory / 1024,
+		    job->call_depth, job->worker, job->input_file);
+		if (job->call_depth > depth)
+			depth = job->call_depth;
+		if (job->memory > peak)
+			peak = job->memory;
+		instructions += job->instructions;
+		busy += job->elapsed;
+	}
+	for (i = 0; i < b->nworkers; i++)
+		steals += b->workers[i].steals;
+
+	printf("\n%d jobs (%d failed) on %d threads, %d stolen\n", njobs, failed, b->nworkers, steals);
+	printf("%llu instructions in %.3f s (%.1f MIPS, %.3f s of runs)\n",
+	    (unsigned long long) instructions, elapsed,
+	    elapsed > 0 ? instructions / elapsed / 1e6 : 0.0, busy);
+	printf("memory: %zu KiB resident at most per machine (main memory %zu KiB)\n",
+	    peak / 1024, b->memory_size * sizeof(rbml_word) / 1024);
+	printf("call depth: %zu max (stack limit %zu)\n", depth, b->call_stack_limit);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int c;
+	const char *argv0 = argv[0];
+
+	const char *program_file;
+	const char *output_dir = NULL;
+	struct batch b;
+	struct job *jobs;
+	int njobs, i;
+	struct timespec start, end;
+	double elapsed;
+
+	memset(&b, 0, sizeof(b));
+	b.memory_size = RBML_DEFAULT_MEMORY_SIZE;
+	b.engine = RBML_ENGINE_FAST;
+	b.call_stack_limit = RBML_DEFAULT_CALL_STACK_LIMIT;
+	b.nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+
+	/*
+	 * parse command line arguments
+	 */
+	while ((c = getopt(argc, argv, "c:e:Hj:m:o:r:R:h")) != -1) {
+		switch (c) {
+		case 'c':
+			// the call stack counter is an int
+			b.call_stack_limit = parse_count(argv0, optarg, INT_MAX);
+			break;
+
+		case 'e':
+			b.engine = parse_engine(argv0, optarg);
+			break;
+
+		case 'H':
+			b.hugepages = 1;
+			break;
+
+		case 'j':
+			b.nworkers = atoi(optarg);
+			break;
+
+		case 'm':
+			// addresses and the instruction counter are ints
+			b.memory_size = parse_count(argv0, optarg, INT_MAX);
+			break;
+
+		case 'o':
+			output_dir = optarg;
+			break;
+
+		case 'r':
+			b.checkpoint_file = optarg;
+			break;
+
+		case 'R':
+			b.ram_disks = optarg;
+			break;
+
+		case 'h':
+		default:
+			usage(argv0);
+			/* NOTREACHED */
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc < (b.checkpoint_file == NULL ? 2 : 1)) {
+		usage(argv0);
+		/* NOTREACHED */
+	}
+
+	if (b.checkpoint_file != NULL) {
+		struct rbml_machine *m;
+
+		// check the checkpoint once, and get its memory size
+		if ((m = rbml_machine_alloc(1)) == NULL)
+			die("Failed to allocate machine");
+		m->call_stack_limit = b.call_stack_limit;
+		if (rbml_machine_restore(m, b.checkpoint_file) < 0)
+			exit(1);
+		b.memory_size = m->memory_size;
+		rbml_machine_free(m);
+	} else {
+		program_file = argv[0];
+		argc--;
+		argv++;
+		if ((b.image = rbml_image_open(program_file)) == NULL)
+			exit(1);
+		if (b.image->size > b.memory_size)
+			die("Program %s too large: %zu words, main memory is %zu words",
+			    program_file, b.image->size, b.memory_size);
+	}
+	njobs = argc;
+
+	if ((jobs = calloc(njobs, sizeof(*jobs))) == NULL)
+		die("Failed to allocate %d jobs", njobs);
+	for (i = 0; i < njobs; i++) {
+		jobs[i].input_file = argv[i];
+		jobs[i].output_file = output_name(jobs[i].input_file, output_dir);
+	}
+
+	/*
+	 * deal the jobs out to the workers
+	 */
+	if (b.nworkers < 1)
+		b.nworkers = 1;
+	if (b.nworkers > njobs)
+		b.nworkers = njobs;
+	if ((b.workers = calloc(b.nworkers, sizeof(*b.workers))) == NULL)
+		die("Failed to allocate %d workers", b.nworkers);
+	for (i = 0; i < b.nworkers; i++) {
+		struct worker *w = &b.workers[i];
+
+		w->id = i;
+		w->batch = &b;
+		pthread_mutex_init(&w->lock, NULL);
+		if ((w->queue = calloc(njobs / b.nworkers + 1, sizeof(*w->queue))) == NULL)
+			die("Failed to allocate job queue");
+	}
+	for (i = 0; i < njobs; i++) {
+		struct worker *w = &b.workers[i % b.nworkers];
+
+		w->queue[w->tail++] = &jobs[i];
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < b.nworkers; i++) {
+		if ((errno = pthread_create(&b.workers[i].thread, NULL, worker_main, &b.workers[i])) != 0)
+			die("Failed to start worker thread: %s", strerror(errno));
+	}
+	for (i = 0; i < b.nworkers; i++)
+		pthread_join(b.workers[i].thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	print_summary(&b, jobs, njobs, elapsed);
+
+	for (i = 0; i < njobs; i++) {
+		if (!jobs[i].ran)
+			return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,323 @@
+/**
+ * RBML linker: relocatable objects to RBML program image
+ *
+ * Objects (rbmlc -c, see object.h) are laid out one after the other in
+ * command line order, so the first one holds the entry point (address 0).
+ * Every exported symbol is given its address and the imported ones are
+ * looked up by name in one sorted table; the relocations of all objects
+ * are then applied in a single pass over the program image:
+ *
+ *	rbmlc -c main.asm
+ *	rbmlc -c lib.asm
+ *	rbml-ld -o prog.rbml main.rbo lib.rbo
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "object.h"
+#include "rbml.h"
+
+/**
+ * Highest address ARG3 can hold
+ */
+#define ADDR_MAX	0xffff
+
+/**
+ * Object loaded for linking
+ */
+struct object {
+	const char *file;			/**< object file name */
+	struct rbml_object_header hdr;
+	rbml_word *text;
+	struct rbml_object_reloc *relocs;
+	struct rbml_object_symbol *symbols;
+	char *names;
+	size_t base;				/**< address of the text */
+	uint32_t *addr;				/**< per symbol: its address */
+};
+
+/**
+ * Exported symbol
+ */
+struct export {
+	const char *name;
+	uint32_t addr;
+	const struct object *obj;		/**< object defining it */
+};
+
+/**
+ * Print message and die
+ */
+void
+die(const char *format, ...)
+{
+	va_list ap;
+
+	if (format) {
+		va_start(ap, format);
+		vfprintf(stderr, format, ap);
+		fputc('\n', stderr);
+		va_end(ap);
+	}
+
+	exit(1);
+}
+
+/**
+ * Print usage and exit
+ */
+static void
+usage(const char *argv0)
+{
+	const char *program_name;
+
+	if ((program_name = strrchr(argv0, PATH_SEP)) != NULL)
+		program_name++;
+	else
+		program_name = argv0;
+
+	die("Usage: %s [-o <output-file>] <object-file>...", program_name);
+}
+
+/**
+ * Allocate memory or die
+ */
+static void *
+xcalloc(size_t n, size_t size)
+{
+	void *p;
+
+	if ((p = calloc(n != 0 ? n : 1, size)) == NULL)
+		die("Out of memory");
+
+	return p;
+}
+
+/**
+ * Read part of object file
+ */
+static void
+read_part(FILE *fp, void *buf, size_t size, size_t n, const char *file)
+{
+	if (fread(buf, size, n, fp) != n)
+		die("Corrupted object %s: Truncated", file);
+}
+
+/**
+ * Read object file
+ */
+static void
+read_object(struct object *obj, const char *file)
+{
+	const struct rbml_object_header *hdr = &obj->hdr;
+	uint32_t i;
+	FILE *fp;
+
+	obj->file = file;
+	if ((fp = fopen(file, "rb")) == NULL)
+		die("Failed to open object %s: %s", file, strerror(errno));
+	if (fread(&obj->hdr, sizeof(obj->hdr), 1, fp) != 1
+	    || memcmp(hdr->magic, RBML_OBJECT_MAGIC, sizeof(hdr->magic)) != 0)
+		die("%s: Not an RBML object", file);
+	if (hdr->text_words > ADDR_MAX + 1)
+		die("Corrupted object %s: Text of %u words", file, hdr->text_words);
+
+	obj->text = xcalloc(hdr->text_words, sizeof(*obj->text));
+	obj->relocs = xcalloc(hdr->num_relocs, sizeof(*obj->relocs));
+	obj->symbols = xcalloc(hdr->num_symbols, sizeof(*obj->symbols));
+	obj->names = xcalloc(hdr->names_size + 1, 1);
+	obj->addr = xcalloc(hdr->num_symbols, sizeof(*obj->addr));
+	read_part(fp, obj->text, sizeof(*obj->text), hdr->text_words, file);
+	read_part(fp, obj->relocs, sizeof(*obj->relocs), hdr->num_relocs, file);
+	read_part(fp, obj->symbols, sizeof(*obj->symbols), hdr->num_symbols, file);
+	read_part(fp, obj->names, 1, hdr->names_size, file);
+	fclose(fp);
+
+	for (i = 0; i < hdr->num_relocs; i++) {
+		if (obj->relocs[i].offset >= hdr->text_words
+		    || (obj->relocs[i].symbol != RBML_RELOC_LOCAL
+		    && obj->relocs[i].symbol >= hdr->num_symbols))
+			die("Corrupted object %s: Bad relocation %u", file, i);
+	}
+	for (i = 0; i < hdr->num_symbols; i++) {
+		// a label after the last word is at text_words
+		if (obj->symbols[i].name >= hdr->names_size
+		    || ((obj->symbols[i].flags & RBML_SYMBOL_EXPORT)
+		    && obj->symbols[i].offset > hdr->text_words))
+			die("Corrupted object %s: Bad symbol %u", file, i);
+	}
+}
+
+/**
+ * Compare exports by name
+ */
+static int
+export_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct export *) a)->name, ((const struct export *) b)->name);
+}
+
+/**
+ * Give every symbol of the objects its address
+ */
+static void
+resolve(struct object *objs, size_t num_objs)
+{
+	struct export *exports, key, *e;
+	struct rbml_object_symbol *sym;
+	size_t i, n = 0, errors = 0;
+	uint32_t j;
+
+	for (i = 0; i < num_objs; i++)
+		n += objs[i].hdr.num_symbols;
+	exports = xcalloc(n, sizeof(*exports));
+
+	n = 0;
+	for (i = 0; i < num_objs; i++) {
+		for (j = 0; j < objs[i].hdr.num_symbols; j++) {
+			sym = &objs[i].symbols[j];
+			if (!(sym->flags & RBML_SYMBOL_EXPORT))
+				continue;
+			objs[i].addr[j] = objs[i].base + sym->offset;
+			if (objs[i].addr[j] > ADDR_MAX) {
+				fprintf(stderr, "%s: Symbol `%s' at %u out of the address space\n",
+				    objs[i].file, objs[i].names + sym->name, objs[i].addr[j]);
+				errors++;
+			}
+			exports[n++] = (struct export) { objs[i].names + sym->name, objs[i].addr[j], &objs[i] };
+		}
+	}
+	qsort(exports, n, sizeof(*exports), export_cmp);
+	for (i = 1; i < n; i++) {
+		if (strcmp(exports[i - 1].name, exports[i].name) == 0) {
+			fprintf(stderr, "Symbol `%s' exported by %s and %s\n",
+			    exports[i].name, exports[i - 1].obj->file, exports[i].obj->file);
+			errors++;
+		}
+	}
+
+	for (i = 0; i < num_objs; i++) {
+		for (j = 0; j < objs[i].hdr.num_symbols; j++) {
+			sym = &objs[i].symbols[j];
+			if (sym->flags & RBML_SYMBOL_EXPORT)
+				continue;
+			key.name = objs[i].names + sym->name;
+			e = bsearch(&key, exports, n, sizeof(*exports), export_cmp);
+			if (e == NULL) {
+				fprintf(stderr, "%s: Undefined symbol `%s'\n", objs[i].file, key.name);
+				errors++;
+				continue;
+			}
+			objs[i].addr[j] = e->addr;
+		}
+	}
+	free(exports);
+
+	if (errors > 0)
+		die("Total %zu errors", errors);
+}
+
+/**
+ * Main entry point
+ */
+int
+main(int argc, char *argv[])
+{
+	int c;
+	const char *argv0 = argv[0];
+	const char *output_file = "a.rbml";
+	struct object *objs, *obj;
+	struct rbml_object_reloc *r;
+	rbml_word *image;
+	size_t i, size = 0;
+	uint32_t j, addr;
+	FILE *fp;
+
+	/*
+	 * Parse command line arguments
+	 */
+	while ((c = getopt(argc, argv, "o:h")) != -1) {
+		switch (c) {
+		case 'o':
+			output_file = optarg;
+			break;
+		case 'h':
+		default:
+			usage(argv0);
+			/* NOTREACHED */
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) {
+		usage(argv0);
+		/* NOTREACHED */
+	}
+
+	/*
+	 * Lay the objects out in command line order
+	 */
+	objs = xcalloc(argc, sizeof(*objs));
+	for (i = 0; i < (size_t) argc; i++) {
+		read_object(&objs[i], argv[i]);
+		objs[i].base = size;
+		size += objs[i].hdr.text_words;
+		if (size > ADDR_MAX + 1)
+			die("Program of %zu words does not fit the address space", size);
+	}
+	resolve(objs, argc);
+
+	/*
+	 * Relocate
+	 */
+	image = xcalloc(size, sizeof(*image));
+	for (i = 0; i < (size_t) argc; i++) {
+		obj = &objs[i];
+		memcpy(image + obj->base, obj->text, obj->hdr.text_words * sizeof(*image));
+		for (j = 0; j < obj->hdr.num_relocs; j++) {
+			r = &obj->relocs[j];
+			if (r->symbol == RBML_RELOC_LOCAL)
+				addr = obj->base + RBML_ARG3(obj->text[r->offset]);
+			else
+				addr = obj->addr[r->symbol];
+			if (addr > ADDR_MAX)
+				die("%s: Reference at %u to address %u out of the address space",
+				    obj->file, r->offset, addr);
+			RBML_SET_ARG3(image[obj->base + r->offset], addr);
+		}
+	}
+
+	/*
+	 * Write program image
+	 */
+	fp = fopen(output_file, "wb");
+	if (fp == NULL)
+		die("Failed to open output file %s: %s", output_file, strerror(errno));
+	fwrite(image, sizeof(*image), size, fp);
+	if (ferror(fp) || fclose(fp) != 0) {
+		unlink(output_file);
+		die("Failed to write output file %s: %s", output_file, strerror(errno));
+	}
+
+	for (i = 0; i < (size_t) argc; i++) {
+		free(objs[i].text);
+		free(objs[i].relocs);
+		free(objs[i].symbols);
+		free(objs[i].names);
+		free(objs[i].addr);
+	}
+	free(objs);
+	free(image);
+
+	exit(0);
+}
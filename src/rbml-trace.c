@@ -0,0 +1,135 @@
+//Rumbaugh-Bricker Machine Language Emulator
+//copyright: 2015, Douglas Rumbaugh. All rights reserved.
+//
+//Trace decoder: prints the instruction trace written by rbml -d or
+//rbml -t, one executed instruction per line, oldest first.
+//
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "machine.h"
+
+/**
+ * Print message and die
+ */
+void
+die(const char *format, ...)
+{
+	va_list ap;
+
+	if (format) {
+		va_start(ap, format);
+		vfprintf(stderr, format, ap);
+		fputc('\n', stderr);
+		va_end(ap);
+	}
+
+	exit(1);
+}
+
+/**
+ * Print usage and exit
+ */
+static void
+usage(const char *argv0)
+{
+	const char *program_name;
+
+	if ((program_name = strrchr(argv0, PATH_SEP)) != NULL)
+		program_name++;
+	else
+		program_name = argv0;
+
+	die("Usage: %s [-n <count>] <trace-file>\n"
+	    "\n"
+	    "-n <count>		- print only the last count instructions", program_name);
+}
+
+/**
+ * Print trace record
+ */
+static void
+print_record(uint64_t seq, const struct rbml_trace_record *r)
+{
+	char insn[32];
+
+	rbml_disasm(r->word, insn, sizeof(insn));
+	printf("%10llu  0x%08x: %08x  ", (unsigned long long) seq, r->pc, (unsigned) r->word);
+	if (r->reg < 16)
+		printf("%-20s  r%d = 0x%08x\n", insn, r->reg, (unsigned) r->value);
+	else if (r->reg == RBML_TRACE_ACC)
+		printf("%-20s  acc = 0x%08x\n", insn, (unsigned) r->value);
+	else if (r->reg == RBML_TRACE_JUMP)
+		printf("%-20s  jump = 0x%08x\n", insn, (unsigned) r->value);
+	else
+		printf("%s\n", insn);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int c;
+	const char *argv0 = argv[0];
+
+	const char *trace_file;
+	uint64_t count = 0;
+	uint64_t seq, skip = 0;
+	struct rbml_trace_header hdr;
+	struct rbml_trace_record r;
+	FILE *fp;
+
+	/*
+	 * parse command line arguments
+	 */
+	while ((c = getopt(argc, argv, "n:h")) != -1) {
+		switch (c) {
+		case 'n':
+			count = strtoull(optarg, NULL, 0);
+			break;
+
+		case 'h':
+		default:
+			usage(argv0);
+			/* NOTREACHED */
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc < 1) {
+		usage(argv0);
+		/* NOTREACHED */
+	}
+	trace_file = argv[0];
+
+	if ((fp = fopen(trace_file, "rb")) == NULL)
+		die("Failed to open trace %s: %s", trace_file, strerror(errno));
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1
+	    || memcmp(hdr.magic, RBML_TRACE_MAGIC, sizeof(hdr.magic)) != 0
+	    || hdr.record_size != sizeof(r))
+		die("Corrupted trace %s: Bad header", trace_file);
+
+	if (hdr.total > hdr.records)
+		printf("(%llu earlier instructions not in trace)\n",
+		    (unsigned long long) (hdr.total - hdr.records));
+	if (count != 0 && count < hdr.records)
+		skip = hdr.records - count;
+
+	// records are numbered by instruction executed, starting at 1
+	for (seq = hdr.total - hdr.records + 1; seq <= hdr.total; seq++) {
+		if (fread(&r, sizeof(r), 1, fp) != 1)
+			die("Corrupted trace %s: Truncated at instruction %llu", trace_file, (unsigned long long) seq);
+		if (skip > 0) {
+			skip--;
+			continue;
+		}
+		print_record(seq, &r);
+	}
+	fclose(fp);
+
+	return 0;
+}
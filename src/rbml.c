@@ -2,62 +2,71 @@
 //copyright: 2015, Douglas Rumbaugh. All rights reserved.
 //
 //This is an emulator for a chipset capable of executing RBML.
-//It represents a machine with a word length of 32 bits, 8 registers
-//and an arbitrarily sized main memory. It takes advantage of C functions
-//to enable file, display, and arthimatic operations. In a true machine
-//this functionality would all be coded in RBML as subroutines.
+//The machine itself lives in librbml (machine.c); this is the
+//command line front end that runs one program on one machine.
 //
 
-#include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
-#include "rbml.h"
+#include "machine.h"
 
-#define countof(a)	(sizeof(a) / sizeof((a)[0]))
-
-//Machine Registers.
-rbml_word accumulator;
-rbml_word jump;
-rbml_word reg[16];
-
-rbml_word instructionRegister;
-int instructionCounter;
-//END Machine Registers
-
-//Main Memory
-rbml_word *memory;
-rbml_word *callStack;
+/**
+ * Default trace file
+ */
+#define RBML_DEFAULT_TRACE_FILE	"rbml.trace"
 
-int callStackCounter;
-size_t SIZE_OF_MMEM = 1024;
-size_t SIZE_OF_CALLSTACK = 100;
-//END Main Memory
+/**
+ * Default profile file (JSON)
+ */
+#define RBML_DEFAULT_PROFILE_FILE	"rbml.profile.json"
 
-//Machine flags
-//Comparision Flags
-rbml_word less;
-rbml_word equal;
-rbml_word greater;
+/**
+ * Default checkpoint file
+ */
+#define RBML_DEFAULT_CHECKPOINT_FILE	"rbml.checkpoint"
 
-//Error Flags
-rbml_word overflow;
-rbml_word ioerr;
-rbml_word divzero;
-//END Machine Flags
+/**
+ * Long options without a short one
+ */
+enum {
+	OPT_CHECKPOINT_AT = 256,
+	OPT_CHECKPOINT_FILE,
+	OPT_RESTORE,
+	OPT_DISK_DIR,
+	OPT_RAM_DISKS,
+	OPT_SAVE_DISKS,
+};
 
-//Sequential Access Disks
-FILE *disk[16];
-//END SAD
+static const struct option long_options[] = {
+	{ "checkpoint-at",	required_argument,	NULL,	OPT_CHECKPOINT_AT },
+	{ "checkpoint-file",	required_argument,	NULL,	OPT_CHECKPOINT_FILE },
+	{ "restore",		required_argument,	NULL,	OPT_RESTORE },
+	{ "disk-dir",		required_argument,	NULL,	OPT_DISK_DIR },
+	{ "ram-disks",		required_argument,	NULL,	OPT_RAM_DISKS },
+	{ "save-disks",		no_argument,		NULL,	OPT_SAVE_DISKS },
+	{ "help",		no_argument,		NULL,	'h' },
+	{ NULL,			0,			NULL,	0 },
+};
 
-int debug;
+/**
+ * Number of addresses in the profile report
+ */
+#define PROFILE_TOP		20
 
-static void initInstructions();
-static void evaluateInstruction();
+// Traced machine and trace file, saved from the crash handler.
+static struct rbml_machine *traced;
+static int trace_fd = -1;
 
 /**
  * Print message and die
@@ -90,478 +99,369 @@ usage(const char *argv0)
 	else
 		program_name = argv0;
 
-	die("Usage: %s [-d] [-m <memory-size>] <program-file>\n"
+	die("Usage: %s [-AdHlpsv] [-c <call-stack-limit>] [-e <engine>] [-m <memory-size>]\n"
+	    "	[-P <profile-file>] [-t <trace-file>] [-T <trace-size>]\n"
+	    "	[--checkpoint-at <address>] [--checkpoint-file <checkpoint-file>]\n"
+	    "	[--disk-dir <dir>] [--ram-disks <template-dir> [--save-disks]]\n"
+	    "	<program-file> | --restore <checkpoint-file>\n"
 	    "\n"
-	    "-d			- debug\n"
-	    "-m <memory-size>	- specify memory size (number of words)", program_name);
+	    "-A			- read disks ahead and write them behind on an I/O\n"
+	    "			  thread, syncing them on CLOS and halt\n"
+	    "-c <call-stack-limit>	- call stack size limit (number of words)\n"
+	    "-d			- debug: trace execution to " RBML_DEFAULT_TRACE_FILE "\n"
+	    "-e <engine>		- execution engine (fast, table, jit)\n"
+	    "-H			- back main memory with huge pages\n"
+	    "-l			- line buffer console output (the default on a\n"
+	    "			  terminal)\n"
+	    "-m <memory-size>	- specify memory size (number of words)\n"
+	    "-p			- profile: print report, write " RBML_DEFAULT_PROFILE_FILE "\n"
+	    "-P <profile-file>	- profile, writing JSON profile to file\n"
+	    "-s			- print execution statistics\n"
+	    "-t <trace-file>		- trace execution to file (decode with rbml-trace)\n"
+	    "-T <trace-size>		- number of instructions kept in the trace\n"
+	    "-v			- verify program, printing what keeps it from\n"
+	    "			  running unchecked\n"
+	    "--checkpoint-at <address>\n"
+	    "			- write checkpoint when about to execute the\n"
+	    "			  instruction at address (the first time), then go on\n"
+	    "--checkpoint-file <checkpoint-file>\n"
+	    "			- checkpoint file (default: " RBML_DEFAULT_CHECKPOINT_FILE ")\n"
+	    "--restore <checkpoint-file>\n"
+	    "			- resume from checkpoint instead of running a program\n"
+	    "--disk-dir <dir>	- directory of the disk files (default: current)\n"
+	    "--ram-disks <template-dir>\n"
+	    "			- keep disks in memory, loaded from the disk files\n"
+	    "			  in template-dir\n"
+	    "--save-disks		- write RAM disks to the disk directory at exit", program_name);
 }
 
 /**
- * Dump registers
+ * Parse engine name
  */
-static void
-dump_registers()
+static int
+parse_engine(const char *argv0, const char *name)
 {
-	int i;
-
-	for (i = 0; i < countof(reg) / 2; i++) {
-		fprintf(stderr, "r%d:\t0x%08x\tr%d:\t0x%08x\n",
-		    i, reg[i], i + (int) countof(reg) / 2, reg[i + countof(reg) / 2]);
-	}
-	fprintf(stderr, "acc:\t0x%08x\tjump:\t0x%08x\n", accumulator, jump);
+	if (strcmp(name, "fast") == 0)
+		return RBML_ENGINE_FAST;
+	if (strcmp(name, "table") == 0)
+		return RBML_ENGINE_TABLE;
+	if (strcmp(name, "jit") == 0)
+		return RBML_ENGINE_JIT;
+
+	usage(argv0);
+	/* NOTREACHED */
+	return -1;
 }
 
-int
-main(int argc, char *argv[])
+/**
+ * Parse count option argument: a number from 1 to max
+ */
+static size_t
+parse_count(const char *argv0, const char *arg, size_t max)
 {
-	int c;
-	const char *argv0 = argv[0];
-
-	struct stat sb;
-	const char *program_file;
-	FILE *fp;
-	rbml_word program_size;
-
-	/*
-	 * parse command line arguments
-	 */
-	while ((c = getopt(argc, argv, "dm:h")) != -1) {
-		switch (c) {
-		case 'd':
-			debug = 1;
-			break;
-
-		case 'm':
-			SIZE_OF_MMEM = atoi(optarg);
-			break;
+	unsigned long n;
+	char *end_ptr;
 
-		case 'h':
-		default:
-			usage(argv0);
-			/* NOTREACHED */
-		}
-	}
-	argc -= optind;
-	argv += optind;
-	if (argc < 1) {
+	errno = 0;
+	n = strtoul(arg, &end_ptr, 0);
+	if (*arg == '\0' || *end_ptr != '\0' || errno != 0 || n == 0 || n > max)
 		usage(argv0);
-		/* NOTREACHED */
-	}
-	program_file = argv[0];
-
-	// initialize call stack
-	callStack = calloc(SIZE_OF_CALLSTACK, sizeof(*callStack));
-	callStackCounter = 0;
-
-	// initialize main memory
-	memory = calloc(SIZE_OF_MMEM, sizeof(*memory));
-
-	if (stat(program_file, &sb) < 0) {
-		fprintf(stderr, "Failed to stat program %s: %s\n", program_file, strerror(errno));
-		exit(1);
-	}
-	program_size = sb.st_size;
-	if ((program_size % sizeof(rbml_word)) != 0) {
-		fprintf(stderr, "Corrupted program %s: Not multiple of RBML word (%d bytes)\n",
-		    program_file, (int) sizeof(rbml_word));
-		exit(1);
-	}
 
-	// read program into main memory from file
-	fp = fopen(program_file, "r");
-	if (fp == NULL) {
-		fprintf(stderr, "Failed to open program %s: %s\n", program_file, strerror(errno));
-		exit(1);
-	}
- 
-	// Program is loaded into main memory. If the length of the program file exceeds
-	// that of main memory, only that which can fit is loaded. Note that this will
-	// result in undefined, potentially hazardous, behavior during program execution.
-	if (program_size < SIZE_OF_MMEM * sizeof(*memory))
-		fread(memory, 1, program_size, fp);
-	else
-		fread(memory, sizeof(*memory), SIZE_OF_MMEM, fp);
-	fclose(fp);
-	// end read program into main memory from file
-
-	initInstructions();
-	while (1) {
-		instructionRegister = memory[instructionCounter];
-		if (debug)
-			fprintf(stderr, "--> 0x%08x: %08x\n", instructionCounter, instructionRegister);
-		evaluateInstruction();
-		if (debug)
-			dump_registers();
-
-		instructionCounter++;
-		if (instructionCounter >= SIZE_OF_MMEM) {
-			fprintf(stderr, "Instruction counter out of memory region\n");
-			break;
-		}
-	}
-
-	free(memory);
-	free(callStack);
+	return n;
 }
 
-// Instructions -- these function simulate each CPU instruction.
-typedef void (*opcode_fn)(int arg1, int arg2, int arg3);
-#define OPCODE(name) static void name(int arg1, int arg2, int arg3)
-
-OPCODE(sto) { memory[arg3] = reg[arg1]; }
-OPCODE(stoa) { memory[arg3] = accumulator; }
-OPCODE(stoj) { memory[arg3] = jump; }
-
-OPCODE(lod) { reg[arg1] = memory[arg3]; }
-OPCODE(loda) { accumulator = memory[arg3]; }
-OPCODE(lodj) { jump = memory[arg3]; }
-
-OPCODE(mov) { reg[arg2] = reg[arg1]; }
-OPCODE(mova) { if (arg1) reg[arg2] = accumulator; else accumulator = reg[arg2]; }
-OPCODE(movj) { if (arg1) reg[arg2] = jump; else jump = reg[arg2]; }
-
-// Generic method for writing characters to console
+/**
+ * Save trace of crashed (or interrupted) machine and die by the signal
+ */
 static void
-cwrite(int fcontrol, rbml_word w)
+crash(int sig)
 {
-	if (fcontrol) {
-		int i;
-		char *s = (char *) &w;
-
-		for (i = sizeof(w) - 1; i >= 0; i--)
-			putchar(s[i]);
-	} else {
-		printf("%d\n", w);
-	}
+	rbml_machine_trace_dump(traced, trace_fd);
+	raise(sig);
 }
 
-OPCODE(writ) { cwrite(arg1, reg[arg2]); }
-OPCODE(wrta) { cwrite(arg1, accumulator); }
-OPCODE(wrtj) { cwrite(arg1, jump); }
-
-// General read function--called by all console input instructions
-// The fcontrol parameter controls the format of the output.
-//	If fcontrol is high, then the characters will be kept in ASCII
-//	If fcontrol is low, then the characters will be converted to 
-//	numeric. 
-//	This is important mainly for differentiating between input that is
-//	intended to be kept in character format, and input that should be 
-//	converted to a numeric format, when reading in numbers.
-static rbml_word
-cread(fcontrol)
+/**
+ * Open trace file and save it if the emulator crashes
+ */
+static void
+start_trace(struct rbml_machine *m, const char *trace_file, size_t trace_size)
 {
-	rbml_word w;
+	static const int signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGINT, SIGTERM };
+	struct sigaction sa;
+	int i;
 
-	if (fcontrol) {
-		fgets((char *) &w, sizeof(w), stdin);
-	} else {
-		scanf("%d", &w);
-	}
+	if (rbml_machine_trace(m, trace_size) < 0)
+		die("Failed to allocate trace of %zu instructions", trace_size);
+	if ((trace_fd = open(trace_file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		die("Failed to create trace %s: %s", trace_file, strerror(errno));
+	traced = m;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = crash;
+	sa.sa_flags = SA_RESETHAND;
+	sigemptyset(&sa.sa_mask);
+	for (i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+		sigaction(signals[i], &sa, NULL);
+}
 
-	return w;
+/**
+ * Save trace
+ */
+static void
+end_trace(const char *trace_file)
+{
+	if (rbml_machine_trace_dump(traced, trace_fd) < 0 || close(trace_fd) < 0)
+		die("Failed to write trace %s: %s", trace_file, strerror(errno));
+	trace_fd = -1;
 }
 
-OPCODE(crdm) { memory[arg3] = cread(arg1); }
-OPCODE(crda) { accumulator = cread(arg1); }
-OPCODE(crdj) { jump = cread(arg1); }
-OPCODE(crdr) { reg[arg2] = cread(arg1); }
+/**
+ * Print profile report and write JSON profile
+ */
+static void
+end_profile(struct rbml_machine *m, const char *profile_file)
+{
+	FILE *fp;
 
-OPCODE(open) {
-	char name[16];
-	snprintf(name, sizeof(name), "disk%d.rbdi", arg1);
+	fprintf(stderr, "\n");
+	rbml_machine_profile_report(m, stderr, PROFILE_TOP);
 
-	ioerr = 0;
-	disk[arg1] = fopen(name, "r+");
-	if (disk[arg1] == NULL)
-		ioerr = 1;
-}
-OPCODE(clos) {
-	fclose(disk[arg1]);
-	disk[arg1] = NULL;
+	if ((fp = fopen(profile_file, "w")) == NULL)
+		die("Failed to create profile %s: %s", profile_file, strerror(errno));
+	if (rbml_machine_profile_json(m, fp) < 0 || fclose(fp) != 0)
+		die("Failed to write profile %s", profile_file);
 }
-OPCODE(frdm) { fprintf(stderr, "Instruction not implemented\n"); }
-OPCODE(frdr) { fprintf(stderr, "Instruction not implemented\n"); }
-OPCODE(frda) { fprintf(stderr, "Instruction not implemented\n"); }
-OPCODE(frdj) { fprintf(stderr, "Instruction not implemented\n"); }
-OPCODE(fwrt) { fprintf(stderr, "Instruction not implemented\n"); }
-OPCODE(fwta) { fprintf(stderr, "Instruction not implemented\n"); }
-OPCODE(fwtj) { fprintf(stderr, "Instruction not implemented\n"); }
-OPCODE(repo) { fprintf(stderr, "Instruction not implemented\n"); }
-OPCODE(pres) { fprintf(stderr, "Instruction not implemented\n"); }
-
-static rbml_word
-addition(rbml_word a, rbml_word b)
-{
-	overflow = 0;
-	if ((a > 0 && b > RBML_WORD_MAX - a) || (a < 0 && b < RBML_WORD_MIN - a))
-		overflow = 1;
 
-	return a + b;
-}
+/**
+ * Print execution statistics
+ */
+static void
+print_stats(struct rbml_machine *m, const struct timespec *start, const struct timespec *end)
+{
+	static const struct {
+		const char *name;
+		int span;
+	} fuse[RBML_NUM_FUSE] = {
+		[RBML_FUSE_CMP_BR] =		{ "cmp+br", 2 },
+		[RBML_FUSE_LOD_OP_STO] =	{ "lod+lod+op+stoa", 4 },
+		[RBML_FUSE_OP_MOVA] =		{ "op+mova", 2 },
+		[RBML_FUSE_MOVA_MOVA] =		{ "mova+mova", 2 },
+	};
+	double elapsed;
+	uint64_t dispatches = m->instructions;
+	int i;
 
-OPCODE(add) { accumulator = addition(reg[arg1], reg[arg2]); }
-OPCODE(adda) { accumulator = addition(accumulator, reg[arg1]); }
-OPCODE(addj) { accumulator = addition(jump, reg[arg1]); }
+	elapsed = (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+	fprintf(stderr, "%llu instructions in %.3f s (%.1f MIPS)\n",
+	    (unsigned long long) m->instructions, elapsed,
+	    elapsed > 0 ? m->instructions / elapsed / 1e6 : 0.0);
 
-// Generic subtraction method, with overflow capture.
-static rbml_word
-subtraction(rbml_word a, rbml_word b)
-{
-	overflow = 0;
-	if ((a > 0 && b > RBML_WORD_MAX - a) || (a < 0 && b < RBML_WORD_MIN - a))
-		overflow = 1;
+	for (i = 0; i < RBML_NUM_FUSE; i++) {
+		fprintf(stderr, "fused %s:\t%llu\n", fuse[i].name, (unsigned long long) m->fused[i]);
+		dispatches -= m->fused[i] * (fuse[i].span - 1);
+	}
+	fprintf(stderr, "%llu dispatches (%.1f%% of instructions)\n", (unsigned long long) dispatches,
+	    m->instructions > 0 ? 100.0 * dispatches / m->instructions : 0.0);
+	fprintf(stderr, "memory: %zu KiB resident (main memory %zu KiB)\n",
+	    rbml_machine_memory_resident(m) / 1024, m->memory_size * sizeof(rbml_word) / 1024);
+
+	fprintf(stderr, "call depth: %zu max (stack limit %zu)\n", m->call_depth_max, m->call_stack_limit);
+	for (i = 0; i < RBML_CALL_DEPTH_BUCKETS; i++) {
+		if (m->call_depth[i] != 0)
+			fprintf(stderr, "depth %llu-%llu:\t%llu calls\n", 1ULL << i, (2ULL << i) - 1,
+			    (unsigned long long) m->call_depth[i]);
+	}
 
-	return a - b;
+	for (i = 0; i < RBML_NUM_DISKS; i++) {
+		if (m->disk_stall[i] != 0)
+			fprintf(stderr, "disk %d: %.3f s stalled on I/O\n", i, m->disk_stall[i] / 1e9);
+	}
 }
 
-OPCODE(sub) { accumulator = subtraction(reg[arg1], reg[arg2]); }
-OPCODE(suba) { accumulator = subtraction(accumulator, reg[arg1]); }
-OPCODE(subj) { accumulator = subtraction(jump, reg[arg1]); }
-
-static rbml_word
-multiplication(rbml_word a, rbml_word b)
+int
+main(int argc, char *argv[])
 {
-	overflow = 0;
-	if (a == 0 || b == 0)
-		return 0;
-	if ((a > 0 && b > RBML_WORD_MAX / a) || (a < 0 && b < RBML_WORD_MIN / a))
-		overflow = 1;
-
-	return a * b;
-}
+	int c;
+	const char *argv0 = argv[0];
 
-OPCODE(mult) { accumulator = multiplication(reg[arg1], reg[arg2]); }
-OPCODE(mlta) { accumulator = multiplication(accumulator, reg[arg1]); }
-OPCODE(mltj) { accumulator = multiplication(jump, reg[arg1]); }
+	const char *program_file = NULL;
+	const char *restore_file = NULL;
+	const char *checkpoint_file = RBML_DEFAULT_CHECKPOINT_FILE;
+	long checkpoint_at = -1;
+	char *end_ptr;
+	size_t memory_size = RBML_DEFAULT_MEMORY_SIZE;
+	size_t call_stack_limit = RBML_DEFAULT_CALL_STACK_LIMIT;
+	const char *trace_file = NULL;
+	const char *profile_file = NULL;
+	size_t trace_size = RBML_DEFAULT_TRACE_SIZE;
+	int engine = RBML_ENGINE_FAST;
+	int stats = 0;
+	int hugepages = 0;
+	int output_buffering = RBML_OUTPUT_AUTO;
+	int verify = 0;
+	int disk_thread = 0;
+	const char *disk_dir = NULL;
+	const char *ram_disks = NULL;
+	int save_disks = 0;
+	int exit_status;
+	struct rbml_machine *m;
+	struct timespec start, end;
 
-static rbml_word
-division(rbml_word a, rbml_word b)
-{
-	if (b == 0) {
-		divzero = 1;
-		return 0;
-	}
+	/*
+	 * parse command line arguments
+	 */
+	while ((c = getopt_long(argc, argv, "Ac:de:Hlm:pP:st:T:vh", long_options, NULL)) != -1) {
+		switch (c) {
+		case OPT_CHECKPOINT_AT:
+			checkpoint_at = strtol(optarg, &end_ptr, 0);
+			if (*optarg == '\0' || *end_ptr != '\0' || checkpoint_at < 0)
+				usage(argv0);
+			break;
 
-	divzero = 0;
-	return a / b;
-}
+		case OPT_CHECKPOINT_FILE:
+			checkpoint_file = optarg;
+			break;
 
-OPCODE(div_) { accumulator = division(reg[arg1], reg[arg2]); }
-OPCODE(diva) { accumulator = division(accumulator, reg[arg1]); }
-OPCODE(divj) { accumulator = division(jump, reg[arg1]); }
+		case OPT_RESTORE:
+			restore_file = optarg;
+			break;
 
-static rbml_word
-modulus(rbml_word a, rbml_word b)
-{
-	if (b == 0) {
-		divzero = 1;
-		return 0;
-	}
+		case OPT_DISK_DIR:
+			disk_dir = optarg;
+			break;
 
-	divzero = 0;
-	return a % b;
-}
+		case OPT_RAM_DISKS:
+			ram_disks = optarg;
+			break;
 
-OPCODE(mod) { accumulator = modulus(reg[arg1], reg[arg2]); }
-OPCODE(moda) { accumulator = modulus(accumulator, reg[arg1]); }
-OPCODE(modj) { accumulator = modulus(jump, reg[arg1]); }
+		case OPT_SAVE_DISKS:
+			save_disks = 1;
+			break;
 
-OPCODE(cjnt) { accumulator = reg[arg1] & reg[arg2]; }
-OPCODE(cjna) { accumulator = accumulator & reg[arg1]; }
-OPCODE(cjnj) { accumulator = jump & reg[arg1]; }
+		case 'A':
+			disk_thread = 1;
+			break;
 
-OPCODE(djnt) { accumulator = reg[arg1] | reg[arg2]; }
-OPCODE(djna) { accumulator = accumulator | reg[arg1]; }
-OPCODE(djnj) { accumulator = jump | reg[arg1]; }
+		case 'c':
+			// the call stack counter is an int
+			call_stack_limit = parse_count(argv0, optarg, INT_MAX);
+			break;
 
-OPCODE(comp) { accumulator = ~reg[arg1]; }
-OPCODE(compa) { accumulator = ~accumulator; }
-OPCODE(compj) { accumulator = ~jump; }
+		case 'd':
+			trace_file = RBML_DEFAULT_TRACE_FILE;
+			break;
 
-OPCODE(lsft) { accumulator = reg[arg1] << reg[arg2]; }
-OPCODE(lsfa) { accumulator = accumulator << reg[arg1]; }
-OPCODE(lsfj) { accumulator = jump << reg[arg1]; }
+		case 'e':
+			engine = parse_engine(argv0, optarg);
+			break;
 
-OPCODE(rsft) { accumulator = reg[arg1] >> reg[arg2]; }
-OPCODE(rsfa) { accumulator = accumulator >> reg[arg1]; }
-OPCODE(rsfj) { accumulator = jump >> reg[arg1]; }
+		case 'H':
+			hugepages = 1;
+			break;
 
-static void
-compare(rbml_word a, rbml_word b)
-{
-	less = a < b;
-	equal = a == b;
-	greater = a > b;
-}
+		case 'l':
+			output_buffering = RBML_OUTPUT_LINE;
+			break;
 
-OPCODE(cmp) { compare(reg[arg1], reg[arg2]); }
-OPCODE(cmpa) { compare(accumulator, reg[arg1]); }
-OPCODE(cmpj) { compare(jump, reg[arg1]); }
-OPCODE(cmpm) { compare(reg[arg1], memory[arg3]); }
-
-OPCODE(bran) { instructionCounter = arg3 - 1; }
-OPCODE(brgt) { if (greater) bran(arg1, arg2, arg3); }
-OPCODE(brlt) { if (less) bran(arg1, arg2, arg3); }
-OPCODE(breq) { if (equal) bran(arg1, arg2, arg3); }
-OPCODE(brge) { if (greater || equal) bran(arg1, arg2, arg3); }
-OPCODE(brle) { if (greater || less) bran(arg1, arg2, arg3); }
-
-OPCODE(call) {
-	if (jump == 0)
-		jump = instructionCounter;
-	else {
- 		 *(callStack + callStackCounter) = jump;
-		callStackCounter = callStackCounter + 1;
-		jump = instructionCounter;
-	}
-	instructionCounter = arg3 - 1;
-}
-OPCODE(cagt) { if (greater) call(arg1, arg2, arg3); }
-OPCODE(calt) { if (less) call(arg1, arg2, arg3); }
-OPCODE(caeq) { if (equal) call(arg1, arg2, arg3); }
-OPCODE(cage) { if (greater || equal) call(arg1, arg2, arg3); }
-OPCODE(cale) { if (less || equal) call(arg1, arg2, arg3); }
-OPCODE(end) {
-	instructionCounter = jump;
-	if (callStackCounter == 0) {
-		jump = callStack[0];
-		callStack[0] = 0;
-	} else {
-		jump = callStack[--callStackCounter];
-	}
-}
+		case 'm':
+			// addresses and the instruction counter are ints
+			memory_size = parse_count(argv0, optarg, INT_MAX);
+			break;
 
-OPCODE(halt) { exit(0); }
-OPCODE(herr) { exit(2); }
+		case 'p':
+			profile_file = RBML_DEFAULT_PROFILE_FILE;
+			break;
 
-struct opcode_def {
-	uint8_t opcode;
-	opcode_fn op;
-};
+		case 'P':
+			profile_file = optarg;
+			break;
 
-static struct opcode_def opcode_defs[] = {
-	{ OP_STO,	sto },
-	{ OP_STOA,	stoa },
-	{ OP_STOJ,	stoj },
-
-	{ OP_LOD,	lod },
-	{ OP_LODA,	loda },
-	{ OP_LODJ,	lodj },
-
-	{ OP_MOV,	mov },
-	{ OP_MOVA,	mova },
-	{ OP_MOVJ,	movj },
-
-	{ OP_CRDM,	crdm },
-	{ OP_CRDR,	crdr },
-	{ OP_CRDA,	crda },
-	{ OP_CRDJ,	crdj },
-
-	{ OP_WRIT,	writ },
-	{ OP_WRTA,	wrta },
-	{ OP_WRTJ,	wrtj },
-
-	{ OP_FRDM,	frdm },
-	{ OP_FRDR,	frdr },
-	{ OP_FRDA,	frda },
-	{ OP_FRDJ,	frdj },
-	{ OP_FWRT,	fwrt },
-	{ OP_FWTA,	fwta },
-	{ OP_FWTJ,	fwtj },
-	{ OP_REPO,	repo },
-	{ OP_PRES,	pres },
-	{ OP_OPEN,	open },
-	{ OP_CLOS,	clos },
-
-	{ OP_ADD,	add },
-	{ OP_ADDA,	adda },
-	{ OP_ADDJ,	addj },
-
-	{ OP_SUB,	sub },
-	{ OP_SUBA,	suba },
-	{ OP_SUBJ,	subj },
-
-	{ OP_DIV,	div_ },
-	{ OP_DIVA,	diva },
-	{ OP_DIVJ,	divj },
-
-	{ OP_MULT,	mult },
-	{ OP_MLTA,	mlta },
-	{ OP_MLTJ,	mltj },
-
-	{ OP_MOD,	mod },
-	{ OP_MODA,	moda },
-	{ OP_MODJ,	modj },
-
-	{ OP_CJNT,	cjnt },
-	{ OP_CJNA,	cjna },
-	{ OP_CJNJ,	cjnj },
-
-	{ OP_DJNT,	djnt },
-	{ OP_DJNA,	djna },
-	{ OP_DJNJ,	djnj },
-
-	{ OP_COMP,	comp },
-	{ OP_COMPA,	compa },
-	{ OP_COMPJ,	compj },
-
-	{ OP_LSFT,	lsft },
-	{ OP_LSFA,	lsfa },
-	{ OP_LSFJ,	lsfj },
-
-	{ OP_RSFT,	rsft },
-	{ OP_RSFA,	rsfa },
-	{ OP_RSFJ,	rsfj },
-
-	{ OP_CMP,	cmp },
-	{ OP_CMPA,	cmpa },
-	{ OP_CMPJ,	cmpj },
-	{ OP_CMPM,	cmpm },
-
-	{ OP_BRAN,	bran },
-	{ OP_BRGT,	brgt },
-	{ OP_BRLT,	brlt },
-	{ OP_BREQ,	breq },
-	{ OP_BRGE,	brge },
-	{ OP_BRLE,	brle },
-
-	{ OP_CALL,	call },
-	{ OP_CAGT,	cagt },
-	{ OP_CALT,	calt },
-	{ OP_CAEQ,	caeq },
-	{ OP_CAGE,	cage },
-	{ OP_CALE,	cale },
-	{ OP_END,	end },
-
-	{ OP_HALT,	halt },
-	{ OP_HERR,	herr },
-
-	{ 0,		NULL },
-};
+		case 's':
+			stats = 1;
+			break;
 
-static opcode_fn opcodes[256];
+		case 't':
+			trace_file = optarg;
+			break;
 
-static void
-initInstructions()
-{
-	struct opcode_def *d = opcode_defs;
+		case 'T':
+			trace_size = atoi(optarg);
+			if (trace_size == 0)
+				usage(argv0);
+			break;
 
-	for (d = opcode_defs; d->op != NULL; d++)
-		opcodes[d->opcode] = d->op;
-}
+		case 'v':
+			verify = 1;
+			break;
 
-static void
-evaluateInstruction()
-{
-	opcode_fn op;
-	rbml_word w = instructionRegister;
-	uint8_t opcode = RBML_OPCODE(w);
-
-	op = opcodes[opcode];
-	if (op == NULL) {
-		fprintf(stderr, "Unknown opcode %x at %x\n", opcode, instructionCounter);
-		return;
+		case 'h':
+		default:
+			usage(argv0);
+			/* NOTREACHED */
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != (restore_file == NULL ? 1 : 0)) {
+		usage(argv0);
+		/* NOTREACHED */
 	}
+	if (restore_file == NULL)
+		program_file = argv[0];
+	if (save_disks && ram_disks == NULL)
+		usage(argv0);
 
-	op(RBML_ARG1(w), RBML_ARG2(w), RBML_ARG3(w));
+	m = rbml_machine_alloc(memory_size);
+	if (m == NULL)
+		die("Failed to allocate machine with %zu words of memory", memory_size);
+	m->engine = engine;
+	m->call_stack_limit = call_stack_limit;
+	m->output_buffering = output_buffering;
+	if (hugepages && rbml_machine_hugepages(m, 1) < 0)
+		die("Huge pages not supported");
+	if (rbml_machine_disk_dir(m, disk_dir) < 0 || rbml_machine_ram_disks(m, ram_disks) < 0)
+		die("Failed to allocate disk directory names");
+
+	if (restore_file != NULL) {
+		if (rbml_machine_restore(m, restore_file) < 0)
+			exit(1);
+	} else {
+		if (rbml_machine_load(m, program_file) < 0)
+			exit(1);
+	}
+	if (verify) {
+		if (rbml_machine_verify(m, stderr) < 0)
+			die("Failed to allocate verifier");
+		fprintf(stderr, "Program %s\n", m->verified ? "verified" : "not verified, running checked");
+	}
+	if (disk_thread && rbml_machine_disk_thread(m, 1) < 0)
+		die("Failed to start disk I/O thread: %s", strerror(errno));
+	if (trace_file != NULL)
+		start_trace(m, trace_file, trace_size);
+	if (profile_file != NULL && rbml_machine_profile(m, 1) < 0)
+		die("Failed to allocate profile for %zu words of memory", m->memory_size);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (checkpoint_at >= 0) {
+		if (rbml_machine_run_until(m, checkpoint_at) == RBML_RUN_STOPPED) {
+			if (rbml_machine_checkpoint(m, checkpoint_file) < 0)
+				exit(1);
+		} else {
+			fprintf(stderr, "Program stopped before reaching 0x%lx, no checkpoint written\n",
+			    checkpoint_at);
+		}
+	}
+	exit_status = rbml_machine_run(m);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (trace_file != NULL)
+		end_trace(trace_file);
+	if (profile_file != NULL)
+		end_profile(m, profile_file);
+	if (stats)
+		print_stats(m, &start, &end);
+	if (save_disks && rbml_machine_save_disks(m) < 0)
+		exit_status = RBML_EXIT_ERROR;
+	rbml_machine_free(m);
+
+	return exit_status;
 }
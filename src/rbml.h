@@ -24,7 +24,7 @@ typedef int32_t rbml_word;
  * Generate RBML instruction
  */
 #define RBML_INST(op, arg1, arg2, arg3)		\
-	(((op) & 0xff) << 24 | ((arg1) & 0xf) << 20 | ((arg2) & 0xf) << 16 | (arg3) & 0xffff)
+	(((op) & 0xff) << 24 | ((arg1) & 0xf) << 20 | ((arg2) & 0xf) << 16 | ((arg3) & 0xffff))
 
 /**
  * Get RBML instruction opcode
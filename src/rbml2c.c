@@ -0,0 +1,609 @@
+/**
+ * RBML ahead of time translator: RBML program image to C
+ *
+ * Every word reachable from the entry point (address 0) by falling
+ * through, branching or calling is translated to C in address order, with
+ * a label at the start of each basic block. Registers and flags are locals
+ * of the translated function, so the C compiler can keep them in host
+ * registers. Static branch and call targets compile to plain gotos;
+ * returns (END) go through a switch over the instruction counter whose
+ * cases are the block labels.
+ *
+ * Anything that cannot be translated ahead of time is handed over to the
+ * interpreter (rbml_machine_run()) with the machine state written back:
+ * a computed jump to an address that does not start a translated block,
+ * a store into a translated word (self-modifying code), and a memory
+ * operand out of the memory region, which the interpreter reports. The
+ * interpreter then runs the program to the end on the modified memory.
+ *
+ * The generated code links against librbml and does its console and disk
+ * I/O through the same functions as the emulator, so its output is
+ * identical:
+ *
+ *	rbml2c -o prog.c prog.rbml
+ *	cc -O2 -Isrc -o prog prog.c src/librbml.a -lpthread
+ *
+ * Define RBML2C_NO_MAIN to embed the translated program; it is then run by
+ * rbml_program_run() on a machine loaded with rbml_program_image.
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "machine_impl.h"
+
+/*
+ * Word flags
+ */
+#define W_REACHABLE	0x01	/**< word is executed */
+#define W_LABEL		0x02	/**< word starts a basic block */
+
+/**
+ * Translation
+ */
+struct translation {
+	const char *program_file;	/**< program file name */
+	const rbml_word *memory;	/**< program image */
+	size_t memory_size;		/**< main memory size (number of words) */
+	size_t image_size;		/**< program image size (number of words) */
+	unsigned char *flags;		/**< word flags (W_*) */
+	FILE *fp;			/**< output file */
+};
+
+/**
+ * Print message and die
+ */
+void
+die(const char *format, ...)
+{
+	va_list ap;
+
+	if (format) {
+		va_start(ap, format);
+		vfprintf(stderr, format, ap);
+		fputc('\n', stderr);
+		va_end(ap);
+	}
+
+	exit(1);
+}
+
+/**
+ * Print usage and exit
+ */
+static void
+usage(const char *argv0)
+{
+	const char *program_name;
+
+	if ((program_name = strrchr(argv0, PATH_SEP)) != NULL)
+		program_name++;
+	else
+		program_name = argv0;
+
+	die("Usage: %s [-m <memory-size>] [-o <output-file>] <program-file>", program_name);
+}
+
+/**
+ * Mark word reachable
+ *
+ * @return 1 if the word has to be visited, 0 otherwise
+ */
+static int
+reach(struct translation *t, size_t addr, int label)
+{
+	int visit;
+
+	if (addr >= t->memory_size)
+		return 0;
+
+	visit = !(t->flags[addr] & W_REACHABLE);
+	t->flags[addr] |= W_REACHABLE | (label ? W_LABEL : 0);
+
+	return visit;
+}
+
+/**
+ * Find the words reachable from the entry point and the basic blocks
+ * they form
+ */
+static void
+analyze(struct translation *t)
+{
+	size_t *stack;
+	size_t sp = 0, addr;
+	rbml_word w;
+	int op;
+
+	stack = calloc(t->memory_size, sizeof(*stack));
+	if (stack == NULL)
+		die("Out of memory");
+
+	if (reach(t, 0, 1))
+		stack[sp++] = 0;
+	while (sp > 0) {
+		addr = stack[--sp];
+		w = t->memory[addr];
+		op = RBML_OPCODE(w);
+
+		// branch and call targets start blocks
+		if (op >= OP_BRAN && op <= OP_BRLE) {
+			if (reach(t, RBML_ARG3(w), 1))
+				stack[sp++] = RBML_ARG3(w);
+		} else if (op >= OP_CALL && op <= OP_CALE) {
+			if (reach(t, RBML_ARG3(w), 1))
+				stack[sp++] = RBML_ARG3(w);
+		}
+
+		// next word; the word after a call is where END returns to
+		switch (op) {
+		case OP_BRAN:
+		case OP_END:
+		case OP_HALT:
+		case OP_HERR:
+			break;
+
+		default:
+			if (reach(t, addr + 1, (op >= OP_BRGT && op <= OP_BRLE) || (op >= OP_CALL && op <= OP_CALE)))
+				stack[sp++] = addr + 1;
+			break;
+		}
+	}
+
+	free(stack);
+}
+
+/**
+ * Emit jump to static target
+ */
+static void
+emit_jump(struct translation *t, size_t target)
+{
+	if (target >= t->memory_size)
+		fprintf(t->fp, "{ pc = %zu; goto out_of_region; }\n", target);
+	else
+		fprintf(t->fp, "goto L%04zx;\n", target);
+}
+
+/**
+ * Emit store to memory
+ *
+ * A store into a translated word leaves the translated code for the
+ * interpreter, which runs the modified program.
+ */
+static void
+emit_store(struct translation *t, size_t addr, int arg3, const char *value)
+{
+	fprintf(t->fp, "\tmemory[%d] = %s;\n", arg3, value);
+	if (arg3 < t->memory_size && (t->flags[arg3] & W_REACHABLE))
+		fprintf(t->fp, "\tpc = %zu;\n\tgoto interpret;\n", addr + 1);
+}
+
+/**
+ * Get flag condition of conditional branch or call
+ */
+static const char *
+condition(int op)
+{
+	switch (op) {
+	case OP_BRGT: case OP_CAGT:	return "greater";
+	case OP_BRLT: case OP_CALT:	return "less";
+	case OP_BREQ: case OP_CAEQ:	return "equal";
+	case OP_BRGE: case OP_CAGE:	return "greater || equal";
+	case OP_BRLE:			return "greater || less";
+	case OP_CALE:			return "less || equal";
+	}
+
+	return "1";
+}
+
+/**
+ * Emit call
+ */
+static void
+emit_call(struct translation *t, size_t addr, size_t target, const char *indent)
+{
+	fprintf(t->fp, "%sif (rbml_call(m, jump) < 0) {\n", indent);
+	fprintf(t->fp, "%s\tpc = %zu;\n", indent, addr);
+	fprintf(t->fp, "%s\tgoto halt;\n", indent);
+	fprintf(t->fp, "%s}\n", indent);
+	fprintf(t->fp, "%sjump = %zu;\n", indent, addr);
+	fprintf(t->fp, "%s", indent);
+	emit_jump(t, target);
+}
+
+/**
+ * Translate instruction
+ *
+ * @return 1 if execution can fall through to the next word, 0 otherwise
+ */
+static int
+translate(struct translation *t, size_t addr)
+{
+	rbml_word w = t->memory[addr];
+	int op = RBML_OPCODE(w);
+	int arg1 = RBML_ARG1(w);
+	int arg2 = RBML_ARG2(w);
+	int arg3 = RBML_ARG3(w);
+	char r1[8], r2[8];
+	FILE *fp = t->fp;
+
+	snprintf(r1, sizeof(r1), "r%d", arg1);
+	snprintf(r2, sizeof(r2), "r%d", arg2);
+
+	// the interpreter checks the address and stops the program
+	if (rbml_is_memory_operand(w) && (size_t) arg3 >= t->memory_size) {
+		fprintf(fp, "\tpc = %zu;\n\tgoto interpret;\n", addr);
+		return 0;
+	}
+
+	switch (op) {
+	case OP_STO:	emit_store(t, addr, arg3, r1); break;
+	case OP_STOA:	emit_store(t, addr, arg3, "acc"); break;
+	case OP_STOJ:	emit_store(t, addr, arg3, "jump"); break;
+
+	case OP_LOD:	fprintf(fp, "\t%s = memory[%d];\n", r1, arg3); break;
+	case OP_LODA:	fprintf(fp, "\tacc = memory[%d];\n", arg3); break;
+	case OP_LODJ:	fprintf(fp, "\tjump = memory[%d];\n", arg3); break;
+
+	case OP_MOV:	fprintf(fp, "\t%s = %s;\n", r2, r1); break;
+	case OP_MOVA:
+		if (arg1)
+			fprintf(fp, "\t%s = acc;\n", r2);
+		else
+			fprintf(fp, "\tacc = %s;\n", r2);
+		break;
+	case OP_MOVJ:
+		if (arg1)
+			fprintf(fp, "\t%s = jump;\n", r2);
+		else
+			fprintf(fp, "\tjump = %s;\n", r2);
+		break;
+
+	case OP_CRDM: {
+		char value[32];
+
+		snprintf(value, sizeof(value), "rbml_cread(m, %d)", arg1);
+		emit_store(t, addr, arg3, value);
+		break;
+	}
+	case OP_CRDR:	fprintf(fp, "\t%s = rbml_cread(m, %d);\n", r2, arg1); break;
+	case OP_CRDA:	fprintf(fp, "\tacc = rbml_cread(m, %d);\n", arg1); break;
+	case OP_CRDJ:	fprintf(fp, "\tjump = rbml_cread(m, %d);\n", arg1); break;
+
+	case OP_WRIT:	fprintf(fp, "\trbml_cwrite(m, %d, %s);\n", arg1, r2); break;
+	case OP_WRTA:	fprintf(fp, "\trbml_cwrite(m, %d, acc);\n", arg1); break;
+	case OP_WRTJ:	fprintf(fp, "\trbml_cwrite(m, %d, jump);\n", arg1); break;
+
+	case OP_FRDM: {
+		char value[32];
+
+		snprintf(value, sizeof(value), "rbml_disk_read(m, %d)", arg1);
+		emit_store(t, addr, arg3, value);
+		break;
+	}
+	case OP_FRDR:	fprintf(fp, "\t%s = rbml_disk_read(m, %d);\n", r2, arg1); break;
+	case OP_FRDA:	fprintf(fp, "\tacc = rbml_disk_read(m, %d);\n", arg1); break;
+	case OP_FRDJ:	fprintf(fp, "\tjump = rbml_disk_read(m, %d);\n", arg1); break;
+
+	case OP_FWRT:	fprintf(fp, "\trbml_disk_write(m, %d, %s);\n", arg1, r2); break;
+	case OP_FWTA:	fprintf(fp, "\trbml_disk_write(m, %d, acc);\n", arg1); break;
+	case OP_FWTJ:	fprintf(fp, "\trbml_disk_write(m, %d, jump);\n", arg1); break;
+
+	case OP_REPO:	fprintf(fp, "\trbml_disk_move(m, %d, %d, %d);\n", arg1, arg2, arg3); break;
+	case OP_PRES:	fprintf(fp, "\trbml_disk_reset(m, %d, %d);\n", arg1, arg2); break;
+	case OP_OPEN:	fprintf(fp, "\trbml_disk_open(m, %d);\n", arg1); break;
+	case OP_CLOS:	fprintf(fp, "\trbml_disk_close(m, %d);\n", arg1); break;
+
+	case OP_ADD:	fprintf(fp, "\tacc = rbml_add(%s, %s, &overflow);\n", r1, r2); break;
+	case OP_ADDA:	fprintf(fp, "\tacc = rbml_add(acc, %s, &overflow);\n", r1); break;
+	case OP_ADDJ:	fprintf(fp, "\tacc = rbml_add(jump, %s, &overflow);\n", r1); break;
+
+	case OP_SUB:	fprintf(fp, "\tacc = rbml_sub(%s, %s, &overflow);\n", r1, r2); break;
+	case OP_SUBA:	fprintf(fp, "\tacc = rbml_sub(acc, %s, &overflow);\n", r1); break;
+	case OP_SUBJ:	fprintf(fp, "\tacc = rbml_sub(jump, %s, &overflow);\n", r1); break;
+
+	case OP_DIV:	fprintf(fp, "\tacc = rbml_div(%s, %s, &divzero);\n", r1, r2); break;
+	case OP_DIVA:	fprintf(fp, "\tacc = rbml_div(acc, %s, &divzero);\n", r1); break;
+	case OP_DIVJ:	fprintf(fp, "\tacc = rbml_div(jump, %s, &divzero);\n", r1); break;
+
+	case OP_MULT:	fprintf(fp, "\tacc = rbml_mult(%s, %s, &overflow);\n", r1, r2); break;
+	case OP_MLTA:	fprintf(fp, "\tacc = rbml_mult(acc, %s, &overflow);\n", r1); break;
+	case OP_MLTJ:	fprintf(fp, "\tacc = rbml_mult(jump, %s, &overflow);\n", r1); break;
+
+	case OP_MOD:	fprintf(fp, "\tacc = rbml_mod(%s, %s, &divzero);\n", r1, r2); break;
+	case OP_MODA:	fprintf(fp, "\tacc = rbml_mod(acc, %s, &divzero);\n", r1); break;
+	case OP_MODJ:	fprintf(fp, "\tacc = rbml_mod(jump, %s, &divzero);\n", r1); break;
+
+	case OP_CJNT:	fprintf(fp, "\tacc = %s & %s;\n", r1, r2); break;
+	case OP_CJNA:	fprintf(fp, "\tacc = acc & %s;\n", r1); break;
+	case OP_CJNJ:	fprintf(fp, "\tacc = jump & %s;\n", r1); break;
+
+	case OP_DJNT:	fprintf(fp, "\tacc = %s | %s;\n", r1, r2); break;
+	case OP_DJNA:	fprintf(fp, "\tacc = acc | %s;\n", r1); break;
+	case OP_DJNJ:	fprintf(fp, "\tacc = jump | %s;\n", r1); break;
+
+	case OP_COMP:	fprintf(fp, "\tacc = ~%s;\n", r1); break;
+	case OP_COMPA:	fprintf(fp, "\tacc = ~acc;\n"); break;
+	case OP_COMPJ:	fprintf(fp, "\tacc = ~jump;\n"); break;
+
+	case OP_LSFT:	fprintf(fp, "\tacc = %s << %s;\n", r1, r2); break;
+	case OP_LSFA:	fprintf(fp, "\tacc = acc << %s;\n", r1); break;
+	case OP_LSFJ:	fprintf(fp, "\tacc = jump << %s;\n", r1); break;
+
+	case OP_RSFT:	fprintf(fp, "\tacc = %s >> %s;\n", r1, r2); break;
+	case OP_RSFA:	fprintf(fp, "\tacc = acc >> %s;\n", r1); break;
+	case OP_RSFJ:	fprintf(fp, "\tacc = jump >> %s;\n", r1); break;
+
+	case OP_CMP:	fprintf(fp, "\tCOMPARE(%s, %s);\n", r1, r2); break;
+	case OP_CMPA:	fprintf(fp, "\tCOMPARE(acc, %s);\n", r1); break;
+	case OP_CMPJ:	fprintf(fp, "\tCOMPARE(jump, %s);\n", r1); break;
+	case OP_CMPM:	fprintf(fp, "\tCOMPARE(%s, memory[%d]);\n", r1, arg3); break;
+
+	case OP_BRAN:
+		fprintf(fp, "\t");
+		emit_jump(t, arg3);
+		return 0;
+	case OP_BRGT:
+	case OP_BRLT:
+	case OP_BREQ:
+	case OP_BRGE:
+	case OP_BRLE:
+		fprintf(fp, "\tif (%s) ", condition(op));
+		emit_jump(t, arg3);
+		break;
+
+	case OP_CALL:
+		emit_call(t, addr, arg3, "\t");
+		return 0;
+	case OP_CAGT:
+	case OP_CALT:
+	case OP_CAEQ:
+	case OP_CAGE:
+	case OP_CALE:
+		fprintf(fp, "\tif (%s) {\n", condition(op));
+		emit_call(t, addr, arg3, "\t\t");
+		fprintf(fp, "\t}\n");
+		break;
+	case OP_END:
+		fprintf(fp, "\tpc = jump + 1;\n");
+		fprintf(fp, "\tif (m->call_stack_counter == 0) {\n");
+		fprintf(fp, "\t\tjump = m->call_stack[0];\n");
+		fprintf(fp, "\t\tm->call_stack[0] = 0;\n");
+		fprintf(fp, "\t} else {\n");
+		fprintf(fp, "\t\tjump = m->call_stack[--m->call_stack_counter];\n");
+		fprintf(fp, "\t}\n");
+		fprintf(fp, "\tgoto dispatch;\n");
+		return 0;
+
+	case OP_HALT:
+		fprintf(fp, "\tm->exit_status = RBML_EXIT_HALT;\n\tpc = %zu;\n\tgoto halt;\n", addr);
+		return 0;
+	case OP_HERR:
+		fprintf(fp, "\tm->exit_status = RBML_EXIT_HERR;\n\tpc = %zu;\n\tgoto halt;\n", addr);
+		return 0;
+
+	default:
+		fprintf(fp, "\trbml_machine_flush(m);\n"
+		    "\tfprintf(stderr, \"Unknown opcode %x at %zx\\n\");\n", op, addr);
+		break;
+	}
+
+	return 1;
+}
+
+/**
+ * Write translated program
+ */
+static void
+emit(struct translation *t)
+{
+	FILE *fp = t->fp;
+	size_t addr;
+	char buf[64];
+	int i;
+
+	fprintf(fp, "/*\n * %s translated by rbml2c, do not edit\n */\n\n", t->program_file);
+	fprintf(fp, "#include <stdio.h>\n#include <string.h>\n\n#include \"machine_impl.h\"\n\n");
+	fprintf(fp, "#define MEMORY_SIZE\t%zu\n\n", t->memory_size);
+	fprintf(fp, "#define COMPARE(a, b)\t\t\t\t\t\t\t\\\n"
+	    "\tdo {\t\t\t\t\t\t\t\t\\\n"
+	    "\t\trbml_word _a = (a), _b = (b);\t\t\t\t\\\n"
+	    "\t\tless = _a < _b;\t\t\t\t\t\t\\\n"
+	    "\t\tequal = _a == _b;\t\t\t\t\t\\\n"
+	    "\t\tgreater = _a > _b;\t\t\t\t\t\\\n"
+	    "\t} while (0)\n\n");
+
+	// program image
+	fprintf(fp, "const size_t rbml_program_image_size = %zu;\n", t->image_size);
+	fprintf(fp, "const rbml_word rbml_program_image[%zu] = {", t->image_size);
+	for (addr = 0; addr < t->image_size; addr++)
+		fprintf(fp, "%s0x%08x,", addr % 8 == 0 ? "\n\t" : " ", (unsigned) t->memory[addr]);
+	fprintf(fp, "\n};\n\n");
+
+	// translated code
+	fprintf(fp, "/**\n * Run translated program\n */\nvoid\nrbml_program_run(struct rbml_machine *m)\n{\n");
+	fprintf(fp, "\trbml_word *memory = m->memory;\n");
+	for (i = 0; i < 16; i++)
+		fprintf(fp, "\trbml_word r%d = m->reg[%d];\n", i, i);
+	fprintf(fp, "\trbml_word acc = m->accumulator;\n"
+	    "\trbml_word jump = m->jump;\n"
+	    "\trbml_word less = m->less;\n"
+	    "\trbml_word equal = m->equal;\n"
+	    "\trbml_word greater = m->greater;\n"
+	    "\trbml_word overflow = m->overflow;\n"
+	    "\trbml_word divzero = m->divzero;\n"
+	    "\tint pc = m->instruction_counter;\n\n"
+	    "\t(void) memory;\n\n");
+	fprintf(fp, "\t// translated for one memory size only\n"
+	    "\tif (m->memory_size != MEMORY_SIZE)\n"
+	    "\t\tgoto interpret;\n"
+	    "\tgoto dispatch;\n\n");
+
+	for (addr = 0; addr < t->memory_size; addr++) {
+		if (!(t->flags[addr] & W_REACHABLE))
+			continue;
+
+		rbml_disasm(t->memory[addr], buf, sizeof(buf));
+		if (t->flags[addr] & W_LABEL)
+			fprintf(fp, "L%04zx:\n", addr);
+		fprintf(fp, "\t/* %04zx: %s */\n", addr, buf);
+		if (translate(t, addr) && addr + 1 >= t->memory_size)
+			fprintf(fp, "\tpc = %zu;\n\tgoto out_of_region;\n", addr + 1);
+	}
+
+	// computed jumps
+	fprintf(fp, "\ndispatch:\n\tswitch (pc) {\n");
+	for (addr = 0; addr < t->memory_size; addr++) {
+		if (t->flags[addr] & W_LABEL)
+			fprintf(fp, "\tcase %zu: goto L%04zx;\n", addr, addr);
+	}
+	fprintf(fp, "\t}\n"
+	    "\tif ((size_t) pc >= MEMORY_SIZE)\n"
+	    "\t\tgoto out_of_region;\n"
+	    "\tgoto interpret;\n\n");
+
+	fprintf(fp, "out_of_region:\n"
+	    "\trbml_machine_error(m, \"Instruction counter out of memory region\");\n"
+	    "\tgoto halt;\n\n");
+
+	fprintf(fp, "halt:\n\tm->halted = 1;\n");
+	fprintf(fp, "interpret:\n\tm->instruction_counter = pc;\n");
+	for (i = 0; i < 16; i++)
+		fprintf(fp, "\tm->reg[%d] = r%d;\n", i, i);
+	fprintf(fp, "\tm->accumulator = acc;\n"
+	    "\tm->jump = jump;\n"
+	    "\tm->less = less;\n"
+	    "\tm->equal = equal;\n"
+	    "\tm->greater = greater;\n"
+	    "\tm->overflow = overflow;\n"
+	    "\tm->divzero = divzero;\n\n"
+	    "\tif (!m->halted)\n"
+	    "\t\trbml_machine_run(m);\n"
+	    "\telse\n"
+	    "\t\trbml_machine_flush(m);\n"
+	    "}\n\n");
+
+	// stand alone program
+	fprintf(fp, "#ifndef RBML2C_NO_MAIN\n"
+	    "int\n"
+	    "main(int argc, char *argv[])\n"
+	    "{\n"
+	    "\tstruct rbml_machine *m;\n"
+	    "\tint exit_status;\n\n"
+	    "\tm = rbml_machine_alloc(MEMORY_SIZE);\n"
+	    "\tif (m == NULL) {\n"
+	    "\t\tfprintf(stderr, \"Failed to allocate machine with %%d words of memory\\n\", MEMORY_SIZE);\n"
+	    "\t\treturn 1;\n"
+	    "\t}\n"
+	    "\tmemcpy(m->memory, rbml_program_image, sizeof(rbml_program_image));\n\n"
+	    "\trbml_program_run(m);\n"
+	    "\texit_status = m->exit_status;\n"
+	    "\trbml_machine_free(m);\n\n"
+	    "\treturn exit_status;\n"
+	    "}\n"
+	    "#endif\n");
+}
+
+/**
+ * Main entry point
+ */
+int
+main(int argc, char *argv[])
+{
+	int c;
+	const char *argv0 = argv[0];
+	const char *output_file = NULL;
+	char buf[PATH_MAX + sizeof(".c")];
+	size_t memory_size = RBML_DEFAULT_MEMORY_SIZE;
+	struct rbml_machine *m;
+	struct translation t;
+
+	/*
+	 * Parse command line arguments
+	 */
+	while ((c = getopt(argc, argv, "m:o:h")) != -1) {
+		switch (c) {
+		case 'm':
+			memory_size = atoi(optarg);
+			break;
+		case 'o':
+			output_file = optarg;
+			break;
+		case 'h':
+		default:
+			usage(argv0);
+			/* NOTREACHED */
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) {
+		usage(argv0);
+		/* NOTREACHED */
+	}
+	if (memory_size == 0)
+		die("Memory size must be at least 1 word");
+	if (output_file == NULL) {
+		char *p;
+		char buf2[PATH_MAX];
+
+		/* base name */
+		p = strrchr(argv[0], PATH_SEP);
+		snprintf(buf2, sizeof(buf2), "%s", p != NULL ? p + 1 : argv[0]);
+
+		/* strip extension */
+		if ((p = strrchr(buf2, '.')) != NULL)
+			*p = '\0';
+
+		/* make output file name */
+		snprintf(buf, sizeof(buf), "%s.c", buf2);
+		output_file = buf;
+	}
+
+	/*
+	 * Load program the way the emulator does
+	 */
+	m = rbml_machine_alloc(memory_size);
+	if (m == NULL)
+		die("Failed to allocate machine with %zu words of memory", memory_size);
+	if (rbml_machine_load(m, argv[0]) < 0)
+		exit(1);
+
+	memset(&t, 0, sizeof(t));
+	t.program_file = argv[0];
+	t.memory = m->memory;
+	t.memory_size = m->memory_size;
+	for (t.image_size = t.memory_size; t.image_size > 1; t.image_size--) {
+		if (t.memory[t.image_size - 1] != 0)
+			break;
+	}
+	t.flags = calloc(t.memory_size, sizeof(*t.flags));
+	if (t.flags == NULL)
+		die("Out of memory");
+
+	/*
+	 * Translate
+	 */
+	analyze(&t);
+
+	t.fp = fopen(output_file, "w");
+	if (t.fp == NULL)
+		die("Failed to create %s", output_file);
+	emit(&t);
+	if (fclose(t.fp) != 0)
+		die("Failed to write %s", output_file);
+
+	free(t.flags);
+	rbml_machine_free(m);
+
+	exit(0);
+}
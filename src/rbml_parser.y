@@ -18,6 +18,10 @@ int rbml_lex(YYSTYPE *yylval_param, YYLTYPE *yyloc_param, struct parser *parser,
 
 %}
 
+%code requires {
+#include "symbol.h"
+}
+
 %pure-parser
 %name-prefix "rbml_"
 %param 	{struct parser *parser}
@@ -29,10 +33,10 @@ int rbml_lex(YYSTYPE *yylval_param, YYLTYPE *yyloc_param, struct parser *parser,
 %union {
 	int opcode;
 	int number;
-	char *ident;
+	struct symbol_key ident;
 };
 
-%token WORD
+%token WORD EXPORT
 %token<number> REG DISK NUMBER
 %token<ident> IDENT
 %token<opcode> INST0 INST1A INST1R INST2RR INST2RA INST2NR
@@ -53,21 +57,19 @@ line:
 	| label
 	| instruction
 	| label instruction
+	| export
 	| error
 	;
 
 label:
 	IDENT ':' {
 		struct symbol *s;
-		char *ident = $1;
+		struct symbol_key ident = $1;
 
 		/* check if symbol has been seen */
-		if ((s = code_symbol_lookup(code, ident)) == NULL) {
-			code_symbol_add(code, ident, parser->line_num);
-			free(ident);
+		if ((s = code_symbol_lookup(code, &ident)) == NULL) {
+			code_symbol_add(code, &ident, parser->line_num);
 		} else {
-			free(ident);
-
 			/* check if symbol is already defined */
 			if (s->line_num != 0) {
 				parser_error(parser, "Symbol `%s' already defined at line %u",
@@ -81,25 +83,31 @@ label:
 	}
 	;
 
+export:
+	EXPORT IDENT {
+		struct symbol_key ident = $2;
+
+		code_symbol_export(code, &ident, parser->line_num);
+	}
+	;
+
 instruction:
 	WORD NUMBER { code_emit(code, $2); }
 	| INST0 { code_emit(code, RBML_INST($1, 0, 0, 0)); }
 	| INST1A IDENT {
 		struct symbol *s;
-		char *ident = $2;
+		struct symbol_key ident = $2;
 
-		s = code_symbol_ref(code, ident, parser->line_num);
-		free(ident);
+		s = code_symbol_ref(code, &ident, parser->line_num);
 		code_emit(code, RBML_INST($1, 0, 0, s->offset));
 	}
 	| INST1R REG { code_emit(code, RBML_INST($1, $2, 0, 0)); }
 	| INST2RR REG ',' REG { code_emit(code, RBML_INST($1, $2, $4, 0)); }
 	| INST2RA REG ',' IDENT {
 		struct symbol *s;
-		char *ident = $4;
+		struct symbol_key ident = $4;
 
-		s = code_symbol_ref(code, ident, parser->line_num);
-		free(ident);
+		s = code_symbol_ref(code, &ident, parser->line_num);
 		code_emit(code, RBML_INST($1, $2, 0, s->offset));
 	}
 	| INST2NR NUMBER ',' REG { code_emit(code, RBML_INST($1, $2, $4, 0)); }
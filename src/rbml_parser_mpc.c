@@ -19,6 +19,7 @@ struct parser_data {
 	mpc_parser_t *Program;
 	mpc_parser_t *Line;
 	mpc_parser_t *Label;
+	mpc_parser_t *Export;
 	mpc_parser_t *Instruction;
 	mpc_parser_t *Word;
 	mpc_parser_t *Inst0;
@@ -47,6 +48,7 @@ parser_init(struct parser *p)
 	d->Program = mpc_new("program");
 	d->Line = mpc_new("line");
 	d->Label = mpc_new("label");
+	d->Export = mpc_new("export");
 	d->Instruction = mpc_new("instruction");
 	d->Word = mpc_new("word");
 	d->Inst0 = mpc_new("inst0");
@@ -61,8 +63,9 @@ parser_init(struct parser *p)
 	d->Hex = mpc_new("hex");
 	d->Dec = mpc_new("dec");
 	err = mpca_lang(MPCA_LANG_DEFAULT,
-	    "line: /^/ <label>? <instruction>? /$/;\n"
+	    "line: /^/ (<export> | <label>? <instruction>?) /$/;\n"
 	    "label: <ident> ':';\n"
+	    "export: \"EXPORT\" <ident>;\n"
 	    "instruction: (<word>|<inst0>|<inst1a>|<inst1r>|<inst2rr>|<inst2ra>);\n"
 	    "word: \"WORD\" <number>;\n"
 	    "inst0: (\"END\"|\"HALT\"|\"HERR\");\n"
@@ -80,6 +83,7 @@ parser_init(struct parser *p)
 	    "dec: /[+-]?[0-9]+/;\n",
 	    d->Line,
 	    d->Label,
+	    d->Export,
 	    d->Instruction,
 	    d->Word,
 	    d->Inst0,
@@ -112,6 +116,7 @@ parser_destroy(struct parser *p)
 	mpc_cleanup(1, d->Program);
 	mpc_cleanup(1, d->Line);
 	mpc_cleanup(1, d->Label);
+	mpc_cleanup(1, d->Export);
 	mpc_cleanup(1, d->Instruction);
 	mpc_cleanup(1, d->Word);
 	mpc_cleanup(1, d->Inst0);
@@ -193,15 +198,23 @@ parser_parse_line(struct parser *p, struct code *c, char *line)
 		if (strcmp(a->tag, "label|>") == 0) {
 			struct symbol *s;
 			const char *name = a->children[0]->contents;
-		
+			struct symbol_key key = symbol_key(name, strlen(name));
+
 			/* printf("label [%s]\n", name); */
-			if ((s = code_symbol_lookup(c, name)) != NULL) {
+			if ((s = code_symbol_lookup(c, &key)) == NULL) {
+				code_symbol_add(c, &key, p->line_num);
+			} else if (s->line_num != 0) {
 				parser_error(p, "Symbol `%s' already defined at line %u",
 				    name, s->line_num);
-				continue;
+			} else {
+				/* symbol was referenced or exported before */
+				code_symbol_define(c, s, p->line_num);
 			}
+		} else if (strcmp(a->tag, "export|>") == 0) {
+			const char *name = a->children[1]->contents;
+			struct symbol_key key = symbol_key(name, strlen(name));
 
-			code_symbol_add(c, name, p->line_num);
+			code_symbol_export(c, &key, p->line_num);
 		} else if (strcmp(a->tag, "word|>") == 0) {
 			const char *value = a->children[1]->contents;
 
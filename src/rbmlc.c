@@ -13,7 +13,7 @@
 #include "rbmlc.h"
 #include "rbml.h"
 
-static int compile(const char *output_file, const char *input_file);
+static int compile(const char *output_file, const char *input_file, int relocatable);
 
 /**
  * Print message and die
@@ -46,7 +46,8 @@ usage(const char *argv0)
 	else
 		program_name = argv0;
 
-	die("Usage: %s [-o <output-file>] <input-file>", program_name);
+	die("Usage: %s [-c] [-o <output-file>] <input-file>\n"
+	    "  -c  assemble to a relocatable object (link with rbml-ld)", program_name);
 }
 
 /**
@@ -55,17 +56,20 @@ usage(const char *argv0)
 int
 main(int argc, char *argv[])
 {
-	int c;
+	int c, relocatable = 0;
 	const char *argv0 = argv[0];
 	const char *input_file;
-	const char *output_file;
+	const char *output_file = NULL;
 	char buf[PATH_MAX];
 
 	/*
 	 * Parse command line arguments
 	 */
-	while ((c = getopt(argc, argv, "o:h")) != -1) {
+	while ((c = getopt(argc, argv, "co:h")) != -1) {
 		switch (c) {
+		case 'c':
+			relocatable = 1;
+			break;
 		case 'o':
 			output_file = optarg;
 			break;
@@ -86,7 +90,7 @@ main(int argc, char *argv[])
 	input_file = argv[0];
 	if (output_file == NULL) {
 		char *p;
-		char buf2[PATH_MAX];
+		char buf2[PATH_MAX - sizeof(".rbml")];
 
 		/* base name */
 		p = strrchr(input_file, PATH_SEP);
@@ -97,21 +101,21 @@ main(int argc, char *argv[])
 			*p = '\0';
 
 		/* make output file name */
-		snprintf(buf, sizeof(buf), "%s.rbml", buf2);
+		snprintf(buf, sizeof(buf), "%s%s", buf2, relocatable ? ".rbo" : ".rbml");
 		output_file = buf;
 	}
 
 	/*
 	 * Compile
 	 */
-	if (!compile(output_file, input_file))
+	if (!compile(output_file, input_file, relocatable))
 		exit(1);
 
 	exit(0);
 }
 
 static int
-compile(const char *output_file, const char *input_file)
+compile(const char *output_file, const char *input_file, int relocatable)
 {
 	unsigned num_errors;
 	struct code *c;
@@ -121,10 +125,11 @@ compile(const char *output_file, const char *input_file)
 	 * parse input file
 	 */
 	c = code_alloc();
+	c->relocatable = relocatable;
 
 	p = parser_alloc(input_file);
 	parser_parse(p, c);
-	code_check_refs(c, p);
+	code_resolve_refs(c, p);
 	num_errors = p->num_errors;
 	parser_free(p);
 
@@ -132,7 +137,10 @@ compile(const char *output_file, const char *input_file)
 	 * write output file
 	 */
 	if (num_errors == 0) {
-		code_write(c, output_file);
+		if (relocatable)
+			code_write_object(c, output_file);
+		else
+			code_write(c, output_file);
 	} else {
 		printf("Total %d errors\n", num_errors);
 	}
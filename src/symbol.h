@@ -7,56 +7,55 @@
 #ifndef _SYMBOL_H_
 #define _SYMBOL_H_
 
+#include <stddef.h>
+
+#include "arena.h"
 #include "rbml.h"
-#include "tree.h"
-#include "queue.h"
 
-struct symbol_ref;
-struct parser;
+/**
+ * Symbol name as scanned (not NUL terminated), hashed once by the scanner
+ */
+struct symbol_key {
+	const char *name;	/**< name */
+	unsigned len;		/**< name length */
+	unsigned hash;		/**< name hash (see symbol_key()) */
+};
 
 /**
  * Symbol
  */
 struct symbol {
-	/* should be first member */
-	const char *name;	/**< symbol name */
+	const char *name;	/**< symbol name (interned, NUL terminated) */
+	unsigned len;		/**< name length */
+	unsigned hash;		/**< name hash */
+	unsigned id;		/**< index in the code's symbols by id */
 	unsigned line_num;	/**< source line where the symbol is defined
 				     (0 for forward referenced symbols */
+	unsigned export_line;	/**< source line of its EXPORT (0: not
+				     exported) */
 
 	unsigned offset;	/**< program text offset */
-
-	RB_ENTRY(symbol) link;
-	SLIST_HEAD(, symbol_ref) symbol_refs;
 };
 
 /**
- * Allocate symbol
- */
-struct symbol *symbol_alloc(const char *name, unsigned line_num, unsigned offset);
-
-/**
- * Free symbol
- */
-void symbol_free(struct symbol *s);
-
-/**
- * Compare symbols
+ * Make symbol key: hash name of len bytes
  */
-int symbol_cmp(struct symbol *a, struct symbol *b);
+struct symbol_key symbol_key(const char *name, size_t len);
 
 /**
- * Reference symbol
+ * Allocate symbol from arena, interning its name
  */
-void symbol_ref(struct symbol *s, unsigned line_num, unsigned offset);
+struct symbol *symbol_alloc(struct arena *a, const struct symbol_key *key, unsigned id,
+    unsigned line_num, unsigned offset);
 
 /**
- * Define referenced symbol
+ * Compare symbols by name (for qsort() on an array of symbol pointers)
  */
-void symbol_define(struct symbol *s, unsigned line_num, unsigned offset, rbml_word *text);
+int symbol_cmp(const void *a, const void *b);
 
 /**
- * Check symbol refs
+ * Define symbol
  */
-void symbol_check_refs(struct symbol *s, struct parser *p);
+void symbol_define(struct symbol *s, unsigned line_num, unsigned offset);
 
 #endif /* _SYMBOL_H_ */
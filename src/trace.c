@@ -0,0 +1,111 @@
+/**
+ * RBML machine: instruction trace ring buffer
+ *
+ * The traced engine (engine_traced.c) records every instruction it
+ * executes here: address, instruction word and the register it wrote.
+ * The ring buffer is written out as a binary trace file, to be read back
+ * with rbml-trace.
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "machine_impl.h"
+
+/**
+ * Trace every instruction executed into a ring buffer
+ */
+int
+rbml_machine_trace(struct rbml_machine *m, size_t records)
+{
+	struct rbml_trace *t;
+	size_t size;
+
+	if (m->trace != NULL) {
+		free((void *) m->trace->records);
+		free(m->trace);
+		m->trace = NULL;
+	}
+	if (records == 0)
+		return 0;
+
+	for (size = 1; size < records; size <<= 1)
+		;
+	if ((t = calloc(1, sizeof(*t))) == NULL)
+		return -1;
+	if ((t->records = calloc(size, sizeof(*t->records))) == NULL) {
+		free(t);
+		return -1;
+	}
+	t->mask = size - 1;
+	m->trace = t;
+
+	return 0;
+}
+
+/**
+ * Write whole buffer to fd
+ */
+static int
+write_all(int fd, const void *buf, size_t size)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (size > 0) {
+		if ((n = write(fd, p, size)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * Write trace file (header and records) to fd
+ */
+int
+rbml_machine_trace_dump(const struct rbml_machine *m, int fd)
+{
+	const struct rbml_trace *t = m->trace;
+	const struct rbml_trace_record *records;
+	struct rbml_trace_header hdr;
+	uint64_t total, first;
+	size_t size, start, n;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, RBML_TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.record_size = sizeof(struct rbml_trace_record);
+	if (t == NULL)
+		return write_all(fd, &hdr, sizeof(hdr));
+
+	// the pending record is the instruction that was running (or crashed)
+	total = t->head + (t->pending ? 1 : 0);
+	size = t->mask + 1;
+	first = total > size ? total - size : 0;
+	hdr.records = total - first;
+	hdr.total = total;
+	if (write_all(fd, &hdr, sizeof(hdr)) < 0)
+		return -1;
+
+	// oldest first: from the ring position of the first record to the end, then wrap
+	records = (const struct rbml_trace_record *) t->records;
+	start = first & t->mask;
+	n = total - first;
+	if (start + n > size) {
+		if (write_all(fd, records + start, (size - start) * sizeof(*records)) < 0)
+			return -1;
+		n -= size - start;
+		start = 0;
+	}
+
+	return write_all(fd, records + start, n * sizeof(*records));
+}
@@ -0,0 +1,282 @@
+/**
+ * RBML machine: static program verifier
+ *
+ * Follows every word the loaded program can execute from its start or
+ * from where the machine is, the same way rbml2c does, and proves that none of them can
+ * take the machine out of its memory region: no memory operand or branch
+ * target out of memory, no falling through the last word, no store into
+ * code (stores take their address from ARG3, so every store target is
+ * known) and no write to the jump register (so END only returns to the
+ * word after a CALL). A verified program runs on the reference engine
+ * without its per step checks.
+ *
+ * Programs are verified on every load and restore, so the cost follows the
+ * reachable words, not main memory: they are kept in a hash set. A zero
+ * word stores into word 0, which is always code, so a reachable one fails
+ * verification and is not fallen through (memory past the image would
+ * otherwise be walked to its end).
+ *
+ * @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "machine_impl.h"
+
+/**
+ * Number of problems reported before the rest are only counted
+ */
+#define REPORT_MAX	20
+
+/**
+ * Initial size of the reachable set (slots, a power of 2)
+ */
+#define SET_INITIAL	1024
+
+/**
+ * Empty slot of the reachable set
+ */
+#define SET_EMPTY	SIZE_MAX
+
+/**
+ * Verifier state
+ */
+struct verifier {
+	const struct rbml_machine *m;
+	size_t *reachable;		/**< reachable words: open addressing
+					     set of addresses */
+	size_t set_size;		/**< slots */
+	size_t *words;			/**< reachable words, in the order
+					     reached */
+	size_t num_words;
+	size_t *stack;			/**< words to visit */
+	size_t sp;
+	size_t allocated;		/**< words and stack entries */
+	FILE *report;
+	int problems;
+	int failed;			/**< out of memory */
+};
+
+/**
+ * Report problem at address
+ */
+static void
+problem(struct verifier *v, size_t addr, const char *reason)
+{
+	char insn[32];
+
+	if (++v->problems > REPORT_MAX || v->report == NULL)
+		return;
+	if (addr < v->m->memory_size) {
+		rbml_disasm(v->m->memory[addr], insn, sizeof(insn));
+		fprintf(v->report, "%04zx: %s: %s\n", addr, insn, reason);
+	} else {
+		fprintf(v->report, "%04zx: %s\n", addr, reason);
+	}
+}
+
+/**
+ * Get slot of address in the reachable set
+ */
+static size_t *
+set_slot(size_t *set, size_t size, size_t addr)
+{
+	size_t i = (addr * 0x9e3779b97f4a7c15ULL) >> 16;
+
+	for (;; i++) {
+		i &= size - 1;
+		if (set[i] == addr || set[i] == SET_EMPTY)
+			return &set[i];
+	}
+}
+
+/**
+ * Is word reachable
+ */
+static int
+is_reachable(const struct verifier *v, size_t addr)
+{
+	return *set_slot(v->reachable, v->set_size, addr) == addr;
+}
+
+/**
+ * Make room for one more reachable word
+ */
+static int
+set_grow(struct verifier *v)
+{
+	size_t *set, *words, *stack, i;
+
+	if (2 * (v->num_words + 1) > v->set_size) {
+		if ((set = malloc(2 * v->set_size * sizeof(*set))) == NULL)
+			return -1;
+		for (i = 0; i < 2 * v->set_size; i++)
+			set[i] = SET_EMPTY;
+		for (i = 0; i < v->num_words; i++)
+			*set_slot(set, 2 * v->set_size, v->words[i]) = v->words[i];
+		free(v->reachable);
+		v->reachable = set;
+		v->set_size *= 2;
+	}
+	if (v->num_words == v->allocated) {
+		if ((words = realloc(v->words, 2 * v->allocated * sizeof(*words))) == NULL)
+			return -1;
+		v->words = words;
+		if ((stack = realloc(v->stack, 2 * v->allocated * sizeof(*stack))) == NULL)
+			return -1;
+		v->stack = stack;
+		v->allocated *= 2;
+	}
+
+	return 0;
+}
+
+/**
+ * Compare addresses
+ */
+static int
+addr_cmp(const void *a, const void *b)
+{
+	size_t x = *(const size_t *) a, y = *(const size_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Does instruction write the jump register (CALL and END aside)
+ */
+static int
+writes_jump(rbml_word w)
+{
+	int op = RBML_OPCODE(w);
+
+	return op != OP_END && !rbml_is_branch(w) && rbml_trace_reg(w) == RBML_TRACE_JUMP;
+}
+
+/**
+ * Mark word reachable
+ */
+static void
+reach(struct verifier *v, size_t from, size_t addr, const char *reason)
+{
+	if (addr >= v->m->memory_size) {
+		problem(v, from, reason);
+		return;
+	}
+	if (v->failed || is_reachable(v, addr))
+		return;
+	if (set_grow(v) < 0) {
+		v->failed = 1;
+		return;
+	}
+	*set_slot(v->reachable, v->set_size, addr) = addr;
+	v->words[v->num_words++] = addr;
+	v->stack[v->sp++] = addr;
+}
+
+/**
+ * Verify loaded program
+ */
+int
+rbml_machine_verify(struct rbml_machine *m, FILE *report)
+{
+	struct verifier v;
+	size_t addr, i, n;
+	rbml_word w;
+	int op, ends = 0;
+
+	v.m = m;
+	v.set_size = SET_INITIAL;
+	v.reachable = malloc(v.set_size * sizeof(*v.reachable));
+	v.allocated = SET_INITIAL;
+	v.words = malloc(v.allocated * sizeof(*v.words));
+	v.stack = malloc(v.allocated * sizeof(*v.stack));
+	v.num_words = 0;
+	v.sp = 0;
+	v.report = report;
+	v.problems = 0;
+	v.failed = 0;
+	m->verified = 0;
+	if (v.reachable == NULL || v.words == NULL || v.stack == NULL) {
+		free(v.reachable);
+		free(v.words);
+		free(v.stack);
+		return -1;
+	}
+	for (i = 0; i < v.set_size; i++)
+		v.reachable[i] = SET_EMPTY;
+
+	// the program start (the machine may be reset), where the machine is
+	// and where END can return to
+	reach(&v, 0, 0, "Empty memory");
+	reach(&v, m->instruction_counter, m->instruction_counter, "Instruction counter out of memory region");
+	reach(&v, (size_t) m->jump + 1, (size_t) m->jump + 1, "Return address out of memory region");
+	n = m->call_stack_counter > 0 ? m->call_stack_counter : 1;
+	for (i = 0; i < n && i < m->call_stack_size; i++)
+		reach(&v, (size_t) m->call_stack[i] + 1, (size_t) m->call_stack[i] + 1, "Return address out of memory region");
+
+	while (v.sp > 0) {
+		addr = v.stack[--v.sp];
+		w = m->memory[addr];
+		op = RBML_OPCODE(w);
+
+		if (rbml_is_memory_operand(w) && RBML_ARG3(w) >= m->memory_size)
+			problem(&v, addr, "Memory address out of memory region");
+		if (writes_jump(w))
+			problem(&v, addr, "Writes jump register");
+
+		if (rbml_is_branch(w))
+			reach(&v, addr, RBML_ARG3(w), "Branch target out of memory region");
+
+		switch (op) {
+		case OP_BRAN:
+		case OP_HALT:
+		case OP_HERR:
+			break;
+
+		case OP_END:
+			// an END with nothing on the call stack pops a zero
+			ends = 1;
+			break;
+
+		default:
+			// a zero word is a store into code (below)
+			if (w != 0)
+				reach(&v, addr, addr + 1, "Falls through out of memory region");
+			break;
+		}
+
+		if (v.sp == 0 && ends) {
+			reach(&v, addr, 1, "Return address out of memory region");
+			ends = 0;
+		}
+	}
+
+	// stores into code: the program modifies itself
+	qsort(v.words, v.num_words, sizeof(*v.words), addr_cmp);
+	for (i = 0; i < v.num_words && !v.failed; i++) {
+		addr = v.words[i];
+		w = m->memory[addr];
+		op = RBML_OPCODE(w);
+		if (!rbml_is_memory_operand(w))
+			continue;
+		if (op != OP_STO && op != OP_STOA && op != OP_STOJ && op != OP_CRDM && op != OP_FRDM)
+			continue;
+		if (RBML_ARG3(w) < m->memory_size && is_reachable(&v, RBML_ARG3(w)))
+			problem(&v, addr, "Stores into code");
+	}
+
+	if (v.problems > REPORT_MAX && report != NULL)
+		fprintf(report, "(%d more problems)\n", v.problems - REPORT_MAX);
+
+	free(v.reachable);
+	free(v.words);
+	free(v.stack);
+	if (v.failed)
+		return -1;
+
+	m->verified = v.problems == 0;
+	return m->verified;
+}
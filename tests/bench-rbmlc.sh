@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+# Assembler benchmark: wall time and peak RSS of rbmlc on a generated
+# source, a label every 8 lines and a forward or backward reference every
+# other line
+#
+#	bench-rbmlc.sh [<rbmlc> [<lines>]]
+#
+# @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+#
+
+RBMLC=${1:-../src/rbmlc}
+LINES=${2:-1000000}
+
+[ -x "$RBMLC" ] || { echo "$RBMLC: not built" >&2; exit 1; }
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+awk -v lines="$LINES" 'BEGIN {
+	for (i = 0; i < lines; i += 4) {
+		l = int(i / 8);
+		if (i % 8 == 0)
+			printf "label_%d_x:", l;
+		printf "\tLOD r1, label_%d_x\n", l + 3;
+		printf "\tADD r1, r2\n";
+		printf "\tBRLT label_%d_x\n", l;
+		printf "\tCMP r1, r3\n";
+	}
+	# forward references past the last label
+	for (i = l + 1; i <= l + 3; i++)
+		printf "label_%d_x:\tHALT\n", i;
+}' > "$tmp/bench.asm"
+
+echo "$(wc -l < "$tmp/bench.asm") lines"
+
+# wall time and peak RSS of the child, from GNU time or getrusage()
+if /usr/bin/time -f x true > /dev/null 2>&1; then
+	/usr/bin/time -f "%e s, %M KB peak RSS" "$RBMLC" -o "$tmp/bench.rbml" "$tmp/bench.asm"
+else
+	python3 - "$RBMLC" -o "$tmp/bench.rbml" "$tmp/bench.asm" <<'EOF'
+import os, sys, time
+t = time.monotonic()
+pid = os.fork()
+if pid == 0:
+    os.execv(sys.argv[1], sys.argv[1:])
+_, status, ru = os.wait4(pid, 0)
+print("%.2f s, %d KB peak RSS" % (time.monotonic() - t, ru.ru_maxrss))
+sys.exit(os.waitstatus_to_exitcode(status))
+EOF
+fi
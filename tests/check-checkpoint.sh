@@ -0,0 +1,33 @@
+#
+# Regression tests, sourced by check.sh: checkpoint, restore and continue.
+# The restored run must end the way the full run did, with the full run's
+# instruction count. A checkpoint does not hold the disks, so the restored
+# run gets the disk as the run that wrote the checkpoint left it.
+#
+# @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+#
+
+# addresses to checkpoint at: in loops, the deepest point of recurse.asm
+# and the middle of the disk file of disk.asm
+CHECKPOINTS="0 1 3 5 8 10 13 17 21"
+
+for p in $PROGRAMS; do
+	run full -s -m 2000 "$p.rbml"
+	count=$(grep "instructions in" full.err | cut -d ' ' -f 1)
+	for a in $CHECKPOINTS; do
+		rm -f ck
+		run ck -m 2000 --checkpoint-at "$a" --checkpoint-file ck "$p.rbml"
+		same full ck "$p checkpoint at $a"
+		[ -f ck ] || continue
+		DISK=ck.disk
+		for e in table fast jit; do
+			run restored -s -e "$e" --restore ck
+			n=$(grep "instructions in" restored.err | cut -d ' ' -f 1)
+			[ "$n" = "$count" ] || fail "$p restored at $a by $e: $n instructions, expected $count"
+			cmp -s full.status restored.status || fail "$p restored at $a by $e: exit status"
+			tail -c "$(wc -c < restored.out)" full.out | cmp -s - restored.out \
+			    || fail "$p restored at $a by $e: output is not the end of the full output"
+		done
+		DISK=
+	done
+done
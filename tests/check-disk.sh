@@ -0,0 +1,18 @@
+#
+# Regression tests, sourced by check.sh: disk.asm writes a file through
+# OPEN/FWRT/CLOS and reads it back with FRDR across the disk windows. Every
+# engine, with and without the disk I/O thread, must give the output and
+# disk contents of the table engine without it.
+#
+# @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+#
+
+run disk.ref -e table disk.rbml
+[ "$(cat disk.ref.out)" = 140000 ] || fail "disk: read back $(cat disk.ref.out)"
+for e in table fast jit; do
+	for a in "" -A; do
+		run disk $a -e "$e" disk.rbml
+		same disk.ref disk "disk -e $e $a"
+		cmp -s disk.ref.disk disk.disk || fail "disk -e $e $a: disk contents differ"
+	done
+done
@@ -0,0 +1,30 @@
+#
+# Regression tests, sourced by check.sh: every engine and the trace and
+# profile runs against the table engine, same output and exit status
+#
+# @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+#
+
+# run configurations compared with the table engine
+RUNS="-e_fast -e_jit -d -p -A"
+
+for p in $PROGRAMS; do
+	run ref -e table "$p.rbml"
+	for r in $RUNS; do
+		run "$p" $(echo "$r" | tr _ ' ') "$p.rbml"
+		same ref "$p" "$p $r"
+	done
+done
+
+# a call stack limit a word short of the deepest call of recurse.asm
+for e in table fast jit; do
+	run limit -e "$e" -c 49 recurse.rbml
+	[ "$(cat limit.status)" = 1 ] || fail "recurse -c 49 -e $e: exit status $(cat limit.status)"
+done
+
+# program output flushed before a machine error, on every engine
+for e in table fast jit; do
+	"$RBML" -e "$e" fall.rbml > "fall.$e.both" 2>&1
+done
+cmp -s fall.table.both fall.fast.both || fail "fall -e fast: output and errors interleave differently"
+cmp -s fall.table.both fall.jit.both || fail "fall -e jit: output and errors interleave differently"
@@ -0,0 +1,15 @@
+#
+# Regression tests, sourced by check.sh: objects from rbmlc -c linked in
+# order by rbml-ld give the image of their sources assembled as one file
+#
+# @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+#
+
+"$RBMLC" -c -o link_main.rbo "$TESTS/link_main.asm" || fail "rbmlc -c link_main.asm"
+"$RBMLC" -c -o link_lib.rbo "$TESTS/link_lib.asm" || fail "rbmlc -c link_lib.asm"
+"$RBML_LD" -o linked.rbml link_main.rbo link_lib.rbo || fail "rbml-ld"
+cat "$TESTS/link_main.asm" "$TESTS/link_lib.asm" > link_all.asm
+"$RBMLC" -o link_all.rbml link_all.asm || fail "rbmlc link_all.asm"
+cmp -s linked.rbml link_all.rbml || fail "linked image differs from the single-file image"
+run linked linked.rbml
+[ "$(tail -n 1 linked.out)" = 121 ] || fail "linked program printed $(tail -n 1 linked.out)"
@@ -0,0 +1,79 @@
+#!/bin/sh
+#
+# Regression tests: assemble the programs in this directory, then run the
+# check-*.sh parts on them in this shell and a scratch directory
+#
+#	check.sh [<bin-dir>]
+#
+# @author Zachary Bricker <zbricker@my.harrisburgu.edu>
+#
+
+BIN=$(cd "${1:-../src}" && pwd) || exit 1
+TESTS=$(cd "$(dirname "$0")" && pwd)
+RBML=$BIN/rbml
+RBMLC=$BIN/rbmlc
+RBML_LD=$BIN/rbml-ld
+
+# programs run by every engine
+PROGRAMS="hello forward_ref recurse loop selfmod herr disk fall"
+
+# sources rbmlc must reject
+INVALID="duplicate_label invalid_syntax"
+
+failed=0
+DISK=
+
+fail()
+{
+	echo "FAIL: $*"
+	failed=$((failed + 1))
+}
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+cd "$tmp" || exit 1
+
+# run program with options in the scratch directory, disk 3 starting
+# empty or as $DISK
+# output: $1.out, $1.err, $1.disk and the exit status in $1.status
+run()
+{
+	name=$1
+	shift
+	if [ -n "$DISK" ]; then
+		cp "$DISK" disk3.rbdi
+	else
+		: > disk3.rbdi
+	fi
+	"$RBML" "$@" > "$name.out" 2> "$name.err"
+	echo $? > "$name.status"
+	mv disk3.rbdi "$name.disk"
+}
+
+# compare two runs of the same program
+same()
+{
+	cmp -s "$1.out" "$2.out" || fail "$3: output differs"
+	cmp -s "$1.status" "$2.status" || fail "$3: exit status $(cat "$2.status"), expected $(cat "$1.status")"
+}
+
+#
+# Assembler
+#
+for p in $PROGRAMS; do
+	"$RBMLC" -o "$p.rbml" "$TESTS/$p.asm" || fail "rbmlc $p.asm"
+done
+for p in $INVALID; do
+	"$RBMLC" -o "$p.rbml" "$TESTS/$p.asm" > /dev/null 2>&1 && fail "rbmlc accepted $p.asm"
+done
+
+# the parts, sourced with the helpers above
+for part in "$TESTS"/check-*.sh; do
+	. "$part"
+done
+
+if [ $failed -gt 0 ]; then
+	echo "$failed failed"
+	exit 1
+fi
+echo "All tests passed"
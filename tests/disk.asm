@@ -0,0 +1,41 @@
+; write 1..n-1 to disk 3, read it back across the disk windows, print the
+; last word read; HERR on a mismatch. The read goes on at rest (address
+; 21) from the middle of the file, a place to checkpoint at.
+	LOD	r1, one
+	LOD	r3, one
+	LOD	r4, n
+	LOD	r5, mid
+	WORD	0xc0300000		; OPEN d3
+wloop:	WORD	0xbb310000		; FWRT d3, r1
+	ADD	r1, r3
+	MOVA	1, r1
+	CMP	r1, r4
+	BRLT	wloop
+	WORD	0xc1300000		; CLOS d3
+
+	WORD	0xc0300000		; OPEN d3
+	LOD	r1, one
+rloop:	WORD	0xb8320000		; FRDR d3, r2
+	CMP	r2, r1
+	BREQ	next
+	HERR
+next:	ADD	r1, r3
+	MOVA	1, r1
+	CMP	r1, r5
+	BRLT	rloop
+
+rest:	WORD	0xb8320000		; FRDR d3, r2
+	CMP	r2, r1
+	BREQ	next2
+	HERR
+next2:	ADD	r1, r3
+	MOVA	1, r1
+	CMP	r1, r4
+	BRLT	rest
+	WORD	0xc1300000		; CLOS d3
+	WRIT	0, r2
+	HALT
+
+one:	WORD	1
+mid:	WORD	100000
+n:	WORD	140001
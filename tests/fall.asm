@@ -0,0 +1,5 @@
+; print, then run off the end of memory: the output must come before the
+; machine error
+	LOD	r1, v
+	WRIT	0, r1
+v:	WORD	0x7e000000		; unknown opcode, then zeros (STO r0, 0)
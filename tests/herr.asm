@@ -0,0 +1,6 @@
+; print a value, then stop with HERR
+	LOD	r1, v
+	WRIT	0, r1
+	HERR
+
+v:	WORD	0xffffffef
@@ -0,0 +1,8 @@
+; square of r1 into r2
+	EXPORT	square
+	EXPORT	count
+square:	MULT	r1, r1
+	MOVA	1, r2
+	END
+
+count:	WORD	12
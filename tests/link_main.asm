@@ -0,0 +1,13 @@
+; linked with link_lib.asm: prints the squares of 1..count-1
+	LOD	r1, one
+	LOD	r3, one
+loop:	CALL	square
+	WRIT	0, r2
+	ADD	r1, r3
+	MOVA	1, r1
+	LOD	r4, count
+	CMP	r1, r4
+	BRLT	loop
+	HALT
+
+one:	WORD	1
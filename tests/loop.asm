@@ -0,0 +1,28 @@
+; nested loops: sum of i * j mod 7 over i, j < n, printed per row
+	LOD	r3, one
+	LOD	r4, n
+	LOD	r7, seven
+	LOD	r1, zero
+row:	LOD	r2, zero
+	LOD	r5, zero
+col:	MULT	r1, r2
+	MOVA	1, r6
+	MOD	r6, r7
+	MOVA	1, r6
+	ADD	r5, r6
+	MOVA	1, r5
+	ADD	r2, r3
+	MOVA	1, r2
+	CMP	r2, r4
+	BRLT	col
+	WRIT	0, r5
+	ADD	r1, r3
+	MOVA	1, r1
+	CMP	r1, r4
+	BRLT	row
+	HALT
+
+zero:	WORD	0
+one:	WORD	1
+seven:	WORD	7
+n:	WORD	40
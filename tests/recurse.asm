@@ -0,0 +1,27 @@
+; recursive countdown: depth in r1, calls counted in r2 and printed
+	LOD	r1, n1
+	LOD	r3, one
+	CALL	rec
+	WRIT	0, r2
+	LOD	r1, n2
+	CALL	rec
+	WRIT	0, r2
+	HALT
+
+rec:	ADD	r2, r3
+	MOVA	1, r2
+	CMP	r1, r0
+	BREQ	out
+	SUB	r1, r3
+	MOVA	1, r1
+	CALL	rec
+	CALL	leaf
+out:	END
+
+leaf:	ADD	r2, r3
+	MOVA	1, r2
+	END
+
+one:	WORD	1
+n1:	WORD	50
+n2:	WORD	20
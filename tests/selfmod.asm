@@ -0,0 +1,27 @@
+; self-modifying code: the instruction at slot is rewritten every pass,
+; incrementing for the first half of the passes, decrementing after
+	LOD	r1, zero
+	LOD	r3, one
+	LOD	r4, n
+	LOD	r5, half
+	LOD	r6, zero
+loop:	LOD	r2, inc
+	CMP	r1, r5
+	BRLT	patch
+	LOD	r2, dec
+patch:	STO	r2, slot
+slot:	HERR
+	MOVA	1, r6
+	ADD	r1, r3
+	MOVA	1, r1
+	CMP	r1, r4
+	BRLT	loop
+	WRIT	0, r6
+	HALT
+
+inc:	ADD	r6, r3
+dec:	SUB	r6, r3
+zero:	WORD	0
+one:	WORD	1
+half:	WORD	1500
+n:	WORD	2000